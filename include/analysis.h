@@ -0,0 +1,114 @@
+#pragma once
+
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "chip8.h"
+#include "symbols.h"
+#include <stdio.h>
+
+/* Static ROM analysis: follows every path from the entry point through jumps, calls, skips and returns without
+ * running the program, and sorts the ROM bytes into code and data. Paths through BNNN are not followed */
+
+/* Byte flags of the memory map */
+#define ANALYSIS_CODE 0x01     /* First byte of a reachable instruction */
+#define ANALYSIS_OPERAND 0x02  /* Other bytes of a reachable instruction */
+#define ANALYSIS_DATA 0x04     /* Read through I: sprites, FX65, 5XY3, F002 */
+#define ANALYSIS_WRITTEN 0x08  /* Written through I: FX33, FX55, 5XY2 */
+#define ANALYSIS_LEADER 0x10   /* First instruction of a basic block */
+#define ANALYSIS_DATA_REF 0x20 /* Target of ANNN or F000 NNNN */
+
+enum analysis_edge_kind
+{
+    ANALYSIS_EDGE_FALLTHROUGH, /* Into the next block */
+    ANALYSIS_EDGE_JUMP,        /* 1NNN */
+    ANALYSIS_EDGE_CALL,        /* 2NNN, the callee */
+    ANALYSIS_EDGE_RETURN_SITE, /* 2NNN, where the callee's 00EE comes back to */
+    ANALYSIS_EDGE_SKIP,        /* Skip taken */
+    ANALYSIS_EDGE_KIND_COUNT,
+};
+
+/* Block flags */
+#define ANALYSIS_BLOCK_RETURN 0x01   /* Ends with 00EE */
+#define ANALYSIS_BLOCK_EXIT 0x02     /* Ends with 00FD */
+#define ANALYSIS_BLOCK_INDIRECT 0x04 /* Ends with BNNN */
+#define ANALYSIS_BLOCK_HALT 0x08     /* Ends with an unknown opcode or runs off the ROM */
+#define ANALYSIS_BLOCK_LOOP 0x10     /* Header of a loop, the target of a back edge */
+
+enum analysis_issue_kind
+{
+    ANALYSIS_UNKNOWN_OPCODE, /* Reachable opcode the interpreter rejects */
+    ANALYSIS_MACHINE_CODE,   /* 0NNN, the interpreter ignores it */
+    ANALYSIS_SELF_MODIFYING, /* FX33, FX55 or 5XY2 may write over code */
+    ANALYSIS_INDIRECT_JUMP,  /* BNNN, targets are not followed */
+    ANALYSIS_OUTSIDE_ROM,    /* Control flow leaves the ROM, e.g. into code built at runtime */
+    ANALYSIS_ISSUE_KIND_COUNT,
+};
+
+/* Instruction set a ROM needs, from the instructions on its reachable paths and its size */
+enum analysis_platform
+{
+    ANALYSIS_CHIP8,
+    ANALYSIS_SCHIP,  /* Reaches a SUPER-CHIP instruction */
+    ANALYSIS_XOCHIP, /* Reaches an XO-CHIP instruction or does not fit in 4 KB */
+};
+
+struct analysis_edge
+{
+    uint16_t to;
+    enum analysis_edge_kind kind;
+    uint8_t back; /* Closes a loop */
+};
+
+/* Straight-line run of instructions entered at the top only */
+struct analysis_block
+{
+    uint16_t start;
+    uint16_t end; /* Address after the last instruction */
+    uint8_t flags;
+    uint8_t edge_count;
+    struct analysis_edge edges[2];
+};
+
+struct analysis_issue
+{
+    enum analysis_issue_kind kind;
+    uint16_t address;
+    uint16_t opcode;
+    uint16_t target; /* First byte written, for ANALYSIS_SELF_MODIFYING */
+};
+
+struct analysis
+{
+    uint16_t start; /* Entry point and first ROM byte */
+    uint32_t end;   /* Address after the last ROM byte */
+    uint8_t map[MAX_MEMORY];
+    enum analysis_platform platform;
+
+    struct analysis_block *blocks; /* Sorted by address */
+    uint32_t block_count;
+    struct analysis_issue *issues; /* Sorted by address */
+    uint32_t issue_count;
+    uint32_t issue_capacity;
+};
+
+/* Analyze a loaded ROM
+ * @param start Entry point, where the ROM was loaded
+ * @param size ROM size in bytes, see chip8_load_rom
+ * @return 0 if out of memory */
+int8_t analysis_run(struct analysis *analysis, const struct chip8 *chip8, uint16_t start, uint32_t size);
+/* Free the blocks and issues */
+void analysis_free(struct analysis *analysis);
+/* @return Number of issues of a kind */
+uint32_t analysis_count_issues(const struct analysis *analysis, enum analysis_issue_kind kind);
+const char *analysis_issue_name(enum analysis_issue_kind kind);
+const char *analysis_edge_name(enum analysis_edge_kind kind);
+const char *analysis_platform_name(enum analysis_platform platform);
+
+/* Write the code/data map, the blocks with their successors, the loops and the issues as one JSON object */
+void analysis_write_json(const struct analysis *analysis, const struct chip8 *chip8, FILE *out);
+/* Write the control-flow graph in Graphviz DOT
+ * @param symbols Labels used to name blocks, may be NULL */
+void analysis_write_dot(const struct analysis *analysis, const struct symbols *symbols, FILE *out);
+
+#endif /* ANALYSIS_H */
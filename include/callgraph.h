@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include "chip8.h"
+#include "symbols.h"
+#include <stdio.h>
+
+/* One distinct CHIP8 call stack */
+struct callgraph_node
+{
+    uint16_t address;      /* Entry address of the subroutine */
+    uint32_t parent;       /* Index of the caller's node */
+    uint32_t first_child;  /* Index of the first callee, 0 if none */
+    uint32_t next_sibling; /* Index of the next callee of the same caller, 0 if none */
+    uint64_t cycles;       /* Instructions executed with this exact stack */
+};
+
+/* Guest call-graph profiler, follows the CHIP8 stack through 2NNN/00EE */
+struct callgraph
+{
+    struct callgraph_node *nodes; /* Node 0 is the program entry point */
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t current; /* Node of the stack being executed */
+};
+
+/* Setup the profiler, the root frame is named after the entry point
+ * @return 0 if out of memory */
+int8_t callgraph_init(struct callgraph *callgraph, uint16_t entry_address);
+/* Free the profiler */
+void callgraph_free(struct callgraph *callgraph);
+/* Follow a change of the stack pointer, called by callgraph_cycle */
+void callgraph_update(struct callgraph *callgraph, const struct chip8 *chip8, uint8_t previous_sp);
+/* Write one "frame;frame;frame count" line per stack, the folded format read by flamegraph.pl and speedscope
+ * @param symbols Labels used to name frames, may be NULL */
+void callgraph_write_folded(const struct callgraph *callgraph, const struct symbols *symbols, FILE *out);
+
+/* Emulate one instruction cycle with chip8_cycle and charge it to the current stack */
+static inline void callgraph_cycle(struct callgraph *callgraph, struct chip8 *chip8)
+{
+    uint8_t sp = chip8->SP;
+
+    callgraph->nodes[callgraph->current].cycles++;
+    chip8_cycle(chip8);
+
+    if (chip8->SP != sp)
+        callgraph_update(callgraph, chip8, sp);
+}
+
+#endif /* CALLGRAPH_H */
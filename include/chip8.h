@@ -3,33 +3,49 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 
+#include "profile.h"
+#include "trace.h"
 #include <stdint.h>
 
-#define DISPLAY_WIDTH 64
-#define DISPLAY_HEIGHT 32
+/* Display buffer size, the SUPER-CHIP high resolution mode. CHIP8 programs run in the low resolution mode */
+#define DISPLAY_WIDTH 128
+#define DISPLAY_HEIGHT 64
+#define LORES_WIDTH 64
+#define LORES_HEIGHT 32
+#define DISPLAY_WORDS (DISPLAY_WIDTH / 64) /* 64-bit words per display row */
+#define PLANE_COUNT 2                      /* XO-CHIP bitplanes, a pixel has 4 colors */
 
 #define KEY_COUNT 16
 #define REGISTER_COUNT 16
 
-#define MAX_MEMORY 4096
+/* CHIP8 and SUPER-CHIP programs see 4 KB, addresses wrap around. XO-CHIP programs see 64 KB */
+#define CHIP8_MEMORY 0x1000
+#define MAX_MEMORY 0x10000
 #define STACK_SIZE 16
 
 #define START_ADDRESS 0x200
 #define FONTSET_START_ADDRESS 0x50
+#define BIG_FONTSET_START_ADDRESS 0xA0 /* SUPER-CHIP 8x10 digits, right after the small font */
 
-typedef enum
+#define RPL_COUNT 8 /* SUPER-CHIP RPL user flags */
+
+#define AUDIO_PATTERN_SIZE 16 /* XO-CHIP audio pattern, 128 1-bit samples */
+#define AUDIO_DEFAULT_PITCH 64 /* 4000 samples per second */
+
+/* Display packed 64 pixels per word: pixel (x, y) of a plane is bit 63 - x % 64 of planes[plane][y][x / 64], so
+ * scrolling is word shifts and memmoves, and drawing on both planes is the same word operations twice. In low
+ * resolution a row is exactly one word, only the first word of the first LORES_HEIGHT rows is used. CHIP8 and
+ * SUPER-CHIP programs only draw on the first plane */
+struct chip8_display
 {
-    Pressed,
-    Released,
-    Idle
-} keystate;
+    uint64_t planes[PLANE_COUNT][DISPLAY_HEIGHT][DISPLAY_WORDS];
+    uint8_t hires;      /* 128x64 mode, 00FF/00FE */
+    uint8_t plane_mask; /* Planes drawn, cleared and scrolled (bit 0: first plane), XO-CHIP FN01 */
+};
 
 struct chip8
 {
-    /* Default number of unique addresses is 2^12(4096) in a CHIP8 interpreter because it used 12-bit addressing */
-    uint8_t memory[MAX_MEMORY];
-
-    uint8_t display[DISPLAY_HEIGHT * DISPLAY_WIDTH];
+    struct chip8_display display;
 
     /* Index register; store memory address to be used in operations */
     uint16_t I;
@@ -48,30 +64,160 @@ struct chip8
     // uint64_t sound_timer_acc; /* Tracks change in time to decrement sound timer at 60 Hz */
 
     uint8_t V[REGISTER_COUNT]; /* General purpose registers: V0 -> VF */
+    uint8_t rpl[RPL_COUNT];    /* SUPER-CHIP RPL user flags, FX75/FX85 */
 
     uint16_t opcode; /* Current opcode to be decoded and executed */
 
-    uint8_t keypad[KEY_COUNT]; /* Set to 0 if idle, 1 if key is pressed, 2 if key is released */
+    /* Keypad, bit k for key k. Only input events change it, see chip8_key_event */
+    uint16_t keys_down;     /* Held down, tested by EX9E and EXA1 */
+    uint16_t keys_released; /* Let go while FX0A waits, consumed by FX0A */
+    uint8_t key_wait;       /* FX0A is waiting for a key release */
 
     uint8_t draw_flag; /* Update screen when not 0 */
+    uint8_t halted;    /* SUPER-CHIP 00FD ran: PC stays on it and the host ends the run, see chip8_cycle */
+
+    uint32_t rng; /* CXNN random number generator state (xorshift32), never 0 */
+
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE]; /* XO-CHIP: played in a loop while the sound timer runs, F002 */
+    uint8_t pitch;                             /* XO-CHIP: pattern rate 4000 * 2^((pitch - 64) / 48) Hz, FX3A */
+    uint8_t audio_pattern_loaded;              /* F002 ran, the buzzer plays the pattern instead of a tone */
+    uint8_t audio_flag;                        /* Pattern or pitch changed, cleared by the audio output */
+
+    /* Default number of unique addresses is 2^12(4096) in a CHIP8 interpreter because it used 12-bit addressing.
+     * XO-CHIP ROMs get MAX_MEMORY when they are larger, or on their first F000 NNNN. Only the first memory_size
+     * bytes are ever touched, so a 4 KB program keeps the same cache footprint */
+    uint32_t memory_size;
+
+    struct trace *trace; /* Instruction trace ring buffer, NULL if tracing is off */
+    struct tier *tier;   /* Tiered engine state, NULL until the engine runs, see tier.h. Copies share it */
+
+#ifdef CHIP8_PROFILE
+    struct chip8_profile profile; /* Execution histogram, see profile.h */
+#endif
+
+    /* Last, so the registers and the display share cache lines with each other rather than with memory */
+    uint8_t memory[MAX_MEMORY];
 };
 
 /* Initializes CHIP8 state
  * @param pc_start_address Set memory address where the game is located; default is COSMAC-VIP at 0x200 */
 void chip8_init(struct chip8 *chip8, uint16_t pc_start_address);
-/* Load a ROM to memory
- * @param filename Name or path of a compatible *.ch8 ROM */
-void chip8_load_rom(struct chip8 *chip8, const char *filename);
+/* Load a ROM to memory, exits with an error message if it cannot be loaded
+ * @param filename Name or path of a compatible *.ch8 ROM
+ * @return ROM size in bytes */
+uint32_t chip8_load_rom(struct chip8 *chip8, const char *filename);
+/* Load a ROM to memory, returning the error instead of exiting
+ * @param size Set to the ROM size in bytes
+ * @return NULL on success, else the error message */
+const char *chip8_read_rom(struct chip8 *chip8, const char *filename, uint32_t *size);
+/* Check that a ROM fits in memory when loaded at address
+ * @return NULL if it does, else the error message */
+const char *chip8_check_rom_size(uint16_t address, uint64_t size);
+/* Load a ROM already in memory, e.g. a mapped file, see rom_image_open
+ * @return NULL on success, else the error message */
+const char *chip8_load_image(struct chip8 *chip8, const uint8_t *data, uint32_t size);
 /* Load default fontset to memory */
 void chip8_load_fontset(struct chip8 *chip8);
 /* Decode and execute an instruction */
 void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode);
-/* Emulate CHIP8 instruction cycle
- * @param dt */
+/* Emulate CHIP8 instruction cycle. Exits on a stack overflow or an unknown opcode; 00FD does not leave the core,
+ * it sets halted and runs again on every later cycle, so hosts test halted to stop, flush and report */
 void chip8_cycle(struct chip8 *chip8);
-/* Set all pixels on screen to 0 */
+/* Set all pixels of the selected planes to 0 */
 void chip8_clear_display(struct chip8 *chip8);
-/* Set all keys to idle/0 */
-void chip8_reset_released_keys(struct chip8 *chip8);
+/* Switch between the 64x32 and 128x64 display modes, clearing all planes */
+void chip8_set_hires(struct chip8 *chip8, uint8_t hires);
+/* Draw a sprite from I at (x, y) in the current mode, clipped at the right and bottom edges. With several
+ * planes selected, the sprite data of each plane follows the previous one
+ * @param n Rows of 8 pixels, 0 for a 16x16 sprite
+ * @return 1 if a set pixel was erased */
+uint8_t chip8_draw_sprite(struct chip8 *chip8, uint8_t x, uint8_t y, uint8_t n);
+/* Scroll the selected planes down or up n rows, or left or right 4 pixels, in the current mode */
+void chip8_scroll_down(struct chip8 *chip8, uint8_t n);
+void chip8_scroll_up(struct chip8 *chip8, uint8_t n);
+void chip8_scroll_left(struct chip8 *chip8);
+void chip8_scroll_right(struct chip8 *chip8);
+/* Expand a display to DISPLAY_WIDTH * DISPLAY_HEIGHT bytes of 0 -> 3 (bit 0: first plane, bit 1: second plane),
+ * low resolution pixels doubled */
+void chip8_display_unpack(const struct chip8_display *display, uint8_t *pixels);
+/* Apply a key press or release, the only way input reaches the machine */
+void chip8_key_event(struct chip8 *chip8, uint8_t key, uint8_t pressed);
+/* Decrement the delay and sound timers, call 60 times per second. The buzzer sounds while the sound timer
+ * is nonzero */
+void chip8_update_timers(struct chip8 *chip8);
+/* Hash the display contents in the current mode (FNV-1a over the rows packed 8 pixels per byte, leftmost
+ * pixel in the MSB), independent of how the display is stored. The second plane is hashed after the first
+ * when it has set pixels */
+uint64_t chip8_hash_display(const struct chip8 *chip8);
+/* Hash everything in the machine that decides what it does next: memory, display, registers, stack, timers, keys,
+ * random number generator and audio pattern. Two states with the same hash only behave the same if they also get
+ * the same input and run the same instructions per frame, the scheduler phase is up to the caller (see steady.h) */
+uint64_t chip8_hash_state(const struct chip8 *chip8);
+/* Seed the CXNN random number generator, runs with the same seed and input are identical */
+void chip8_seed(struct chip8 *chip8, uint32_t seed);
+
+/* Size of the current display mode */
+static inline uint8_t chip8_display_width(const struct chip8_display *display)
+{
+    return display->hires ? DISPLAY_WIDTH : LORES_WIDTH;
+}
+
+static inline uint8_t chip8_display_height(const struct chip8_display *display)
+{
+    return display->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+}
+
+/* Wrap an address to the memory size */
+static inline uint16_t chip8_address(const struct chip8 *chip8, uint32_t address)
+{
+    return address & (chip8->memory_size - 1);
+}
+
+/* Read the opcode at an address */
+static inline uint16_t chip8_fetch(const struct chip8 *chip8, uint16_t address)
+{
+    return (chip8->memory[chip8_address(chip8, address)] << 8) | chip8->memory[chip8_address(chip8, address + 1)];
+}
+
+/* Skip the next instruction: 4 bytes over an XO-CHIP F000 NNNN, else 2 */
+static inline void chip8_skip(struct chip8 *chip8)
+{
+    chip8->PC += chip8_fetch(chip8, chip8->PC) == 0xF000 ? 4 : 2;
+}
+
+/* Get the next random byte for CXNN */
+static inline uint8_t chip8_random(struct chip8 *chip8)
+{
+    uint32_t x = chip8->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->rng = x;
+    return x >> 24;
+}
+
+/* EX9E/EXA1: @return 1 if the key in the low nibble is held down */
+static inline uint8_t chip8_key_down(const struct chip8 *chip8, uint8_t key)
+{
+    return (chip8->keys_down >> (key & 0xF)) & 1;
+}
+
+/* FX0A: take the lowest key released since the wait started, and start waiting if there is none
+ * @return The key, -1 while waiting */
+static inline int8_t chip8_key_wait(struct chip8 *chip8)
+{
+    if (!chip8->keys_released)
+    {
+        chip8->key_wait = 1;
+        return -1;
+    }
+
+    int8_t key = 0;
+    while (!(chip8->keys_released & (1 << key)))
+        key++;
+    chip8->keys_released = 0;
+    chip8->key_wait = 0;
+    return key;
+}
 
 #endif // !chip8_H
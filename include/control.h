@@ -0,0 +1,95 @@
+#pragma once
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "chip8.h"
+#include "debugger.h"
+#include "engine.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Headless machine driven over a Unix domain socket with a line based text protocol. Every command line gets
+ * exactly one response line, "ok ..." or "error <message>", in order. Clients may send any number of commands
+ * without waiting: the commands received in one read run back to back and their responses are sent in one
+ * write, so "frames 600\ndisplay\n" steps ten seconds and returns the last frame in a single round trip.
+ * Numbers are decimal or 0x hex, output is hex without prefix unless noted.
+ *
+ *   load <path>            Load a ROM and reset: ok <size>
+ *   reset                  Back to the state right after the last load: ok
+ *   seed <n>               CXNN seed of the loaded ROM and the next loads, also applied on reset: ok
+ *   keys <mask>            Keys held down, bit k for key k (hex). Keys let go are released: ok
+ *   cycles <n>             Run n instructions: ok <cycle> <frame> <reason> (decimal)
+ *   frames <n>             Run to the end of n more 60 Hz frames: ok <cycle> <frame> <reason> (decimal)
+ *   regs                   ok pc=<pc> i=<i> sp=<sp> dt=<dt> st=<st> v=<V0..VF> stack=<stack words>
+ *   memory <addr> <len>    ok <bytes>
+ *   display                Current mode, one digit (0 -> 3, bit 1 for the second plane) per pixel: ok <w> <h> <pixels>
+ *   hash                   ok <chip8_hash_display>
+ *   snapshot <slot>        Save the machine, its cycle and frame count: ok
+ *   restore <slot>         ok
+ *   break <spec>           Add a breakpoint, see debugger_parse_breakpoint: ok
+ *   watch <spec>           Add a watchpoint, see debugger_parse_watchpoint: ok
+ *   clear                  Remove every breakpoint and watchpoint: ok
+ *   quit                   Close the connection, the machine is kept for the next client: ok
+ *   shutdown               Stop the server: ok
+ *
+ * A run ends early with a debugger stop reason ("breakpoint", "watchpoint", "frame"), with "exit" once 00FD
+ * halted the machine (PC stays on it), or before an instruction that would end the process ("unknown-opcode",
+ * "stack-overflow") or read outside the stack ("stack-underflow" for 00EE with an empty stack), else its reason
+ * is "done".
+ * Instructions take 1 / clock speed seconds, as in headless uniform timing, and run on the engine given to
+ * control_init */
+
+#define CONTROL_SNAPSHOTS 16
+/* Input buffer, a command line longer than this is rejected */
+#define CONTROL_INPUT_SIZE (64 * 1024)
+
+/* Machine state saved by snapshot */
+struct control_snapshot
+{
+    struct chip8 chip8;
+    uint64_t cycle;
+    uint32_t frame;
+};
+
+struct control
+{
+    struct chip8 chip8;
+    struct chip8 initial; /* State after the last load, restored by reset */
+    uint8_t loaded;
+    uint16_t clock_speed;
+    const struct chip8_engine *engine;
+    uint32_t seed; /* 0 for a time based one */
+    uint64_t cycle; /* Instructions since the last load, reset or restore */
+    uint32_t frame; /* Frames since the last load, reset or restore */
+    struct debugger *debugger;             /* The caller's or own_debugger */
+    struct debugger own_debugger;
+    struct control_snapshot *snapshots[CONTROL_SNAPSHOTS]; /* Allocated on first use */
+
+    /* Responses of the current batch */
+    char *output;
+    size_t used;
+    size_t capacity;
+};
+
+enum control_status
+{
+    CONTROL_CONTINUE,
+    CONTROL_QUIT,     /* The client asked to close its connection */
+    CONTROL_SHUTDOWN, /* The client asked to stop the server */
+};
+
+/* @param engine Instruction cycle of the runs, see engine.h
+ * @param debugger Breakpoints given on the command line, owned by the caller, NULL for none
+ * @return 0 if out of memory */
+int8_t control_init(struct control *control, uint16_t clock_speed, uint32_t seed,
+                    const struct chip8_engine *engine, struct debugger *debugger);
+void control_free(struct control *control);
+/* Run one command line, without its newline, and append its response line to the output buffer */
+enum control_status control_execute(struct control *control, char *line);
+/* Serve clients one after the other on a socket path until a shutdown command
+ * @param rom ROM loaded before the first client, may be NULL
+ * @return Process exit status */
+int control_serve(struct control *control, const char *path, const char *rom);
+
+#endif /* CONTROL_H */
@@ -0,0 +1,125 @@
+#pragma once
+
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "callgraph.h"
+#include "chip8.h"
+#include "engine.h"
+#include "symbols.h"
+#include <stdio.h>
+
+/* Breakpoints, watchpoints, single-step and run-to-frame. debugger_cycle replaces the engine's cycle only while
+ * debugger_active, so a program without breakpoints runs on the plain cycle at full speed */
+
+#define DEBUGGER_MAX_BREAKPOINTS 32
+#define DEBUGGER_MAX_WATCHPOINTS 16
+
+/* Watchpoint access kinds */
+#define DEBUGGER_READ 0x01  /* Through I: DXYN, FX65, 5XY3, F002 */
+#define DEBUGGER_WRITE 0x02 /* Through I: FX33, FX55, 5XY2 */
+
+/* Breakpoint condition on a V register */
+enum debugger_compare
+{
+    DEBUGGER_ALWAYS,
+    DEBUGGER_EQUAL,
+    DEBUGGER_NOT_EQUAL,
+    DEBUGGER_LESS,
+    DEBUGGER_LESS_EQUAL,
+    DEBUGGER_GREATER,
+    DEBUGGER_GREATER_EQUAL,
+};
+
+struct debugger_breakpoint
+{
+    uint16_t address;
+    uint8_t reg; /* V register compared with value */
+    enum debugger_compare compare;
+    uint8_t value;
+};
+
+struct debugger_watchpoint
+{
+    uint16_t start;
+    uint16_t end; /* Last address watched */
+    uint8_t access;
+};
+
+enum debugger_stop
+{
+    DEBUGGER_RUNNING,
+    DEBUGGER_BREAKPOINT, /* Before the instruction at a breakpoint */
+    DEBUGGER_WATCHPOINT, /* Before the instruction accessing a watched address */
+    DEBUGGER_STEP,       /* After the last instruction of debugger_step */
+    DEBUGGER_FRAME,      /* At the end of the last frame of debugger_run_frames */
+};
+
+struct debugger
+{
+    struct debugger_breakpoint breakpoints[DEBUGGER_MAX_BREAKPOINTS];
+    uint32_t breakpoint_count;
+    struct debugger_watchpoint watchpoints[DEBUGGER_MAX_WATCHPOINTS];
+    uint32_t watchpoint_count;
+    uint8_t break_map[MAX_MEMORY / 8]; /* Addresses with a breakpoint, one bit each */
+
+    uint32_t steps;  /* Instructions left before a DEBUGGER_STEP stop, 0 if not stepping */
+    uint32_t frames; /* Frames left before a DEBUGGER_FRAME stop, 0 if not running to a frame */
+    uint8_t resume;  /* Run the next instruction without checking it, to leave the one that stopped */
+
+    /* Why and where the machine stopped, DEBUGGER_RUNNING while it runs */
+    enum debugger_stop stop;
+    uint32_t hit;         /* Breakpoint or watchpoint index */
+    uint16_t hit_address; /* First watched address accessed */
+    uint8_t hit_access;
+};
+
+void debugger_init(struct debugger *debugger);
+/* @return 0 if the table is full */
+int8_t debugger_add_breakpoint(struct debugger *debugger, uint16_t address, enum debugger_compare compare,
+                               uint8_t reg, uint8_t value);
+void debugger_remove_breakpoint(struct debugger *debugger, uint32_t index);
+/* @param end Last address watched, inclusive
+ * @return 0 if the table is full */
+int8_t debugger_add_watchpoint(struct debugger *debugger, uint16_t start, uint16_t end, uint8_t access);
+void debugger_remove_watchpoint(struct debugger *debugger, uint32_t index);
+/* Parse and add a breakpoint written as "0x2a4" or with a condition, "0x2a4:v3==5" (==, !=, <, <=, >, >=)
+ * @return 0 if the text is invalid or the table is full */
+int8_t debugger_parse_breakpoint(struct debugger *debugger, const char *text);
+/* Parse and add a watchpoint written as "0x300", "0x300-0x30f", optionally followed by ":r", ":w" or ":rw"
+ * (default) */
+int8_t debugger_parse_watchpoint(struct debugger *debugger, const char *text);
+
+/* Resume a stopped machine */
+void debugger_continue(struct debugger *debugger);
+/* Resume and stop again after n instructions */
+void debugger_step(struct debugger *debugger, uint32_t n);
+/* Resume and stop again at the end of the nth frame, see debugger_frame */
+void debugger_run_frames(struct debugger *debugger, uint32_t n);
+
+/* @return 1 if debugger_cycle has to be used instead of the engine's cycle: something is set or the machine is
+ * stopped */
+static inline uint8_t debugger_active(const struct debugger *debugger)
+{
+    return debugger->breakpoint_count || debugger->watchpoint_count || debugger->steps || debugger->frames ||
+           debugger->stop != DEBUGGER_RUNNING;
+}
+
+/* Run one instruction on an engine unless a breakpoint or watchpoint stops the machine before it
+ * @param profiler Charged with the instruction through callgraph_cycle, which runs chip8_cycle instead of the
+ * engine, NULL if profiling is off
+ * @return 1 if the instruction ran, 0 if the machine is stopped */
+uint8_t debugger_cycle(struct debugger *debugger, struct chip8 *chip8, const struct chip8_engine *engine,
+                       struct callgraph *profiler);
+/* Count a 60 Hz frame, call after each timer tick
+ * @return 1 if the machine is stopped */
+uint8_t debugger_frame(struct debugger *debugger);
+
+/* Name of a stop reason, e.g. "breakpoint" */
+const char *debugger_stop_name(enum debugger_stop stop);
+/* Print why the machine stopped, the registers and the next instruction
+ * @param symbols Labels used to name addresses, may be NULL */
+void debugger_print(const struct debugger *debugger, const struct chip8 *chip8, const struct symbols *symbols,
+                    FILE *out);
+
+#endif /* DEBUGGER_H */
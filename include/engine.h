@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "chip8.h"
+
+/* Execution engine: an implementation of the instruction cycle.
+ * Every engine must leave the machine in exactly the state chip8_cycle would. Machines are copied while an engine
+ * runs them (checkpoints, snapshots) and the copies share its state, so that state must never be trusted over
+ * the machine itself */
+struct chip8_engine
+{
+    const char *name;
+    const char *description;
+    void (*cycle)(struct chip8 *chip8);
+    void (*release)(struct chip8 *chip8); /* Free the state the engine keeps for a machine, NULL if it keeps none */
+};
+
+/* Get a registered engine, the reference "switch" engine (chip8_cycle) is first
+ * @return NULL past the last engine */
+const struct chip8_engine *chip8_engine_get(uint32_t index);
+/* Find a registered engine by name
+ * @return NULL if there is none */
+const struct chip8_engine *chip8_engine_find(const char *name);
+/* Free the state an engine keeps for a machine, call before the machine is dropped or reinitialized */
+void chip8_engine_release(const struct chip8_engine *engine, struct chip8 *chip8);
+
+#endif /* ENGINE_H */
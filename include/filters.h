@@ -0,0 +1,67 @@
+#pragma once
+
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include "chip8.h"
+#include <stdint.h>
+
+/* Display filters: turn the 1-byte-per-pixel display into ARGB8888 pixels for texture upload, with optional
+ * pixel-art upscaling and phosphor persistence. The kernels come in scalar, SSE2 and AVX2 versions, picked
+ * at runtime for the CPU */
+
+#define FILTER_MAX_SCALE 3
+#define FILTER_COLORS 4 /* Pixel values, see chip8_display_unpack */
+/* Padded copy of the display: 8 bytes on each side of a row and one row above and below, so the kernels
+ * read neighbours without bounds checks */
+#define FILTER_PAD 8
+#define FILTER_STRIDE (DISPLAY_WIDTH + 2 * FILTER_PAD)
+
+enum filter
+{
+    FILTER_NONE,     /* 1x, the renderer scales with nearest neighbour */
+    FILTER_SCALE2X,  /* 2x, Scale2x edge smoothing */
+    FILTER_SCALE3X,  /* 3x, Scale3x edge smoothing */
+    FILTER_PHOSPHOR, /* 1x, pixels fade out over a few frames instead of flickering, in one color */
+    FILTER_CRT,      /* 3x, phosphor persistence with scanlines and an aperture grille, in one color */
+    FILTER_COUNT,
+};
+
+enum filter_isa
+{
+    FILTER_ISA_SCALAR,
+    FILTER_ISA_SSE2,
+    FILTER_ISA_AVX2,
+    FILTER_ISA_COUNT,
+};
+
+struct filter_state
+{
+    enum filter filter;
+    uint32_t palette[FILTER_COLORS]; /* ARGB8888 per pixel value; the phosphor filters use the first two */
+    uint8_t padded[(DISPLAY_HEIGHT + 2) * FILTER_STRIDE];
+    uint8_t intensity[DISPLAY_WIDTH * DISPLAY_HEIGHT];                        /* Phosphor brightness, 0 -> 255 */
+    uint8_t scaled[FILTER_MAX_SCALE * FILTER_MAX_SCALE * DISPLAY_WIDTH * DISPLAY_HEIGHT]; /* Upscaled pixels */
+};
+
+/* Get a filter by name (none, scale2x, scale3x, phosphor, crt)
+ * @return 0 if the name is unknown */
+int8_t filter_find(const char *name, enum filter *filter);
+const char *filter_name(enum filter filter);
+/* Output size multiplier of a filter */
+uint8_t filter_scale(enum filter filter);
+/* @return 1 if the output changes from frame to frame even when the display does not */
+uint8_t filter_animated(enum filter filter);
+
+/* Select the kernels, FILTER_ISA_COUNT picks the best one the CPU supports
+ * @return 0 if the build or the CPU does not support the instruction set, the selection is then unchanged */
+int8_t filter_select_isa(enum filter_isa isa);
+enum filter_isa filter_current_isa(void);
+const char *filter_isa_name(enum filter_isa isa);
+
+void filter_init(struct filter_state *state, enum filter filter, const uint32_t *palette);
+/* Filter a display into DISPLAY_WIDTH * scale by DISPLAY_HEIGHT * scale pixels
+ * @param pitch Distance between two output rows in pixels */
+void filter_apply(struct filter_state *state, const uint8_t *display, uint32_t *out, uint32_t pitch);
+
+#endif /* FILTERS_H */
@@ -0,0 +1,36 @@
+#pragma once
+
+#ifndef INPUT_SCRIPT_H
+#define INPUT_SCRIPT_H
+
+#include "chip8.h"
+#include <stdint.h>
+
+/* Key press or release at a given instruction count */
+struct input_event
+{
+    uint64_t cycle;
+    uint8_t key;     /* Keypad key, 0x0 -> 0xF */
+    uint8_t pressed; /* 1 if pressed, 0 if released */
+};
+
+/* Recorded keypad input, replayed identically on every run */
+struct input_script
+{
+    struct input_event *events; /* Sorted by cycle */
+    uint32_t count;
+};
+
+/* Load an input script. Each line is "<when> <key> <down|up>", where when is an instruction
+ * count, or a frame number with an "f" suffix (e.g. "120f 5 down"). Lines starting with # are ignored
+ * @param cycles_per_frame Instructions per 60 Hz frame, used to convert frame numbers
+ * @return 0 if the file could not be read or has an invalid line */
+int8_t input_script_load(struct input_script *script, const char *filename, uint32_t cycles_per_frame);
+/* Free an input script */
+void input_script_free(struct input_script *script);
+/* Apply the events due at or before an instruction count with chip8_key_event
+ * @param cursor Index of the first event not applied yet
+ * @return the new cursor */
+uint32_t input_script_apply(const struct input_script *script, uint32_t cursor, uint64_t cycle, struct chip8 *chip8);
+
+#endif /* INPUT_SCRIPT_H */
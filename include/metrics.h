@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Frames kept for the frame time percentiles */
+#define METRICS_WINDOW 512
+/* Interval between two snapshots in microseconds */
+#define METRICS_PERIOD 1000000.0
+
+/* Values published once per period */
+struct metrics_snapshot
+{
+    double ips;               /* Emulated instructions per second */
+    double target_ips;        /* Requested clock speed */
+    double frame_ms;          /* Mean frame time */
+    double frame_p99_ms;      /* 99th percentile frame time over the last METRICS_WINDOW frames */
+    double update_ms;         /* Mean time spent in platform_update per frame */
+    double cycle_surplus;     /* Mean executed minus expected cycles per frame, negative when falling behind */
+    double input_p50_ms;      /* Median input to present latency over the last METRICS_WINDOW key events */
+    double input_p99_ms;      /* 99th percentile input to present latency */
+    uint64_t frames;          /* Frames since start */
+    uint64_t inputs;          /* Key events presented since start */
+    uint32_t audio_underruns; /* Audio buffers that ran dry since start */
+};
+
+/* Live performance counters of the main loop */
+struct metrics
+{
+    double frame_us[METRICS_WINDOW]; /* Ring of the last frame times */
+    uint32_t frame_index;
+    uint32_t frame_count;
+    double latency_us[METRICS_WINDOW]; /* Ring of the last input to present latencies */
+    uint32_t latency_index;
+    uint32_t latency_count;
+
+    /* Accumulated over the current period */
+    double period_us;
+    double period_update_us;
+    uint64_t period_cycles;
+    uint32_t period_frames;
+
+    double target_ips;
+    uint64_t frames;
+    uint64_t inputs;
+    double elapsed_us;
+    int fd; /* JSON lines output, -1 if none */
+
+    struct metrics_snapshot snapshot;
+};
+
+/* Setup the counters
+ * @param clock_speed Requested instructions per second
+ * @param fd File descriptor receiving one JSON object per period, -1 to disable */
+void metrics_init(struct metrics *metrics, uint32_t clock_speed, int fd);
+/* Account one frame
+ * @param frame_us Time since the previous frame
+ * @param update_us Time spent presenting this frame
+ * @param cycles Instructions executed during the frame
+ * @return 1 if a period ended and the snapshot was refreshed */
+int8_t metrics_frame(struct metrics *metrics, double frame_us, double update_us, uint64_t cycles);
+/* Update the audio underrun count shown in the snapshot */
+void metrics_audio(struct metrics *metrics, uint32_t underruns);
+/* Account the time from a key event arriving to the first frame drawn after it being presented */
+void metrics_input(struct metrics *metrics, double latency_us);
+/* Print percentiles of the last METRICS_WINDOW input latencies */
+void metrics_report_latency(const struct metrics *metrics, FILE *out);
+/* Format the snapshot as short lines for the on-screen display */
+void metrics_format(const struct metrics *metrics, char *buf, uint32_t size);
+/* Get the p-th percentile (0-100) of a set of samples, the samples are not modified */
+double metrics_percentile(const double *samples, uint32_t count, double p);
+
+#endif /* METRICS_H */
@@ -0,0 +1,95 @@
+#pragma once
+
+#ifndef OPCODE_H
+#define OPCODE_H
+
+#include <stdint.h>
+
+/* Instruction classes, one per handler in chip8_decode_and_execute */
+enum chip8_op
+{
+    OP_0NNN,
+    OP_00E0,
+    OP_00EE,
+    OP_00CN, /* SUPER-CHIP */
+    OP_00DN, /* XO-CHIP */
+    OP_00FB,
+    OP_00FC,
+    OP_00FD,
+    OP_00FE,
+    OP_00FF,
+    OP_1NNN,
+    OP_2NNN,
+    OP_3XNN,
+    OP_4XNN,
+    OP_5XY0,
+    OP_5XY2, /* XO-CHIP */
+    OP_5XY3,
+    OP_6XNN,
+    OP_7XNN,
+    OP_8XY0,
+    OP_8XY1,
+    OP_8XY2,
+    OP_8XY3,
+    OP_8XY4,
+    OP_8XY5,
+    OP_8XY6,
+    OP_8XY7,
+    OP_8XYE,
+    OP_9XY0,
+    OP_ANNN,
+    OP_BNNN,
+    OP_CXNN,
+    OP_DXYN,
+    OP_DXY0, /* SUPER-CHIP 16x16 sprite */
+    OP_EX9E,
+    OP_EXA1,
+    OP_F000, /* XO-CHIP, 4 bytes */
+    OP_FN01,
+    OP_F002,
+    OP_FX07,
+    OP_FX0A,
+    OP_FX15,
+    OP_FX18,
+    OP_FX1E,
+    OP_FX29,
+    OP_FX30, /* SUPER-CHIP */
+    OP_FX33,
+    OP_FX3A, /* XO-CHIP */
+    OP_FX55,
+    OP_FX65,
+    OP_FX75, /* SUPER-CHIP */
+    OP_FX85,
+    OP_UNKNOWN,
+    OP_COUNT
+};
+
+/* Get the instruction class of an opcode
+ * @return OP_UNKNOWN if the opcode is not part of the instruction set */
+enum chip8_op chip8_op_classify(uint16_t opcode);
+/* Get the mnemonic pattern of an instruction class, e.g. "DXYN" */
+const char *chip8_op_name(enum chip8_op op);
+
+struct chip8;
+/* Reason the instruction at PC must not run: chip8_cycle exits the process on it ("unknown-opcode",
+ * "stack-overflow"), or it reads outside the stack ("stack-underflow", 00EE with an empty stack). Hosts with
+ * output to flush stop before it
+ * @return NULL if it can run */
+const char *chip8_op_fatal(const struct chip8 *chip8);
+
+/* COSMAC VIP timing: the 1.7609 MHz CDP1802 takes 8 clocks per machine cycle, 3668 machine cycles per 60 Hz
+ * frame. Instruction costs are averages that include the cycles the display DMA steals */
+#define VIP_CYCLE_US (8.0 / 1.7609)
+#define VIP_CYCLES_PER_FRAME 3668
+
+/* Machine cycles the VIP interpreter spends on an instruction. SUPER-CHIP and XO-CHIP instructions, which the
+ * VIP never ran, cost as much as a jump */
+uint16_t chip8_op_vip_cycles(uint16_t opcode);
+/* @return 1 if the VIP interpreter waits for the next 60 Hz interrupt before running the instruction, as it
+ * does for DXYN. Its chip8_op_vip_cycles cost comes after the wait */
+static inline uint8_t chip8_op_waits_vblank(uint16_t opcode)
+{
+    return (opcode >> 12) == 0xD;
+}
+
+#endif /* OPCODE_H */
@@ -3,6 +3,7 @@
 #ifndef PLATFORM_LAYER_H
 #define PLATFORM_LAYER_H
 
+#include "filters.h"
 #include <stdint.h>
 
 /* TODO: fix redundancy */
@@ -20,28 +21,75 @@
 // #include <time.h>
 // #endif
 
+#define HUD_TEXT_SIZE 256
+
+struct key_queue;
+
+/* Debugger keys of the window, forwarded to the emulation thread */
+enum debug_command
+{
+    DEBUG_NONE,
+    DEBUG_CONTINUE, /* F5 */
+    DEBUG_PAUSE,    /* F6, stop after the current instruction */
+    DEBUG_STEP,     /* F10, one instruction */
+    DEBUG_FRAME,    /* F11, to the end of the next frame */
+};
+
 /* SDL window */
 struct window
 {
     SDL_Window *w;
     SDL_Renderer *renderer;
+    SDL_Texture *texture; /* Filtered displays of all tiles */
     SDL_Event e;
+    enum filter filter;
+    struct filter_state *filters; /* One per tile */
+
+    /* Mosaic of several instances, see platform_set_tiles */
+    uint16_t tiles;   /* Displays shown, 1 without a mosaic */
+    uint16_t columns;
+    uint16_t rows;
+    uint16_t focus;   /* Tile receiving keyboard input, changed by clicking a tile */
+    uint16_t held;    /* Keypad keys held down on the focused tile, released when the focus moves */
+    SDL_Rect view;    /* Where the texture was last drawn, to map clicks to tiles */
+
+    uint8_t show_hud;             /* Draw the performance overlay, toggled with F1 */
+    char hud_text[HUD_TEXT_SIZE]; /* Overlay lines separated by '\n' */
+    enum debug_command debug;     /* Last debugger key pressed, reset by the caller once handled */
 };
 
-/* Setup window */
-void platform_init(struct window *window);
+/* Setup window
+ * @param vsync Block presenting until the display refresh
+ * @param filter Display filter, run with the fastest kernels the CPU supports */
+void platform_init(struct window *window, uint8_t vsync, enum filter filter);
+/* Show a grid of displays instead of one, all composited into one texture. Tiles get a border, the
+ * focused one highlighted
+ * @return 0 if the texture could not be created */
+int8_t platform_set_tiles(struct window *window, uint16_t count);
 /* Cleanup window */
 void platform_close(struct window *window);
-/* Processes input
-  @return return 0 if an escape key is pressed */
-int8_t platform_process_input(uint8_t *keypad);
+/* Processes input as it arrives until a deadline, queueing keypad events stamped with their arrival time
+ * for the emulation thread of the focused tile. F1 toggles the performance overlay, clicking a tile focuses it,
+ * F5/F6/F10/F11 set window->debug
+ * @param keys Key queue of each tile
+ * @param deadline_us platform_now_us time to return at, a past time only handles pending events
+ * @return return 0 if an escape key is pressed, -1 if the window is closed */
+int8_t platform_process_input(struct window *window, struct key_queue *const *keys, double deadline_us);
 /* Get corresponding keypad key from given keycode
  * @return return keypad hex value if input is valid */
 uint8_t platform_get_key_from_keycode(SDL_KeyCode keycode);
-/* Copies data from given buffer to screen */
-void platform_update(struct window *window, uint8_t *display_buffer, uint8_t display_width, uint8_t display_height);
+/* Filters the displays of all tiles into the texture, uploads it once and draws it scaled to the window, with
+ * the overlay on top if it is shown
+ * @param displays DISPLAY_WIDTH * DISPLAY_HEIGHT buffer of each tile
+ * @param labels Text drawn in the corner of each tile, NULL for none */
+void platform_update(struct window *window, const uint8_t *const *displays, const char *const *labels);
+/* Draw text with the built-in 3x5 font on a dark background
+ * @param scale Size of a font pixel in window pixels */
+void platform_draw_text(struct window *window, const char *text, int x, int y, int scale);
 
 /* Timers */
+/* Monotonic clock shared by all threads, in microseconds */
+double platform_now_us(void);
 #ifdef WIN
 void get_current_time(LARGE_INTEGER *time);
 /* elapsed time in microseconds */
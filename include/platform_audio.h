@@ -0,0 +1,102 @@
+#pragma once
+
+#ifndef PLATFORM_AUDIO_H
+#define PLATFORM_AUDIO_H
+
+#include "platform.h"
+
+/* Buzzer output: the emulation thread queues on/off changes, the SDL audio callback synthesizes a square
+ * wave from them, or loops the XO-CHIP audio pattern once one is loaded. Neither side takes a lock, so audio
+ * never blocks emulation */
+
+#define AUDIO_FREQUENCY 48000
+#define AUDIO_BUFFER_US 5000.0  /* Longest callback buffer, the device gets the largest power of 2 below it */
+#define AUDIO_QUEUE_SIZE 64     /* Power of 2 */
+#define AUDIO_TONE 440.0        /* Buzzer pitch in Hz */
+#define AUDIO_AMPLITUDE 0x1000  /* Square wave amplitude, out of 0x7FFF */
+
+/* Buzzer state change at an emulated time */
+struct buzzer_event
+{
+    double time_us; /* platform_now_us clock */
+    uint8_t on;
+    uint8_t set_pattern;    /* The pattern and pitch below replace the current ones, on is unchanged */
+    uint8_t pattern_loaded; /* F002 ran, else only the pitch changed and the tone plays on */
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+};
+
+struct audio
+{
+    SDL_AudioDeviceID device; /* 0 if audio could not be opened */
+    int frequency;            /* Obtained sample rate */
+    uint16_t samples;         /* Obtained samples per callback */
+
+    /* Single producer (emulation thread), single consumer (audio callback) */
+    struct buzzer_event events[AUDIO_QUEUE_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+
+    uint8_t buzzing; /* Producer: last queued state */
+
+    /* Callback state */
+    uint8_t on;
+    uint8_t pattern_loaded; /* Play the pattern instead of the tone */
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+    double pattern_step; /* Pattern bits per output sample */
+    double phase;        /* Position in the square wave period, 0 -> 1, or in the pattern, 0 -> 128 */
+    double callback_us; /* Time of the previous callback */
+
+    SDL_atomic_t underruns; /* Callbacks that came too late to keep the device fed, and dropped events */
+};
+
+/* Open the audio device and start the callback
+ * @return 0 if there is no usable audio device, the buzzer is then silent */
+int8_t platform_audio_open(struct audio *audio);
+void platform_audio_close(struct audio *audio);
+/* Producer: reserve the next event
+ * @return NULL if the queue is full, the change is then dropped */
+static inline struct buzzer_event *platform_audio_event(struct audio *audio)
+{
+    int tail = SDL_AtomicGet(&audio->tail);
+    if (tail - SDL_AtomicGet(&audio->head) == AUDIO_QUEUE_SIZE)
+    {
+        SDL_AtomicAdd(&audio->underruns, 1);
+        return NULL;
+    }
+    return &audio->events[tail & (AUDIO_QUEUE_SIZE - 1)];
+}
+
+/* Producer: hand the reserved event to the callback */
+static inline void platform_audio_publish(struct audio *audio)
+{
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&audio->tail, SDL_AtomicGet(&audio->tail) + 1);
+}
+
+/* Producer: queue a buzzer change if the state differs from the last one queued
+ * @param time_us Emulated time of the change */
+static inline void platform_audio_buzzer(struct audio *audio, uint8_t on, double time_us)
+{
+    if (on == audio->buzzing || !audio->device)
+        return;
+
+    struct buzzer_event *event = platform_audio_event(audio);
+    if (!event)
+        return;
+
+    audio->buzzing = on;
+    event->time_us = time_us;
+    event->on = on;
+    event->set_pattern = 0;
+    platform_audio_publish(audio);
+}
+
+/* Producer: queue a new XO-CHIP audio pattern or pitch, see chip8.h
+ * @param loaded chip8->audio_pattern_loaded, the pattern is ignored until F002 ran */
+void platform_audio_pattern(struct audio *audio, const uint8_t *pattern, uint8_t loaded, uint8_t pitch,
+                            double time_us);
+/* Number of audio underruns since the device was opened */
+uint32_t platform_audio_underruns(struct audio *audio);
+
+#endif /* PLATFORM_AUDIO_H */
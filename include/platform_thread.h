@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef PLATFORM_THREAD_H
+#define PLATFORM_THREAD_H
+
+#include "chip8.h"
+#include "platform.h"
+
+/* Lock-free handoff between the emulation thread and the SDL (input and render) thread */
+
+#define KEY_QUEUE_SIZE 256 /* Power of 2 */
+#define KEY_EVENT_PRESSED 0x10
+#define TRIPLE_BUFFER_FRESH 0x4
+
+/* Display contents published by the emulation thread */
+struct frame
+{
+    struct chip8_display display;
+    uint32_t inputs; /* Key events applied before the frame was drawn, for the latency measurement */
+};
+
+/* Finished frames from the emulation thread to the render thread. Each side owns one buffer, and the third
+ * is exchanged atomically, so neither side ever waits for the other and the renderer always gets the latest
+ * complete frame */
+struct triple_buffer
+{
+    struct frame frames[3];
+    SDL_atomic_t middle; /* Index of the exchanged buffer, with TRIPLE_BUFFER_FRESH set if it holds a new frame */
+    uint8_t back;        /* Written by the producer */
+    uint8_t front;       /* Read by the consumer */
+};
+
+/* Key press or release, stamped with its arrival time */
+struct key_event
+{
+    double time_us; /* platform_now_us clock */
+    uint8_t event;  /* Key in the low nibble, KEY_EVENT_PRESSED if pressed */
+};
+
+/* Key events from the SDL thread to the emulation thread, single producer and single consumer */
+struct key_queue
+{
+    struct key_event events[KEY_QUEUE_SIZE];
+    SDL_atomic_t head; /* Next event to read, written by the consumer */
+    SDL_atomic_t tail; /* Next free slot, written by the producer */
+};
+
+void triple_buffer_init(struct triple_buffer *buffer);
+/* Producer: buffer to write the next frame into */
+struct frame *triple_buffer_back(struct triple_buffer *buffer);
+/* Producer: publish the back buffer as the latest frame */
+void triple_buffer_publish(struct triple_buffer *buffer);
+/* Consumer: take the latest frame if one was published since the last call
+ * @return the frame, or NULL if there is no new one */
+const struct frame *triple_buffer_acquire(struct triple_buffer *buffer);
+
+void key_queue_init(struct key_queue *queue);
+/* Producer: queue a key press or release
+ * @param time_us Arrival time of the event
+ * @return 0 if the queue is full and the event was dropped */
+int8_t key_queue_push(struct key_queue *queue, uint8_t key, uint8_t pressed, double time_us);
+/* Consumer: apply the events that arrived at or before an emulated time with chip8_key_event, stopping before
+ * a second event for the same key so that a press and release queued together are both seen by the program
+ * @return number of events applied */
+uint32_t key_queue_drain(struct key_queue *queue, struct chip8 *chip8, double time_us);
+/* Producer: arrival time of the index-th event pushed, valid until KEY_QUEUE_SIZE more events are pushed */
+double key_queue_time(const struct key_queue *queue, uint32_t index);
+
+#endif /* PLATFORM_THREAD_H */
@@ -0,0 +1,39 @@
+#pragma once
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/* USDT static tracepoints for bpftrace, perf and SystemTap (provider "cilly").
+ * <sys/sdt.h> is header-only and each probe is a single nop plus an ELF note, so nothing is
+ * linked in and nothing runs until a tracer attaches. Without the header, or when built with
+ * CILLY_NO_PROBES (make probes=0), the macros expand to nothing.
+ *
+ * Probes and arguments:
+ *   frame_start(frame)                  main loop starts emulating a 60 Hz frame
+ *   frame_end(frame, cycles)            frame finished, after input and presentation
+ *   update_begin(), update_end()        platform_update
+ *   key_down(key), key_up(key)          keypad events from platform_process_input
+ *   draw(x, y, rows, collision)         DXYN
+ *   key_wait(pc)                        FX0A found no released key and will retry
+ *   unknown_opcode(pc, opcode)          fatal opcode, right before exiting */
+
+#if !defined(CILLY_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CILLY_PROBES 1
+#endif
+#endif
+
+#ifdef CILLY_PROBES
+#define PROBE0(name) STAP_PROBE(cilly, name)
+#define PROBE1(name, a) STAP_PROBE1(cilly, name, a)
+#define PROBE2(name, a, b) STAP_PROBE2(cilly, name, a, b)
+#define PROBE4(name, a, b, c, d) STAP_PROBE4(cilly, name, a, b, c, d)
+#else
+#define PROBE0(name) ((void)0)
+#define PROBE1(name, a) ((void)0)
+#define PROBE2(name, a, b) ((void)0)
+#define PROBE4(name, a, b, c, d) ((void)0)
+#endif /* CILLY_PROBES */
+
+#endif /* PROBES_H */
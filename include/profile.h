@@ -0,0 +1,48 @@
+#pragma once
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* Opcode execution histogram, compiled in with CHIP8_PROFILE (make profile=1).
+ * Without it every PROFILE_* hook expands to nothing and struct chip8 has no profile field */
+
+#include "opcode.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/* One counter per 16-bit address, so PC never needs to be bounds-checked */
+#define PROFILE_ADDRESS_COUNT 0x10000
+
+struct chip8_profile
+{
+    uint64_t instructions;            /* Total executed instructions */
+    uint64_t op_count[OP_COUNT];      /* Executions per instruction class */
+    uint64_t pc_count[PROFILE_ADDRESS_COUNT]; /* Executions per address */
+    uint64_t dxyn_rows;               /* Sprite rows drawn by DXYN */
+    uint64_t fx0a_wait_cycles;        /* Cycles spent in FX0A waiting for a key */
+};
+
+struct chip8;
+
+#ifdef CHIP8_PROFILE
+/* Count an instruction about to be executed at address pc */
+#define PROFILE_INSTRUCTION(chip8, pc, opcode) profile_instruction(&(chip8)->profile, (pc), (opcode))
+/* Add n to one of the event counters of struct chip8_profile */
+#define PROFILE_ADD(chip8, counter, n) ((chip8)->profile.counter += (n))
+#else
+#define PROFILE_INSTRUCTION(chip8, pc, opcode) ((void)0)
+#define PROFILE_ADD(chip8, counter, n) ((void)0)
+#endif /* CHIP8_PROFILE */
+
+static inline void profile_instruction(struct chip8_profile *profile, uint16_t pc, uint16_t opcode)
+{
+    profile->instructions++;
+    profile->op_count[chip8_op_classify(opcode)]++;
+    profile->pc_count[pc]++;
+}
+
+/* Print the instruction mix and the hottest addresses
+ * @param max_addresses Number of addresses to list */
+void profile_report(const struct chip8 *chip8, FILE *out, uint16_t max_addresses);
+
+#endif /* PROFILE_H */
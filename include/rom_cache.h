@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef ROM_CACHE_H
+#define ROM_CACHE_H
+
+#include "analysis.h"
+#include "chip8.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* ROMs identified by the hash of their contents, with the results of the static analysis kept on disk in a
+ * cache directory, one "<hash>.analysis" file per ROM. A ROM seen before is analyzed by mapping its file: the
+ * code/data map, the blocks, the issues and the detected platform are copied out without walking the program.
+ * Files are checked against the ROM bytes, the cache version and the structure layout, anything else is a miss
+ * and is overwritten. Bump ROM_CACHE_VERSION whenever the analysis results change */
+
+#define ROM_CACHE_VERSION 1
+
+/* ROM file mapped read-only */
+struct rom_image
+{
+    const uint8_t *data;
+    uint32_t size;
+    uint64_t hash; /* FNV-1a of the contents */
+    void *mapping; /* Platform handle, see rom_image_close */
+};
+
+/* Map a ROM file and hash it
+ * @return NULL on success, else the error message */
+const char *rom_image_open(struct rom_image *image, const char *path);
+void rom_image_close(struct rom_image *image);
+
+/* Analyze a ROM loaded at chip8->PC from its image, through the cache when directory is not NULL. The
+ * directory is created if needed. A failure to write the cache only loses the next hit, and a directory too long
+ * for the cache file names is not used at all
+ * @return -1 if out of memory, 1 on a cache hit, 0 if the ROM was analyzed */
+int8_t rom_cache_analysis(const char *directory, const struct rom_image *image, const struct chip8 *chip8,
+                          struct analysis *analysis);
+
+#endif /* ROM_CACHE_H */
@@ -0,0 +1,38 @@
+#pragma once
+
+#ifndef STEADY_H
+#define STEADY_H
+
+#include "chip8.h"
+#include <stdint.h>
+
+/* Steady state detection: the machine state is hashed at the end of every frame, and a hash seen before means
+ * the program, without further input, repeats the same frames forever: a fixed point (period 1, e.g. a 1NNN
+ * self-loop with the timers at 0) or a cycle (e.g. a blinking game over screen). The history has to be reset
+ * whenever input changes the keypad, a repeat across input proves nothing */
+
+/* Frames remembered, the longest cycle detected */
+#define STEADY_HISTORY 1024
+
+struct steady
+{
+    uint64_t hashes[STEADY_HISTORY]; /* Ring of chip8_hash_state at the end of the last frames */
+    uint32_t frames[STEADY_HISTORY]; /* Frame of each hash */
+    uint32_t count;                  /* Valid entries */
+    uint32_t next;                   /* Ring position of the next entry */
+
+    /* Set by steady_frame on a repeat */
+    uint32_t period; /* In frames, 0 until a repeat */
+    uint32_t first;  /* Frame at which the repeated state was first seen */
+};
+
+void steady_init(struct steady *steady);
+/* Forget the frames seen so far, call when input is applied */
+void steady_reset(struct steady *steady);
+/* Record the state at the end of a frame
+ * @param phase Scheduler state that decides how many instructions the next frames run, e.g. the remainder of a
+ * fractional instructions per frame rate or the VIP machine cycles carried over. Part of the recorded state
+ * @return Period in frames if the state was seen in an earlier frame, else 0 */
+uint32_t steady_frame(struct steady *steady, const struct chip8 *chip8, uint64_t phase, uint32_t frame);
+
+#endif /* STEADY_H */
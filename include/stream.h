@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "chip8.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Output buffer size, frames are written in blocks of this size */
+#define STREAM_BUFFER_SIZE (1 << 20)
+
+/* Frame stream formats. Frames are DISPLAY_WIDTH x DISPLAY_HEIGHT, low resolution pixels are doubled */
+enum stream_format
+{
+    STREAM_Y4M, /* YUV4MPEG2 with a monochrome 60 fps luma plane, pixels are 0 or 255 (XO-CHIP: 85 and 170
+                 * for the second plane alone and both planes) */
+    STREAM_RAW, /* Rows packed 8 pixels per byte, leftmost pixel in the MSB, set on any plane, no header */
+};
+
+/* Headless display output */
+struct stream
+{
+    int fd;
+    enum stream_format format;
+    uint8_t changed_only; /* Skip frames identical to the previous one written */
+
+    uint8_t *buffer;
+    size_t used;
+
+    struct chip8_display last;                      /* Last frame written, for changed_only */
+    uint8_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT]; /* Unpacked frame */
+    uint64_t frames;                                /* Frames written */
+    uint64_t bytes;                                 /* Bytes written */
+    int8_t error;                                   /* A write failed, the stream is dead */
+};
+
+/* Get a format by name ("y4m" or "raw")
+ * @return 0 if the name is unknown */
+int8_t stream_parse_format(const char *name, enum stream_format *format);
+/* Open a stream and write the format header
+ * @param path Output file, "-" for stdout
+ * @param changed_only Only write frames that differ from the previous one. Raw frames are then preceded by
+ * their frame number as a 32-bit little endian integer
+ * @return 0 if the file could not be opened */
+int8_t stream_open(struct stream *stream, const char *path, enum stream_format format, uint8_t changed_only);
+/* Append the current display
+ * @param frame Frame number, starting at 0
+ * @return 0 if the stream failed */
+int8_t stream_frame(struct stream *stream, const struct chip8 *chip8, uint32_t frame);
+/* Flush and close the stream
+ * @return 0 if a write failed at any point */
+int8_t stream_close(struct stream *stream);
+
+#endif /* STREAM_H */
@@ -0,0 +1,34 @@
+#pragma once
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYMBOL_NAME_LENGTH 48
+
+struct symbol
+{
+    uint16_t address;
+    char name[SYMBOL_NAME_LENGTH];
+};
+
+/* Label table, sorted by address */
+struct symbols
+{
+    struct symbol *entries;
+    uint32_t count;
+};
+
+/* Load labels from a symbol file, the labels of an Octo source with the addresses they assemble to.
+ * Each line holds a label and its address in either order, e.g. "main 0x202", "0x202 main" or "main = 0x202".
+ * Blank lines and lines starting with # are ignored
+ * @return 0 if the file could not be read */
+int8_t symbols_load(struct symbols *symbols, const char *filename);
+/* Free a label table */
+void symbols_free(struct symbols *symbols);
+/* Write a printable name for an address to buf: "label", "label+0x4" or "0x2a4" when there is no label before it */
+void symbols_format(const struct symbols *symbols, uint16_t address, char *buf, size_t size);
+
+#endif /* SYMBOLS_H */
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef TIER_H
+#define TIER_H
+
+#include "chip8.h"
+#include <stdint.h>
+
+/* Tiered execution: every instruction starts out interpreted by chip8_decode_and_execute, and the engine counts
+ * the entries into each block, i.e. every PC reached by anything other than falling through from the previous
+ * interpreted instruction (jumps, calls, returns, taken skips, leaving a promoted block). An entry point reached
+ * TIER_THRESHOLD times is promoted: the straight-line run from it up to the first instruction that can change the
+ * control flow is predecoded into one handler per instruction, with its operands extracted, and from then on
+ * runs without decoding. A short run never gets past the counters, and a promotion costs a single pass over at
+ * most TIER_BLOCK_LENGTH instructions.
+ *
+ * A block is demoted back to the interpreter when FX33, FX55 or 5XY2 write over it, and its entry has to warm up
+ * again. Every predecoded instruction is also checked against memory before it runs, so a machine copied or
+ * restored under the engine's feet (the differential checker bisects over copies, which share the counters) never
+ * runs stale code */
+
+/* Entries into a block before it is promoted */
+#define TIER_THRESHOLD 32
+/* Longest predecoded block, in instructions */
+#define TIER_BLOCK_LENGTH 64
+
+struct tier_op;
+typedef void (*tier_handler)(struct chip8 *chip8, const struct tier_op *op);
+
+/* Predecoded instruction */
+struct tier_op
+{
+    tier_handler handler; /* NULL if the address is not part of a promoted block */
+    uint16_t opcode;      /* Instruction the handler was chosen for */
+    uint8_t x;
+    uint8_t y;
+    uint16_t block; /* Entry address of the block, see tier_demote */
+};
+
+/* Engine state of one machine, hung off chip8->tier on its first cycle */
+struct tier
+{
+    uint16_t fallthrough; /* Address after the last interpreted instruction */
+    uint32_t promotions;
+    uint32_t demotions;
+    uint16_t hot[MAX_MEMORY];       /* Entries per address while interpreted */
+    struct tier_op ops[MAX_MEMORY]; /* By instruction address, calloc leaves the unused pages untouched */
+};
+
+/* Emulate one instruction cycle, the "tiered" engine. Exits if the engine state cannot be allocated */
+void tier_cycle(struct chip8 *chip8);
+/* Free the engine state of a machine, if it has any */
+void tier_release(struct chip8 *chip8);
+
+#endif /* TIER_H */
@@ -0,0 +1,86 @@
+#pragma once
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+struct chip8;
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+/* Default ring size in records, must be a power of two */
+#define TRACE_DEFAULT_RECORDS (1 << 16)
+
+/* One executed instruction, 12 bytes with no padding.
+ * The register written by most instructions is VX (X taken from the opcode), plus VF for the
+ * arithmetic and draw instructions, so both are stored after the instruction has executed */
+struct trace_record
+{
+    uint32_t cycle;  /* Low 32 bits of the instruction count */
+    uint16_t pc;     /* Address of the instruction */
+    uint16_t opcode;
+    uint16_t I;      /* Index register after execution */
+    uint8_t vx;      /* VX after execution */
+    uint8_t vf;      /* VF after execution */
+};
+
+/* Dump file header, followed by count records from oldest to newest */
+struct trace_header
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t cycle; /* Full instruction count of the newest record */
+};
+
+/* Preallocated ring buffer of the last executed instructions */
+struct trace
+{
+    struct trace_record *records;
+    uint32_t mask;  /* Capacity - 1 */
+    uint32_t count; /* Records held, up to the capacity */
+    uint32_t head;  /* Index of the next record to write */
+    uint64_t cycle; /* Instructions recorded so far */
+    char path[1024]; /* Dump destination, copied so it can be opened from a signal handler */
+};
+
+/* Allocate the ring buffer
+ * @param records Capacity, rounded up to a power of two
+ * @param path File written by trace_dump
+ * @return 0 if out of memory */
+int8_t trace_init(struct trace *trace, uint32_t records, const char *path);
+/* Free the ring buffer */
+void trace_free(struct trace *trace);
+/* Dump the buffer when the process crashes (SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT),
+ * and flag a dump request on SIGUSR1. Only one trace can be installed */
+void trace_install_handlers(struct trace *trace);
+/* Dump the buffer if SIGUSR1 was received since the last call */
+void trace_poll(struct trace *trace);
+/* Write the buffer to the trace path, async-signal-safe
+ * @return 0 if the file could not be written */
+int8_t trace_dump(const struct trace *trace);
+/* Record the faulting instruction and dump the buffer before the core exits on a fatal error.
+ * Does nothing if tracing is off */
+void trace_fault(struct chip8 *chip8, uint16_t opcode);
+
+/* Append an executed instruction, overwriting the oldest record when full */
+static inline void trace_record(struct trace *trace, uint16_t pc, uint16_t opcode, uint16_t I, const uint8_t *V)
+{
+    struct trace_record *record = &trace->records[trace->head];
+
+    record->cycle = (uint32_t)trace->cycle;
+    record->pc = pc;
+    record->opcode = opcode;
+    record->I = I;
+    record->vx = V[(opcode >> 8) & 0xF];
+    record->vf = V[0xF];
+
+    trace->head = (trace->head + 1) & trace->mask;
+    trace->count += trace->count <= trace->mask;
+    trace->cycle++;
+}
+
+#endif /* TRACE_H */
@@ -0,0 +1,653 @@
+#include "analysis.h"
+#include "opcode.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Marks an unknown value of I while tracking it through a block */
+#define ANALYSIS_NO_ADDRESS -1
+
+static const char *issue_names[ANALYSIS_ISSUE_KIND_COUNT] = {
+    "unknown_opcode", "machine_code", "self_modifying", "indirect_jump", "outside_rom",
+};
+
+static const char *edge_names[ANALYSIS_EDGE_KIND_COUNT] = {
+    "fallthrough", "jump", "call", "return_site", "skip",
+};
+
+static const char *platform_names[] = {"chip8", "schip", "xochip"};
+
+const char *analysis_issue_name(enum analysis_issue_kind kind)
+{
+    return kind < ANALYSIS_ISSUE_KIND_COUNT ? issue_names[kind] : "?";
+}
+
+const char *analysis_edge_name(enum analysis_edge_kind kind)
+{
+    return kind < ANALYSIS_EDGE_KIND_COUNT ? edge_names[kind] : "?";
+}
+
+const char *analysis_platform_name(enum analysis_platform platform)
+{
+    return platform <= ANALYSIS_XOCHIP ? platform_names[platform] : "?";
+}
+
+/* F000 NNNN is the only instruction with an operand word */
+static uint8_t analysis_length(const struct chip8 *chip8, uint16_t address)
+{
+    return chip8_fetch(chip8, address) == 0xF000 ? 4 : 2;
+}
+
+static uint8_t analysis_in_rom(const struct analysis *analysis, uint32_t address, uint32_t length)
+{
+    return address >= analysis->start && address + length <= analysis->end;
+}
+
+static uint8_t analysis_is_skip(enum chip8_op op)
+{
+    return op == OP_3XNN || op == OP_4XNN || op == OP_5XY0 || op == OP_9XY0 || op == OP_EX9E || op == OP_EXA1;
+}
+
+static int8_t analysis_add_issue(struct analysis *analysis, enum analysis_issue_kind kind, uint16_t address,
+                                 uint16_t opcode, uint16_t target)
+{
+    if (analysis->issue_count == analysis->issue_capacity)
+    {
+        uint32_t capacity = analysis->issue_capacity ? analysis->issue_capacity * 2 : 64;
+        struct analysis_issue *issues = realloc(analysis->issues, capacity * sizeof(*issues));
+        if (!issues)
+            return 0;
+        analysis->issues = issues;
+        analysis->issue_capacity = capacity;
+    }
+
+    analysis->issues[analysis->issue_count++] = (struct analysis_issue){
+        .kind = kind,
+        .address = address,
+        .opcode = opcode,
+        .target = target,
+    };
+    return 1;
+}
+
+/* Queue a branch target as the start of a block
+ * @return 0 if out of memory */
+static int8_t analysis_push(struct analysis *analysis, uint16_t *stack, uint32_t *depth, uint16_t from,
+                            uint16_t opcode, uint16_t target)
+{
+    if (!analysis_in_rom(analysis, target, 2))
+        return analysis_add_issue(analysis, ANALYSIS_OUTSIDE_ROM, from, opcode, target);
+
+    if (!(analysis->map[target] & ANALYSIS_LEADER))
+    {
+        analysis->map[target] |= ANALYSIS_LEADER;
+        stack[(*depth)++] = target;
+    }
+    return 1;
+}
+
+/* Follow every path from the entry point and mark the instructions it runs through */
+static int8_t analysis_walk(struct analysis *analysis, const struct chip8 *chip8)
+{
+    /* Every address is queued at most once, when it first becomes a leader */
+    uint16_t *stack = malloc(MAX_MEMORY * sizeof(uint16_t));
+    if (!stack)
+        return 0;
+
+    uint32_t depth = 0;
+    int8_t ok = analysis_push(analysis, stack, &depth, analysis->start, 0, analysis->start);
+
+    while (ok && depth)
+    {
+        uint16_t pc = stack[--depth];
+
+        while (ok && !(analysis->map[pc] & ANALYSIS_CODE))
+        {
+            uint16_t opcode = chip8_fetch(chip8, pc);
+            enum chip8_op op = chip8_op_classify(opcode);
+            uint8_t length = analysis_length(chip8, pc);
+            uint16_t nnn = opcode & 0x0FFF;
+
+            analysis->map[pc] |= ANALYSIS_CODE;
+            for (uint8_t i = 1; i < length; i++)
+                analysis->map[(pc + i) & (MAX_MEMORY - 1)] |= ANALYSIS_OPERAND;
+
+            uint32_t next = pc + length;
+            uint8_t stop = 0;
+            switch (op)
+            {
+            case OP_1NNN:
+                ok = analysis_push(analysis, stack, &depth, pc, opcode, nnn);
+                stop = 1;
+                break;
+            case OP_2NNN:
+                ok = analysis_push(analysis, stack, &depth, pc, opcode, nnn);
+                /* The callee comes back to the next instruction, which starts its own block */
+                if (analysis_in_rom(analysis, next, 2))
+                    analysis->map[next] |= ANALYSIS_LEADER;
+                break;
+            case OP_00EE:
+            case OP_00FD:
+                stop = 1;
+                break;
+            case OP_BNNN:
+                ok = analysis_add_issue(analysis, ANALYSIS_INDIRECT_JUMP, pc, opcode, nnn);
+                stop = 1;
+                break;
+            case OP_UNKNOWN:
+                ok = analysis_add_issue(analysis, ANALYSIS_UNKNOWN_OPCODE, pc, opcode, 0);
+                stop = 1;
+                break;
+            case OP_0NNN:
+                ok = analysis_add_issue(analysis, ANALYSIS_MACHINE_CODE, pc, opcode, nnn);
+                break;
+            default:
+                if (analysis_is_skip(op) && analysis_in_rom(analysis, next, 2))
+                {
+                    /* Skips step over the whole next instruction, including F000's operand */
+                    analysis->map[next] |= ANALYSIS_LEADER;
+                    ok = analysis_push(analysis, stack, &depth, pc, opcode, next + analysis_length(chip8, next));
+                }
+                break;
+            }
+
+            if (stop)
+                break;
+            if (!analysis_in_rom(analysis, next, 2))
+            {
+                ok = ok && analysis_add_issue(analysis, ANALYSIS_OUTSIDE_ROM, pc, opcode, next);
+                break;
+            }
+            pc = next;
+        }
+    }
+
+    free(stack);
+    return ok;
+}
+
+/* Where the block's last instruction sends control */
+static void analysis_add_edges(struct analysis *analysis, const struct chip8 *chip8, struct analysis_block *block,
+                               uint16_t last)
+{
+    uint16_t opcode = chip8_fetch(chip8, last);
+    enum chip8_op op = chip8_op_classify(opcode);
+    uint16_t nnn = opcode & 0x0FFF;
+    uint32_t next = block->end;
+
+    switch (op)
+    {
+    case OP_1NNN:
+        if (analysis_in_rom(analysis, nnn, 2))
+            block->edges[block->edge_count++] = (struct analysis_edge){nnn, ANALYSIS_EDGE_JUMP, 0};
+        return;
+    case OP_2NNN:
+        if (analysis_in_rom(analysis, nnn, 2))
+            block->edges[block->edge_count++] = (struct analysis_edge){nnn, ANALYSIS_EDGE_CALL, 0};
+        if (analysis_in_rom(analysis, next, 2))
+            block->edges[block->edge_count++] = (struct analysis_edge){next, ANALYSIS_EDGE_RETURN_SITE, 0};
+        else
+            block->flags |= ANALYSIS_BLOCK_HALT;
+        return;
+    case OP_00EE:
+        block->flags |= ANALYSIS_BLOCK_RETURN;
+        return;
+    case OP_00FD:
+        block->flags |= ANALYSIS_BLOCK_EXIT;
+        return;
+    case OP_BNNN:
+        block->flags |= ANALYSIS_BLOCK_INDIRECT;
+        return;
+    case OP_UNKNOWN:
+        block->flags |= ANALYSIS_BLOCK_HALT;
+        return;
+    default:
+        break;
+    }
+
+    if (!analysis_in_rom(analysis, next, 2))
+    {
+        block->flags |= ANALYSIS_BLOCK_HALT;
+        return;
+    }
+    block->edges[block->edge_count++] = (struct analysis_edge){next, ANALYSIS_EDGE_FALLTHROUGH, 0};
+    if (analysis_is_skip(op))
+    {
+        uint16_t target = next + analysis_length(chip8, next);
+        if (analysis_in_rom(analysis, target, 2))
+            block->edges[block->edge_count++] = (struct analysis_edge){target, ANALYSIS_EDGE_SKIP, 0};
+    }
+}
+
+/* Split the marked instructions into basic blocks */
+static int8_t analysis_build_blocks(struct analysis *analysis, const struct chip8 *chip8)
+{
+    uint32_t count = 0;
+    for (uint32_t address = analysis->start; address < analysis->end; address++)
+        count += (analysis->map[address] & (ANALYSIS_LEADER | ANALYSIS_CODE)) == (ANALYSIS_LEADER | ANALYSIS_CODE);
+
+    analysis->blocks = calloc(count ? count : 1, sizeof(*analysis->blocks));
+    if (!analysis->blocks)
+        return 0;
+
+    for (uint32_t address = analysis->start; address < analysis->end; address++)
+    {
+        if ((analysis->map[address] & (ANALYSIS_LEADER | ANALYSIS_CODE)) != (ANALYSIS_LEADER | ANALYSIS_CODE))
+            continue;
+
+        struct analysis_block *block = &analysis->blocks[analysis->block_count++];
+        block->start = address;
+
+        /* Same path the walk took, up to a control transfer or the next leader */
+        uint16_t last = address;
+        for (;;)
+        {
+            enum chip8_op op = chip8_op_classify(chip8_fetch(chip8, last));
+            uint32_t next = last + analysis_length(chip8, last);
+            if (op == OP_1NNN || op == OP_2NNN || op == OP_00EE || op == OP_00FD || op == OP_BNNN ||
+                op == OP_UNKNOWN || analysis_is_skip(op) || !analysis_in_rom(analysis, next, 2) ||
+                (analysis->map[next] & (ANALYSIS_LEADER | ANALYSIS_CODE)) != ANALYSIS_CODE)
+            {
+                block->end = next;
+                break;
+            }
+            last = next;
+        }
+        analysis_add_edges(analysis, chip8, block, last);
+    }
+    return 1;
+}
+
+static int compare_blocks(const void *address, const void *block)
+{
+    return (int)*(const uint16_t *)address - ((const struct analysis_block *)block)->start;
+}
+
+static struct analysis_block *analysis_find_block(const struct analysis *analysis, uint16_t start)
+{
+    return bsearch(&start, analysis->blocks, analysis->block_count, sizeof(*analysis->blocks), compare_blocks);
+}
+
+/* Depth-first search from the entry block: an edge back to a block still on the search path closes a loop.
+ * Calls into a subroutine already on the path are recursion, not loops */
+static int8_t analysis_find_loops(struct analysis *analysis)
+{
+    if (!analysis->block_count)
+        return 1;
+
+    uint8_t *state = calloc(analysis->block_count, 1); /* 0 unvisited, 1 on the path, 2 done */
+    uint32_t *path = malloc(analysis->block_count * sizeof(uint32_t));
+    uint8_t *next_edge = calloc(analysis->block_count, 1);
+    if (!state || !path || !next_edge)
+    {
+        free(state);
+        free(path);
+        free(next_edge);
+        return 0;
+    }
+
+    uint32_t depth = 0;
+    path[depth++] = 0;
+    state[0] = 1;
+    while (depth)
+    {
+        uint32_t index = path[depth - 1];
+        struct analysis_block *block = &analysis->blocks[index];
+        if (next_edge[index] == block->edge_count)
+        {
+            state[index] = 2;
+            depth--;
+            continue;
+        }
+
+        struct analysis_edge *edge = &block->edges[next_edge[index]++];
+        struct analysis_block *target = analysis_find_block(analysis, edge->to);
+        if (!target)
+            continue;
+
+        uint32_t target_index = target - analysis->blocks;
+        if (!state[target_index])
+        {
+            state[target_index] = 1;
+            path[depth++] = target_index;
+        }
+        else if (state[target_index] == 1 && edge->kind != ANALYSIS_EDGE_CALL)
+        {
+            edge->back = 1;
+            target->flags |= ANALYSIS_BLOCK_LOOP;
+        }
+    }
+
+    free(state);
+    free(path);
+    free(next_edge);
+    return 1;
+}
+
+/* Mark the bytes an instruction reads or writes through I
+ * @return 0 if out of memory */
+static int8_t analysis_access(struct analysis *analysis, uint16_t pc, uint16_t opcode, int32_t address,
+                              uint32_t length, uint8_t flag)
+{
+    if (address == ANALYSIS_NO_ADDRESS)
+        return 1;
+
+    int32_t overwritten = ANALYSIS_NO_ADDRESS;
+    for (uint32_t i = 0; i < length && address + i < MAX_MEMORY; i++)
+    {
+        analysis->map[address + i] |= flag;
+        if (flag == ANALYSIS_WRITTEN && overwritten == ANALYSIS_NO_ADDRESS &&
+            (analysis->map[address + i] & (ANALYSIS_CODE | ANALYSIS_OPERAND)))
+            overwritten = address + i;
+    }
+
+    if (overwritten != ANALYSIS_NO_ADDRESS)
+        return analysis_add_issue(analysis, ANALYSIS_SELF_MODIFYING, pc, opcode, overwritten);
+    return 1;
+}
+
+/* Track I through each block to find sprites, tables and stores. Only values set within the block are known */
+static int8_t analysis_find_data(struct analysis *analysis, const struct chip8 *chip8)
+{
+    for (uint32_t b = 0; b < analysis->block_count; b++)
+    {
+        const struct analysis_block *block = &analysis->blocks[b];
+        int32_t I = ANALYSIS_NO_ADDRESS;
+
+        for (uint32_t pc = block->start; pc < block->end; pc += analysis_length(chip8, pc))
+        {
+            uint16_t opcode = chip8_fetch(chip8, pc);
+            uint8_t x = (opcode >> 8) & 0xF;
+            uint8_t y = (opcode >> 4) & 0xF;
+            uint8_t n = opcode & 0xF;
+            uint8_t registers = (x > y ? x - y : y - x) + 1;
+            int8_t ok = 1;
+
+            switch (chip8_op_classify(opcode))
+            {
+            case OP_ANNN:
+                I = opcode & 0x0FFF;
+                analysis->map[I] |= ANALYSIS_DATA_REF;
+                break;
+            case OP_F000:
+                I = chip8_fetch(chip8, pc + 2);
+                analysis->map[I] |= ANALYSIS_DATA_REF;
+                break;
+            case OP_DXYN:
+                ok = analysis_access(analysis, pc, opcode, I, n, ANALYSIS_DATA);
+                break;
+            case OP_DXY0:
+                ok = analysis_access(analysis, pc, opcode, I, 32, ANALYSIS_DATA);
+                break;
+            case OP_FX33:
+                ok = analysis_access(analysis, pc, opcode, I, 3, ANALYSIS_WRITTEN);
+                break;
+            case OP_FX55:
+                ok = analysis_access(analysis, pc, opcode, I, x + 1, ANALYSIS_WRITTEN);
+                if (I != ANALYSIS_NO_ADDRESS)
+                    I += x + 1;
+                break;
+            case OP_FX65:
+                ok = analysis_access(analysis, pc, opcode, I, x + 1, ANALYSIS_DATA);
+                if (I != ANALYSIS_NO_ADDRESS)
+                    I += x + 1;
+                break;
+            case OP_5XY2:
+                ok = analysis_access(analysis, pc, opcode, I, registers, ANALYSIS_WRITTEN);
+                break;
+            case OP_5XY3:
+                ok = analysis_access(analysis, pc, opcode, I, registers, ANALYSIS_DATA);
+                break;
+            case OP_F002:
+                ok = analysis_access(analysis, pc, opcode, I, AUDIO_PATTERN_SIZE, ANALYSIS_DATA);
+                break;
+            case OP_FX1E:
+            case OP_FX29:
+            case OP_FX30:
+                I = ANALYSIS_NO_ADDRESS;
+                break;
+            default:
+                break;
+            }
+            if (!ok)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Detect the instruction set from the reachable instructions */
+static void analysis_detect_platform(struct analysis *analysis, const struct chip8 *chip8)
+{
+    analysis->platform = analysis->end > CHIP8_MEMORY ? ANALYSIS_XOCHIP : ANALYSIS_CHIP8;
+    for (uint32_t address = analysis->start; address < analysis->end; address++)
+    {
+        if (!(analysis->map[address] & ANALYSIS_CODE))
+            continue;
+
+        switch (chip8_op_classify(chip8_fetch(chip8, address)))
+        {
+        case OP_00CN:
+        case OP_00FB:
+        case OP_00FC:
+        case OP_00FD:
+        case OP_00FE:
+        case OP_00FF:
+        case OP_DXY0:
+        case OP_FX30:
+        case OP_FX75:
+        case OP_FX85:
+            if (analysis->platform < ANALYSIS_SCHIP)
+                analysis->platform = ANALYSIS_SCHIP;
+            break;
+        case OP_00DN:
+        case OP_5XY2:
+        case OP_5XY3:
+        case OP_F000:
+        case OP_FN01:
+        case OP_F002:
+        case OP_FX3A:
+            analysis->platform = ANALYSIS_XOCHIP;
+            return;
+        default:
+            break;
+        }
+    }
+}
+
+static int compare_issues(const void *a, const void *b)
+{
+    const struct analysis_issue *first = a, *second = b;
+    if (first->address != second->address)
+        return (int)first->address - second->address;
+    return (int)first->kind - second->kind;
+}
+
+int8_t analysis_run(struct analysis *analysis, const struct chip8 *chip8, uint16_t start, uint32_t size)
+{
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->start = start;
+    analysis->end = start + size < MAX_MEMORY ? start + size : MAX_MEMORY;
+
+    if (!analysis_walk(analysis, chip8) || !analysis_build_blocks(analysis, chip8) || !analysis_find_loops(analysis) ||
+        !analysis_find_data(analysis, chip8))
+    {
+        analysis_free(analysis);
+        return 0;
+    }
+
+    qsort(analysis->issues, analysis->issue_count, sizeof(*analysis->issues), compare_issues);
+    analysis_detect_platform(analysis, chip8);
+    return 1;
+}
+
+void analysis_free(struct analysis *analysis)
+{
+    free(analysis->blocks);
+    free(analysis->issues);
+    analysis->blocks = NULL;
+    analysis->issues = NULL;
+    analysis->block_count = 0;
+    analysis->issue_count = 0;
+    analysis->issue_capacity = 0;
+}
+
+uint32_t analysis_count_issues(const struct analysis *analysis, enum analysis_issue_kind kind)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < analysis->issue_count; i++)
+        count += analysis->issues[i].kind == kind;
+    return count;
+}
+
+enum analysis_region
+{
+    REGION_CODE,
+    REGION_DATA,
+    REGION_UNREACHED,
+};
+
+static const char *region_names[] = {"code", "data", "unreached"};
+
+/* Bytes nobody reads but that follow a data reference are taken as the rest of that table or sprite */
+static enum analysis_region analysis_region(const struct analysis *analysis, uint32_t address, uint8_t *in_data)
+{
+    uint8_t flags = analysis->map[address];
+    if (flags & (ANALYSIS_CODE | ANALYSIS_OPERAND))
+    {
+        *in_data = 0;
+        return REGION_CODE;
+    }
+    if (flags & (ANALYSIS_DATA | ANALYSIS_WRITTEN | ANALYSIS_DATA_REF))
+        *in_data = 1;
+    return *in_data ? REGION_DATA : REGION_UNREACHED;
+}
+
+void analysis_write_json(const struct analysis *analysis, const struct chip8 *chip8, FILE *out)
+{
+    uint32_t bytes[3] = {0};
+    uint8_t in_data = 0;
+    for (uint32_t address = analysis->start; address < analysis->end; address++)
+        bytes[analysis_region(analysis, address, &in_data)]++;
+
+    fprintf(out, "{\n  \"start\": %u,\n  \"size\": %u,\n  \"memory_size\": %u,\n  \"platform\": \"%s\",\n",
+            analysis->start, analysis->end - analysis->start, chip8->memory_size,
+            analysis_platform_name(analysis->platform));
+    fprintf(out, "  \"bytes\": {\"code\": %u, \"data\": %u, \"unreached\": %u},\n", bytes[REGION_CODE],
+            bytes[REGION_DATA], bytes[REGION_UNREACHED]);
+
+    /* Contiguous runs of one kind */
+    fprintf(out, "  \"regions\": [");
+    in_data = 0;
+    uint32_t region_start = analysis->start;
+    enum analysis_region region = analysis_region(analysis, region_start, &in_data);
+    const char *separator = "";
+    for (uint32_t address = analysis->start + 1; address <= analysis->end; address++)
+    {
+        enum analysis_region next = address < analysis->end ? analysis_region(analysis, address, &in_data) : region;
+        if (address < analysis->end && next == region)
+            continue;
+        fprintf(out, "%s\n    {\"start\": %u, \"end\": %u, \"kind\": \"%s\"}", separator, region_start, address,
+                region_names[region]);
+        separator = ",";
+        region_start = address;
+        region = next;
+    }
+    fprintf(out, "\n  ],\n");
+
+    fprintf(out, "  \"blocks\": [");
+    for (uint32_t b = 0; b < analysis->block_count; b++)
+    {
+        const struct analysis_block *block = &analysis->blocks[b];
+        fprintf(out, "%s\n    {\"start\": %u, \"end\": %u, \"successors\": [", b ? "," : "", block->start, block->end);
+        for (uint8_t e = 0; e < block->edge_count; e++)
+            fprintf(out, "%s{\"to\": %u, \"kind\": \"%s\"}", e ? ", " : "", block->edges[e].to,
+                    analysis_edge_name(block->edges[e].kind));
+        fprintf(out, "]");
+
+        static const char *flag_names[] = {"return", "exit", "indirect", "halt", "loop"};
+        fprintf(out, ", \"flags\": [");
+        separator = "";
+        for (uint8_t flag = 0; flag < sizeof(flag_names) / sizeof(flag_names[0]); flag++)
+        {
+            if (block->flags & (1 << flag))
+            {
+                fprintf(out, "%s\"%s\"", separator, flag_names[flag]);
+                separator = ", ";
+            }
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n  ],\n");
+
+    /* One entry per back edge: the latch block jumps back to the header */
+    fprintf(out, "  \"loops\": [");
+    separator = "";
+    for (uint32_t b = 0; b < analysis->block_count; b++)
+    {
+        const struct analysis_block *block = &analysis->blocks[b];
+        for (uint8_t e = 0; e < block->edge_count; e++)
+        {
+            if (!block->edges[e].back)
+                continue;
+            fprintf(out, "%s\n    {\"header\": %u, \"latch\": %u}", separator, block->edges[e].to, block->start);
+            separator = ",";
+        }
+    }
+    fprintf(out, "\n  ],\n");
+
+    fprintf(out, "  \"issues\": [");
+    for (uint32_t i = 0; i < analysis->issue_count; i++)
+    {
+        const struct analysis_issue *issue = &analysis->issues[i];
+        fprintf(out, "%s\n    {\"kind\": \"%s\", \"address\": %u, \"opcode\": \"%04X\", \"target\": %u}", i ? "," : "",
+                analysis_issue_name(issue->kind), issue->address, issue->opcode, issue->target);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+void analysis_write_dot(const struct analysis *analysis, const struct symbols *symbols, FILE *out)
+{
+    static const char *edge_styles[ANALYSIS_EDGE_KIND_COUNT] = {
+        "",               /* Fallthrough */
+        "",               /* Jump */
+        "style=dashed",   /* Call */
+        "style=dotted",   /* Return site */
+        "label=\"skip\"", /* Skip */
+    };
+
+    fprintf(out, "digraph cfg {\n  node [shape=box fontname=\"monospace\"];\n");
+    for (uint32_t b = 0; b < analysis->block_count; b++)
+    {
+        const struct analysis_block *block = &analysis->blocks[b];
+        fprintf(out, "  b%04x [label=\"", block->start);
+        if (symbols)
+        {
+            char name[SYMBOL_NAME_LENGTH + 16];
+            symbols_format(symbols, block->start, name, sizeof(name));
+            fprintf(out, "%s\\n", name);
+        }
+        fprintf(out, "0x%03x-0x%03x\"", block->start, block->end);
+        if (block->flags & ANALYSIS_BLOCK_HALT)
+            fprintf(out, " color=red");
+        else if (block->flags & (ANALYSIS_BLOCK_RETURN | ANALYSIS_BLOCK_EXIT))
+            fprintf(out, " style=rounded");
+        if (block->flags & ANALYSIS_BLOCK_LOOP)
+            fprintf(out, " penwidth=2");
+        fprintf(out, "];\n");
+    }
+
+    for (uint32_t b = 0; b < analysis->block_count; b++)
+    {
+        const struct analysis_block *block = &analysis->blocks[b];
+        for (uint8_t e = 0; e < block->edge_count; e++)
+        {
+            const struct analysis_edge *edge = &block->edges[e];
+            const char *style = edge_styles[edge->kind];
+            fprintf(out, "  b%04x -> b%04x [%s", block->start, edge->to, style);
+            if (edge->back)
+                fprintf(out, "%scolor=blue constraint=false", *style ? " " : "");
+            fprintf(out, "];\n");
+        }
+    }
+    fprintf(out, "}\n");
+}
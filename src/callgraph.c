@@ -0,0 +1,106 @@
+#include "callgraph.h"
+#include <stdlib.h>
+#include <string.h>
+
+int8_t callgraph_init(struct callgraph *callgraph, uint16_t entry_address)
+{
+    callgraph->capacity = 256;
+    callgraph->nodes = calloc(callgraph->capacity, sizeof(*callgraph->nodes));
+    if (!callgraph->nodes)
+        return 0;
+
+    callgraph->nodes[0].address = entry_address;
+    callgraph->count = 1;
+    callgraph->current = 0;
+    return 1;
+}
+
+void callgraph_free(struct callgraph *callgraph)
+{
+    free(callgraph->nodes);
+    callgraph->nodes = NULL;
+    callgraph->count = 0;
+}
+
+/* Find or create the node for calling address from the current node */
+static uint32_t callgraph_enter(struct callgraph *callgraph, uint16_t address)
+{
+    uint32_t parent = callgraph->current;
+
+    for (uint32_t child = callgraph->nodes[parent].first_child; child; child = callgraph->nodes[child].next_sibling)
+    {
+        if (callgraph->nodes[child].address == address)
+            return child;
+    }
+
+    if (callgraph->count == callgraph->capacity)
+    {
+        struct callgraph_node *nodes = realloc(callgraph->nodes, callgraph->capacity * 2 * sizeof(*nodes));
+        /* Out of memory: keep charging the caller */
+        if (!nodes)
+            return parent;
+        callgraph->nodes = nodes;
+        callgraph->capacity *= 2;
+    }
+
+    uint32_t node = callgraph->count++;
+    callgraph->nodes[node] = (struct callgraph_node){
+        .address = address,
+        .parent = parent,
+        .first_child = 0,
+        .next_sibling = callgraph->nodes[parent].first_child,
+        .cycles = 0,
+    };
+    callgraph->nodes[parent].first_child = node;
+    return node;
+}
+
+void callgraph_update(struct callgraph *callgraph, const struct chip8 *chip8, uint8_t previous_sp)
+{
+    /* 2NNN pushed a frame and PC is now the subroutine's entry point */
+    if (chip8->SP > previous_sp)
+    {
+        callgraph->current = callgraph_enter(callgraph, chip8->PC);
+        return;
+    }
+
+    /* 00EE popped one or more frames */
+    for (uint8_t sp = chip8->SP; sp < previous_sp && callgraph->current; sp++)
+        callgraph->current = callgraph->nodes[callgraph->current].parent;
+}
+
+/* Flamegraph tools split frames on ';' and the count on the last space */
+static void write_frame(const struct symbols *symbols, uint16_t address, FILE *out)
+{
+    char name[SYMBOL_NAME_LENGTH + 8];
+    symbols_format(symbols, address, name, sizeof(name));
+
+    for (char *c = name; *c; c++)
+    {
+        if (*c == ';' || *c == ' ')
+            *c = '_';
+    }
+    fputs(name, out);
+}
+
+static void write_stack(const struct callgraph *callgraph, const struct symbols *symbols, uint32_t node, FILE *out)
+{
+    if (node)
+    {
+        write_stack(callgraph, symbols, callgraph->nodes[node].parent, out);
+        fputc(';', out);
+    }
+    write_frame(symbols, callgraph->nodes[node].address, out);
+}
+
+void callgraph_write_folded(const struct callgraph *callgraph, const struct symbols *symbols, FILE *out)
+{
+    for (uint32_t node = 0; node < callgraph->count; node++)
+    {
+        if (!callgraph->nodes[node].cycles)
+            continue;
+
+        write_stack(callgraph, symbols, node, out);
+        fprintf(out, " %llu\n", (unsigned long long)callgraph->nodes[node].cycles);
+    }
+}
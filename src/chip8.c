@@ -1,4 +1,5 @@
 #include "chip8.h"
+#include "probes.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,50 +14,172 @@ void chip8_init(struct chip8 *chip8, uint16_t pc_start_address)
     /* Init chip8 fields */
     memset(chip8, 0, sizeof(struct chip8));
     chip8->PC = pc_start_address;
+    chip8->memory_size = CHIP8_MEMORY;
+    chip8->display.plane_mask = 1;
+    chip8->pitch = AUDIO_DEFAULT_PITCH;
     chip8_load_fontset(chip8);
 
     /* Init seed */
-    srand(time(NULL));
+    chip8_seed(chip8, time(NULL));
 }
 
-void chip8_load_rom(struct chip8 *chip8, const char *filename)
+void chip8_seed(struct chip8 *chip8, uint32_t seed)
 {
-    FILE *rom = fopen(filename, "rb");
+    /* xorshift gets stuck at 0 */
+    chip8->rng = seed ? seed : 0x9E3779B9;
+}
 
-    if (rom)
+/* @return 1 if a plane has a set pixel */
+static uint8_t chip8_plane_used(const struct chip8_display *display, uint8_t plane)
+{
+    for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++)
     {
-        /* Find the ROM file size */
-        fseek(rom, 0L, SEEK_END);
-        uint64_t rom_size = ftell(rom);
-        fseek(rom, 0L, SEEK_SET);
+        for (uint8_t word = 0; word < DISPLAY_WORDS; word++)
+        {
+            if (display->planes[plane][y][word])
+                return 1;
+        }
+    }
+    return 0;
+}
 
-        if (rom_size > 0)
+uint64_t chip8_hash_display(const struct chip8 *chip8)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint8_t words = chip8_display_width(&chip8->display) / 64;
+
+    /* Programs that only use the first plane hash the same as before there were planes */
+    for (uint8_t plane = 0; plane < PLANE_COUNT; plane++)
+    {
+        if (plane && !chip8_plane_used(&chip8->display, plane))
+            continue;
+
+        for (uint8_t y = 0; y < chip8_display_height(&chip8->display); y++)
         {
-            if (rom_size <= MAX_MEMORY)
-            {
-                fread(chip8->memory + chip8->PC, 1, rom_size, rom);
-            }
-            else
+            for (uint8_t word = 0; word < words; word++)
             {
-                /* Handle ROM too large for memory */
-                printf("Error: ROM size exceeds memory bounds.\n");
-                exit(EXIT_FAILURE);
+                /* Leftmost pixels are in the most significant byte */
+                for (int8_t shift = 56; shift >= 0; shift -= 8)
+                {
+                    hash ^= (uint8_t)(chip8->display.planes[plane][y][word] >> shift);
+                    hash *= 0x100000001b3ull;
+                }
             }
         }
-        else
-        {
-            /* Handle empty ROM file */
-            printf("Error: ROM file is empty.\n");
-            exit(EXIT_FAILURE);
-        }
-        fclose(rom);
     }
-    else
+    return hash;
+}
+
+/* Mix a word into a state hash, one multiply per word keeps hashing 64 KB of memory cheap */
+static inline uint64_t chip8_hash_word(uint64_t hash, uint64_t word)
+{
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 29);
+}
+
+uint64_t chip8_hash_state(const struct chip8 *chip8)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    /* memory_size is a multiple of 8 */
+    for (uint32_t address = 0; address < chip8->memory_size; address += 8)
     {
-        /* Handle file opening error */
-        printf("Error: Failed to open the ROM file.\n");
+        uint64_t word;
+        memcpy(&word, chip8->memory + address, sizeof(word));
+        hash = chip8_hash_word(hash, word);
+    }
+    for (uint32_t i = 0; i < sizeof(chip8->display.planes) / sizeof(uint64_t); i++)
+        hash = chip8_hash_word(hash, (&chip8->display.planes[0][0][0])[i]);
+
+    /* Stack entries above SP are never read again */
+    for (uint8_t i = 0; i < chip8->SP && i < STACK_SIZE; i++)
+        hash = chip8_hash_word(hash, chip8->stack[i]);
+
+    uint64_t words[8] = {0};
+    memcpy(&words[0], chip8->V, REGISTER_COUNT);
+    memcpy(&words[2], chip8->rpl, RPL_COUNT);
+    words[3] = chip8->keys_down | (uint64_t)chip8->keys_released << 16 | (uint64_t)chip8->key_wait << 32 |
+               (uint64_t)chip8->halted << 40;
+    memcpy(&words[5], chip8->audio_pattern, AUDIO_PATTERN_SIZE);
+    words[7] = (uint64_t)chip8->PC | (uint64_t)chip8->I << 16 | (uint64_t)chip8->SP << 32 |
+               (uint64_t)chip8->delay_timer << 40 | (uint64_t)chip8->sound_timer << 48 |
+               (uint64_t)chip8->display.hires << 56 | (uint64_t)chip8->display.plane_mask << 57;
+    for (uint8_t i = 0; i < 8; i++)
+        hash = chip8_hash_word(hash, words[i]);
+    hash = chip8_hash_word(hash, (uint64_t)chip8->rng | (uint64_t)chip8->pitch << 32 |
+                                     (uint64_t)chip8->audio_pattern_loaded << 40 |
+                                     (uint64_t)chip8->memory_size << 41);
+    return hash;
+}
+
+void chip8_update_timers(struct chip8 *chip8)
+{
+    if (chip8->delay_timer > 0)
+        chip8->delay_timer--;
+    if (chip8->sound_timer > 0)
+        chip8->sound_timer--;
+}
+
+const char *chip8_check_rom_size(uint16_t address, uint64_t size)
+{
+    if (!size)
+        return "ROM file is empty.";
+    if (size > (uint64_t)(MAX_MEMORY - address))
+        return "ROM size exceeds memory bounds.";
+    return NULL;
+}
+
+/* Only XO-CHIP programs can be larger than 4 KB */
+static void chip8_fit_memory(struct chip8 *chip8, uint64_t size)
+{
+    if (chip8->PC + size > CHIP8_MEMORY)
+        chip8->memory_size = MAX_MEMORY;
+}
+
+const char *chip8_read_rom(struct chip8 *chip8, const char *filename, uint32_t *size)
+{
+    FILE *rom = fopen(filename, "rb");
+    if (!rom)
+        return "Failed to open the ROM file.";
+
+    /* Find the ROM file size */
+    fseek(rom, 0L, SEEK_END);
+    long rom_size = ftell(rom);
+    fseek(rom, 0L, SEEK_SET);
+
+    const char *error = rom_size < 0 ? "Failed to read the ROM file." : chip8_check_rom_size(chip8->PC, rom_size);
+    if (!error && fread(chip8->memory + chip8->PC, 1, rom_size, rom) != (size_t)rom_size)
+        error = "Failed to read the ROM file.";
+    fclose(rom);
+    if (error)
+        return error;
+
+    chip8_fit_memory(chip8, rom_size);
+    *size = rom_size;
+    return NULL;
+}
+
+const char *chip8_load_image(struct chip8 *chip8, const uint8_t *data, uint32_t size)
+{
+    const char *error = chip8_check_rom_size(chip8->PC, size);
+    if (error)
+        return error;
+
+    memcpy(chip8->memory + chip8->PC, data, size);
+    chip8_fit_memory(chip8, size);
+    return NULL;
+}
+
+uint32_t chip8_load_rom(struct chip8 *chip8, const char *filename)
+{
+    uint32_t size;
+    const char *error = chip8_read_rom(chip8, filename, &size);
+    if (error)
+    {
+        fprintf(stderr, "Error: %s\n", error);
         exit(EXIT_FAILURE);
     }
+    return size;
 }
 
 void chip8_load_fontset(struct chip8 *chip8)
@@ -93,15 +216,43 @@ void chip8_load_fontset(struct chip8 *chip8)
     {
         chip8->memory[FONTSET_START_ADDRESS + i] = fontset[i];
     }
+
+    /* SUPER-CHIP 8x10 digits for FX30 */
+    uint8_t big_fontset[] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+    memcpy(chip8->memory + BIG_FONTSET_START_ADDRESS, big_fontset, sizeof(big_fontset));
 }
 
-void chip8_reset_released_keys(struct chip8 *chip8)
+void chip8_key_event(struct chip8 *chip8, uint8_t key, uint8_t pressed)
 {
-    for (uint8_t key = 0; key < KEY_COUNT; key++)
+    uint16_t bit = 1 << (key & 0xF);
+    if (pressed)
     {
-        if (chip8->keypad[key] == 2)
-            chip8->keypad[key] = 0;
+        chip8->keys_down |= bit;
+        return;
     }
+
+    /* Releases before FX0A started waiting are not for it, and neither are releases of keys that were not held,
+     * e.g. a key pressed on another mosaic tile */
+    if (chip8->key_wait && (chip8->keys_down & bit))
+        chip8->keys_released |= bit;
+    chip8->keys_down &= ~bit;
 }
 
 void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
@@ -118,6 +269,22 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
     switch (instruction_group)
     {
     case 0x0:
+        /* 00CN:
+         * SCHIP: Scroll the display down N pixels */
+        if (x == 0 && y == 0xC)
+        {
+            chip8_scroll_down(chip8, n);
+            break;
+        }
+
+        /* 00DN:
+         * XO-CHIP: Scroll the display up N pixels */
+        if (x == 0 && y == 0xD)
+        {
+            chip8_scroll_up(chip8, n);
+            break;
+        }
+
         switch (nn)
         {
         /* 00E0:
@@ -132,6 +299,37 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
             chip8->SP--;
             chip8->PC = chip8->stack[chip8->SP];
             break;
+
+        /* 00FB:
+         * SCHIP: Scroll the display right 4 pixels */
+        case 0xFB:
+            chip8_scroll_right(chip8);
+            break;
+
+        /* 00FC:
+         * SCHIP: Scroll the display left 4 pixels */
+        case 0xFC:
+            chip8_scroll_left(chip8);
+            break;
+
+        /* 00FD:
+         * SCHIP: Exit the interpreter. The machine halts on it, the host ends the run */
+        case 0xFD:
+            chip8->halted = 1;
+            chip8->PC -= 2;
+            break;
+
+        /* 00FE:
+         * SCHIP: Switch to the 64x32 low resolution mode */
+        case 0xFE:
+            chip8_set_hires(chip8, 0);
+            break;
+
+        /* 00FF:
+         * SCHIP: Switch to the 128x64 high resolution mode */
+        case 0xFF:
+            chip8_set_hires(chip8, 1);
+            break;
         }
         break;
 
@@ -146,7 +344,8 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
     case 0x2:
         if (chip8->SP >= STACK_SIZE)
         {
-            printf("Stack overflow detected. Terminating program.\n");
+            fprintf(stderr, "Stack overflow detected. Terminating program.\n");
+            trace_fault(chip8, opcode);
             exit(EXIT_FAILURE);
         }
 
@@ -161,7 +360,7 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
      * otherwise do nothing */
     case 0x3:
         if (chip8->V[x] == nn)
-            chip8->PC += 2;
+            chip8_skip(chip8);
         break;
 
     /* 4XNN:
@@ -170,16 +369,43 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
      * otherwise do nothing */
     case 0x4:
         if (chip8->V[x] != nn)
-            chip8->PC += 2;
+            chip8_skip(chip8);
         break;
 
-    /* 5XY0:
-     * Skip the following instruction
-     * if the value of register VX equal to the value of register VY (PC += 2),
-     * otherwise do nothing */
     case 0x5:
-        if (chip8->V[x] == chip8->V[y])
-            chip8->PC += 2;
+        switch (n)
+        {
+        /* 5XY2:
+         * XO-CHIP: Store registers VX to VY inclusive in memory starting at address I,
+         * in reverse order if X > Y. I is unchanged */
+        case 0x2: {
+            uint8_t count = (x > y ? x - y : y - x) + 1;
+            int8_t step = x > y ? -1 : 1;
+            for (uint8_t i = 0; i < count; i++)
+                chip8->memory[chip8_address(chip8, chip8->I + i)] = chip8->V[x + i * step];
+        }
+        break;
+
+        /* 5XY3:
+         * XO-CHIP: Fill registers VX to VY inclusive from memory starting at address I,
+         * in reverse order if X > Y. I is unchanged */
+        case 0x3: {
+            uint8_t count = (x > y ? x - y : y - x) + 1;
+            int8_t step = x > y ? -1 : 1;
+            for (uint8_t i = 0; i < count; i++)
+                chip8->V[x + i * step] = chip8->memory[chip8_address(chip8, chip8->I + i)];
+        }
+        break;
+
+        /* 5XY0:
+         * Skip the following instruction
+         * if the value of register VX equal to the value of register VY (PC += 2),
+         * otherwise do nothing */
+        default:
+            if (chip8->V[x] == chip8->V[y])
+                chip8_skip(chip8);
+            break;
+        }
         break;
 
     /* 6XNN:
@@ -296,7 +522,7 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
      * is not equal to the value of register VY */
     case 0x9:
         if (chip8->V[x] != chip8->V[y])
-            chip8->PC += 2;
+            chip8_skip(chip8);
         break;
 
     /* ANNN:
@@ -319,7 +545,7 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
     /* CXNN:
      * Set VX to a random number with a mask of NN (random number AND NN) */
     case 0xC: {
-        uint8_t r = rand();
+        uint8_t r = chip8_random(chip8);
 
         chip8->V[x] = r & nn;
     }
@@ -328,48 +554,15 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
     /* DXYN:
      * Draw a sprite at position (VX, VY) with N bytes of sprite data
      * starting at the address storedin I.
+     * SCHIP: DXY0 draws a 16x16 sprite from 32 bytes, two per row.
      * Set VF to 1 if any set pixels are changed to unset, and 0 otherwise */
     case 0xD: {
         chip8->draw_flag = 1;
         uint8_t x_pos = chip8->V[x];
         uint8_t y_pos = chip8->V[y];
 
-        chip8->V[0xF] = 0;
-        /* Draw sprite from address in I to N */
-        for (uint8_t row = 0; row < n; row++)
-        {
-            /* Stop drawing if bottom edge is reached */
-            if (y_pos + row >= DISPLAY_HEIGHT)
-                break;
-
-            /* Extract byte at current row */
-            uint8_t sprite_byte = chip8->memory[chip8->I + row];
-
-            /* Iterate over extracted byte */
-            for (uint8_t col = 0; col < 8; col++)
-            {
-                /* Stop drawing if right edge is reached */
-                if (x_pos + col >= DISPLAY_WIDTH)
-                    break;
-
-                /* Extract current bit */
-                uint8_t sprite_pixel = (sprite_byte >> (7 - col)) & 0x1;
-                /* Get current pixel value from display buffer */
-                uint8_t *display_pixel = &chip8->display[((y_pos + row) * DISPLAY_WIDTH) + (x_pos + col)];
-
-                /* Extracted bit from sprite is set */
-                if (sprite_pixel)
-                {
-                    /* Current pixel from display is set */
-                    if (*display_pixel)
-                        /* Collision: set VF to 1 */
-                        chip8->V[0xF] = 1;
-
-                    /* Set display pixel if it's currently 0, or unset it if it's currently 1 */
-                    *display_pixel ^= 1;
-                }
-            }
-        }
+        chip8->V[0xF] = chip8_draw_sprite(chip8, x_pos, y_pos, n);
+        PROBE4(draw, x_pos, y_pos, n, chip8->V[0xF]);
         break;
     }
 
@@ -379,30 +572,53 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
         /* EXA1:
          * Skip the following instruction if the key corresponding to the hex value
          * currently stored in register VX is not pressed  */
-        case 0xA1: {
-            uint8_t key = chip8->V[x];
-
-            if (chip8->keypad[key] != 1)
-                chip8->PC += 2;
-        }
-        break;
+        case 0xA1:
+            if (!chip8_key_down(chip8, chip8->V[x]))
+                chip8_skip(chip8);
+            break;
 
         /* EX9E:
          * Skip the following instruction if the key corresponding to the hex value
          * currently stored in register VX is pressed */
-        case 0x9E: {
-            uint8_t key = chip8->V[x];
-
-            if (chip8->keypad[key] == 1)
-                chip8->PC += 2;
-        }
-        break;
+        case 0x9E:
+            if (chip8_key_down(chip8, chip8->V[x]))
+                chip8_skip(chip8);
+            break;
         }
         break;
 
     case 0xF:
         switch (nn)
         {
+        /* F000 NNNN:
+         * XO-CHIP: Set I to the 16-bit address in the following two bytes */
+        case 0x00:
+            if (x == 0)
+            {
+                chip8->memory_size = MAX_MEMORY;
+                chip8->I = chip8_fetch(chip8, chip8->PC);
+                chip8->PC += 2;
+            }
+            break;
+
+        /* FN01:
+         * XO-CHIP: Select the planes drawn, cleared and scrolled, bit 0 is the first plane */
+        case 0x01:
+            chip8->display.plane_mask = x & ((1 << PLANE_COUNT) - 1);
+            break;
+
+        /* F002:
+         * XO-CHIP: Load the 16-byte audio pattern starting at address I */
+        case 0x02:
+            if (x == 0)
+            {
+                for (uint8_t i = 0; i < AUDIO_PATTERN_SIZE; i++)
+                    chip8->audio_pattern[i] = chip8->memory[chip8_address(chip8, chip8->I + i)];
+                chip8->audio_pattern_loaded = 1;
+                chip8->audio_flag = 1;
+            }
+            break;
+
         /* FX07:
          * Store the current value of the delay timer in register VX */
         case 0x07:
@@ -410,22 +626,15 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
             break;
 
         /* FX0A:
-         * Wait for a keypress and store the result in register VX */
+         * Wait for a key to be pressed and released, and store it in register VX */
         case 0xA: {
-            uint8_t key_released = 0;
-
-            for (uint8_t i = 0; i < KEY_COUNT; i++)
-            {
-                if (chip8->keypad[i] == 2)
-                {
-                    chip8->V[x] = i;
-                    key_released = 1;
-                    break;
-                }
-            }
-
-            if (!key_released)
+            int8_t key = chip8_key_wait(chip8);
+            if (key >= 0)
+                chip8->V[x] = key;
+            else
             {
+                PROFILE_ADD(chip8, fx0a_wait_cycles, 1);
+                PROBE1(key_wait, chip8->PC - 2);
                 chip8->PC -= 2;
             }
         }
@@ -463,19 +672,33 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
         }
         break;
 
+        /* FX30:
+         * SCHIP: Set I to the memory address of the 8x10 sprite
+         * of the hexadecimal digit stored in register VX */
+        case 0x30:
+            chip8->I = BIG_FONTSET_START_ADDRESS + (10 * (chip8->V[x] & 0xF));
+            break;
+
+        /* FX3A:
+         * XO-CHIP: Set the audio pattern pitch to the value of register VX */
+        case 0x3A:
+            chip8->pitch = chip8->V[x];
+            chip8->audio_flag = 1;
+            break;
+
         /* FX33:
          * Store the binary-coded decimal equivalent of the value
          * stored in register VX at addresses I, I+1, and I+2 */
         case 0x33: {
             uint8_t value = chip8->V[x];
 
-            chip8->memory[chip8->I + 2] = value % 10;
+            chip8->memory[chip8_address(chip8, chip8->I + 2)] = value % 10;
             value /= 10;
 
-            chip8->memory[chip8->I + 1] = value % 10;
+            chip8->memory[chip8_address(chip8, chip8->I + 1)] = value % 10;
             value /= 10;
 
-            chip8->memory[chip8->I] = value % 10;
+            chip8->memory[chip8_address(chip8, chip8->I)] = value % 10;
         }
         break;
 
@@ -486,7 +709,7 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
         case 0x55:
             for (size_t i = 0; i <= x; i++)
             {
-                chip8->memory[chip8->I + i] = chip8->V[i];
+                chip8->memory[chip8_address(chip8, chip8->I + i)] = chip8->V[i];
             }
             /* COSMAC-VIP specific */
             chip8->I += x + 1;
@@ -500,12 +723,30 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
 
             for (size_t i = 0; i <= x; i++)
             {
-                chip8->V[i] = chip8->memory[chip8->I + i];
+                chip8->V[i] = chip8->memory[chip8_address(chip8, chip8->I + i)];
             }
             /* TODO(nael): support legacy config/quirks */
             /* COSMAC-VIP specific */
             chip8->I += x + 1;
             break;
+
+        /* FX75:
+         * SCHIP: Store registers V0 to VX inclusive in the RPL user flags, X < 8 */
+        case 0x75:
+            for (size_t i = 0; i <= x && i < RPL_COUNT; i++)
+            {
+                chip8->rpl[i] = chip8->V[i];
+            }
+            break;
+
+        /* FX85:
+         * SCHIP: Fill registers V0 to VX inclusive from the RPL user flags, X < 8 */
+        case 0x85:
+            for (size_t i = 0; i <= x && i < RPL_COUNT; i++)
+            {
+                chip8->V[i] = chip8->rpl[i];
+            }
+            break;
         }
         break;
 
@@ -513,6 +754,8 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
         /* Unknown opcode */
         fprintf(stderr, "Fatal Error: Opcode 0x%04x is unknown or incompatible. Please load a compatible rom.\n",
                 opcode);
+        PROBE2(unknown_opcode, chip8->PC - 2, opcode);
+        trace_fault(chip8, opcode);
         exit(EXIT_FAILURE);
         break;
     }
@@ -521,20 +764,195 @@ void chip8_decode_and_execute(struct chip8 *chip8, uint16_t opcode)
 void chip8_cycle(struct chip8 *chip8)
 {
     /* Fetch opcode */
-    uint16_t opcode = chip8->memory[chip8->PC];
-    opcode <<= 8;
-    opcode |= chip8->memory[chip8->PC + 1];
+    uint16_t opcode = chip8_fetch(chip8, chip8->PC);
+
+    uint16_t pc = chip8->PC;
+    PROFILE_INSTRUCTION(chip8, pc, opcode);
 
     /* Point to next opcode */
     chip8->PC += 2;
 
     chip8_decode_and_execute(chip8, opcode);
 
-    /* Set released keys to idle */
-    chip8_reset_released_keys(chip8);
+    if (chip8->trace)
+        trace_record(chip8->trace, pc, opcode, chip8->I, chip8->V);
 }
 
 void chip8_clear_display(struct chip8 *chip8)
 {
-    memset(chip8->display, 0, (DISPLAY_WIDTH * DISPLAY_HEIGHT) * sizeof(uint8_t));
+    for (uint8_t plane = 0; plane < PLANE_COUNT; plane++)
+    {
+        if (chip8->display.plane_mask & (1 << plane))
+            memset(chip8->display.planes[plane], 0, sizeof(chip8->display.planes[plane]));
+    }
+}
+
+void chip8_set_hires(struct chip8 *chip8, uint8_t hires)
+{
+    chip8->display.hires = hires;
+    memset(chip8->display.planes, 0, sizeof(chip8->display.planes));
+    chip8->draw_flag = 1;
+}
+
+uint8_t chip8_draw_sprite(struct chip8 *chip8, uint8_t x, uint8_t y, uint8_t n)
+{
+    struct chip8_display *display = &chip8->display;
+    uint8_t width = chip8_display_width(display);
+    uint8_t height = chip8_display_height(display);
+    uint8_t rows = n ? n : 16;
+    uint8_t collision = 0;
+
+    /* Sprites starting off screen are clipped entirely */
+    if (x >= width)
+        return 0;
+
+    uint8_t word = x / 64;
+    uint8_t shift = x % 64;
+    uint8_t spill = shift && word + 1 < width / 64; /* Pixels past the word go to the next one, else off screen */
+    uint16_t address = chip8->I;
+
+    for (uint8_t plane = 0; plane < PLANE_COUNT; plane++)
+    {
+        if (!(display->plane_mask & (1 << plane)))
+            continue;
+
+        for (uint8_t row = 0; row < rows; row++)
+        {
+            /* Stop drawing if bottom edge is reached */
+            if (y + row >= height)
+                break;
+            PROFILE_ADD(chip8, dxyn_rows, 1);
+
+            /* Sprite row in the most significant bits, leftmost pixel first */
+            uint64_t sprite;
+            if (n)
+            {
+                sprite = (uint64_t)chip8->memory[chip8_address(chip8, address + row)] << 56;
+            }
+            else
+            {
+                uint16_t data = chip8_fetch(chip8, address + 2 * row);
+                sprite = (uint64_t)data << 48;
+            }
+
+            uint64_t *line = display->planes[plane][y + row];
+            uint64_t bits = sprite >> shift;
+            collision |= (line[word] & bits) != 0;
+            line[word] ^= bits;
+
+            if (spill)
+            {
+                bits = sprite << (64 - shift);
+                collision |= (line[word + 1] & bits) != 0;
+                line[word + 1] ^= bits;
+            }
+        }
+
+        /* The next plane's sprite follows, clipped rows included */
+        address += n ? n : 32;
+    }
+    return collision;
+}
+
+void chip8_scroll_down(struct chip8 *chip8, uint8_t n)
+{
+    uint8_t height = chip8_display_height(&chip8->display);
+    if (n > height)
+        n = height;
+
+    for (uint8_t plane = 0; plane < PLANE_COUNT; plane++)
+    {
+        if (!(chip8->display.plane_mask & (1 << plane)))
+            continue;
+
+        uint64_t(*rows)[DISPLAY_WORDS] = chip8->display.planes[plane];
+        memmove(rows[n], rows[0], (height - n) * sizeof(rows[0]));
+        memset(rows[0], 0, n * sizeof(rows[0]));
+    }
+    chip8->draw_flag = 1;
+}
+
+void chip8_scroll_up(struct chip8 *chip8, uint8_t n)
+{
+    uint8_t height = chip8_display_height(&chip8->display);
+    if (n > height)
+        n = height;
+
+    for (uint8_t plane = 0; plane < PLANE_COUNT; plane++)
+    {
+        if (!(chip8->display.plane_mask & (1 << plane)))
+            continue;
+
+        uint64_t(*rows)[DISPLAY_WORDS] = chip8->display.planes[plane];
+        memmove(rows[0], rows[n], (height - n) * sizeof(rows[0]));
+        memset(rows[height - n], 0, n * sizeof(rows[0]));
+    }
+    chip8->draw_flag = 1;
+}
+
+void chip8_scroll_left(struct chip8 *chip8)
+{
+    uint8_t words = chip8_display_width(&chip8->display) / 64;
+    for (uint8_t plane = 0; plane < PLANE_COUNT; plane++)
+    {
+        if (!(chip8->display.plane_mask & (1 << plane)))
+            continue;
+
+        for (uint8_t y = 0; y < chip8_display_height(&chip8->display); y++)
+        {
+            uint64_t *row = chip8->display.planes[plane][y];
+            for (uint8_t word = 0; word + 1 < words; word++)
+                row[word] = (row[word] << 4) | (row[word + 1] >> 60);
+            row[words - 1] <<= 4;
+        }
+    }
+    chip8->draw_flag = 1;
+}
+
+void chip8_scroll_right(struct chip8 *chip8)
+{
+    uint8_t words = chip8_display_width(&chip8->display) / 64;
+    for (uint8_t plane = 0; plane < PLANE_COUNT; plane++)
+    {
+        if (!(chip8->display.plane_mask & (1 << plane)))
+            continue;
+
+        for (uint8_t y = 0; y < chip8_display_height(&chip8->display); y++)
+        {
+            uint64_t *row = chip8->display.planes[plane][y];
+            for (uint8_t word = words - 1; word > 0; word--)
+                row[word] = (row[word] >> 4) | (row[word - 1] << 60);
+            row[0] >>= 4;
+        }
+    }
+    chip8->draw_flag = 1;
+}
+
+/* Color of a pixel, bit n from plane n */
+static inline uint8_t chip8_pixel(const struct chip8_display *display, uint8_t x, uint8_t y)
+{
+    uint8_t shift = 63 - x % 64;
+    return ((display->planes[0][y][x / 64] >> shift) & 1) | (((display->planes[1][y][x / 64] >> shift) & 1) << 1);
+}
+
+void chip8_display_unpack(const struct chip8_display *display, uint8_t *pixels)
+{
+    if (display->hires)
+    {
+        for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++)
+            for (uint8_t x = 0; x < DISPLAY_WIDTH; x++)
+                pixels[y * DISPLAY_WIDTH + x] = chip8_pixel(display, x, y);
+        return;
+    }
+
+    /* Each low resolution pixel covers 2x2 */
+    for (uint8_t y = 0; y < LORES_HEIGHT; y++)
+    {
+        for (uint8_t x = 0; x < LORES_WIDTH; x++)
+        {
+            uint8_t pixel = chip8_pixel(display, x, y);
+            uint8_t *out = pixels + 2 * y * DISPLAY_WIDTH + 2 * x;
+            out[0] = out[1] = out[DISPLAY_WIDTH] = out[DISPLAY_WIDTH + 1] = pixel;
+        }
+    }
 }
@@ -0,0 +1,491 @@
+#include "control.h"
+#include "opcode.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/* First output buffer size, it grows with the batch */
+#define CONTROL_OUTPUT_SIZE (64 * 1024)
+
+static const char hex_digits[] = "0123456789abcdef";
+
+int8_t control_init(struct control *control, uint16_t clock_speed, uint32_t seed,
+                    const struct chip8_engine *engine, struct debugger *debugger)
+{
+    memset(control, 0, sizeof(*control));
+    control->clock_speed = clock_speed;
+    control->seed = seed;
+    control->engine = engine;
+    debugger_init(&control->own_debugger);
+    control->debugger = debugger ? debugger : &control->own_debugger;
+
+    control->output = malloc(CONTROL_OUTPUT_SIZE);
+    control->capacity = CONTROL_OUTPUT_SIZE;
+    return control->output != NULL;
+}
+
+void control_free(struct control *control)
+{
+    for (uint8_t i = 0; i < CONTROL_SNAPSHOTS; i++)
+        free(control->snapshots[i]);
+    chip8_engine_release(control->engine, &control->chip8);
+    free(control->output);
+    control->output = NULL;
+}
+
+/* Make room for n more output bytes
+ * @return Where to write them, NULL if out of memory */
+static char *control_reserve(struct control *control, size_t n)
+{
+    if (control->capacity - control->used < n)
+    {
+        size_t capacity = control->capacity;
+        while (capacity - control->used < n)
+            capacity *= 2;
+        char *output = realloc(control->output, capacity);
+        if (!output)
+            return NULL;
+        control->output = output;
+        control->capacity = capacity;
+    }
+    return control->output + control->used;
+}
+
+/* Append formatted text to the response */
+static void control_printf(struct control *control, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    char *out = control_reserve(control, length + 1);
+    if (length < 0 || !out)
+        return;
+    va_start(args, format);
+    vsnprintf(out, length + 1, format, args);
+    va_end(args);
+    control->used += length;
+}
+
+/* Append bytes as two hex digits each */
+static void control_hex(struct control *control, const uint8_t *bytes, size_t n)
+{
+    char *out = control_reserve(control, 2 * n);
+    if (!out)
+        return;
+    for (size_t i = 0; i < n; i++)
+    {
+        *out++ = hex_digits[bytes[i] >> 4];
+        *out++ = hex_digits[bytes[i] & 0xF];
+    }
+    control->used += 2 * n;
+}
+
+/* Parse the next space separated number of a command line
+ * @return 0 if there is none or it is out of range */
+static int8_t parse_argument(char **line, uint64_t max, uint64_t *value)
+{
+    char *end;
+    *line += strspn(*line, " ");
+    if (!**line)
+        return 0;
+    *value = strtoull(*line, &end, 0);
+    if (end == *line || (*end && *end != ' ') || *value > max)
+        return 0;
+    *line = end;
+    return 1;
+}
+
+/* Instruction count at the end of a frame, frame f ends after f * clock_speed / 60 instructions like in
+ * headless mode */
+static uint64_t control_frame_end(const struct control *control, uint32_t frame)
+{
+    return (uint64_t)(frame + 1) * control->clock_speed / 60;
+}
+
+/* Run until an instruction count or the end of a frame, whichever comes first
+ * @return Why the run ended */
+static const char *control_run(struct control *control, uint64_t end_cycle, uint32_t end_frame)
+{
+    struct chip8 *chip8 = &control->chip8;
+    struct debugger *debugger = control->debugger;
+    if (debugger->stop != DEBUGGER_RUNNING)
+        debugger_continue(debugger);
+
+    for (;;)
+    {
+        /* Timer ticks due, several with a clock speed under 60 Hz */
+        while (control->frame < end_frame && control->cycle >= control_frame_end(control, control->frame))
+        {
+            chip8_update_timers(chip8);
+            chip8->draw_flag = 0;
+            control->frame++;
+            if (debugger_frame(debugger))
+                return debugger_stop_name(debugger->stop);
+        }
+        if (control->cycle >= end_cycle || control->frame >= end_frame)
+            return "done";
+
+        /* 00FD halts the machine with PC still on it */
+        const char *fatal = chip8->halted ? "exit" : chip8_op_fatal(chip8);
+        if (fatal)
+            return fatal;
+        if (debugger_active(debugger))
+        {
+            if (!debugger_cycle(debugger, chip8, control->engine, NULL))
+                return debugger_stop_name(debugger->stop);
+        }
+        else
+        {
+            control->engine->cycle(chip8);
+        }
+        control->cycle++;
+    }
+}
+
+/* Replace the machine, keeping the state the engine allocated for it, see engine.h */
+static void control_set_machine(struct control *control, const struct chip8 *chip8)
+{
+    struct tier *tier = control->chip8.tier;
+    control->chip8 = *chip8;
+    control->chip8.tier = tier;
+}
+
+/* Load a ROM into a scratch machine first, so a failed load keeps the current one
+ * @return NULL on success, else the error message */
+static const char *control_load_rom(struct control *control, const char *path, uint32_t *size)
+{
+    struct chip8 *chip8 = malloc(sizeof(*chip8));
+    if (!chip8)
+        return "out of memory";
+
+    chip8_init(chip8, START_ADDRESS);
+    const char *error = chip8_read_rom(chip8, path, size);
+    if (!error)
+    {
+        if (control->seed)
+            chip8_seed(chip8, control->seed);
+        control->initial = *chip8;
+        control_set_machine(control, chip8);
+        control->loaded = 1;
+        control->cycle = 0;
+        control->frame = 0;
+    }
+    free(chip8);
+    return error;
+}
+
+/* Hold down the keys of a mask, keys that were down and are not anymore are released */
+static void control_keys(struct control *control, uint16_t mask)
+{
+    uint16_t changed = control->chip8.keys_down ^ mask;
+    for (uint8_t key = 0; key < KEY_COUNT; key++)
+    {
+        if (changed & (1 << key))
+            chip8_key_event(&control->chip8, key, (mask >> key) & 1);
+    }
+}
+
+static void control_registers(struct control *control)
+{
+    const struct chip8 *chip8 = &control->chip8;
+    control_printf(control, "ok pc=%03x i=%03x sp=%u dt=%u st=%u v=", chip8->PC, chip8->I, chip8->SP,
+                   chip8->delay_timer, chip8->sound_timer);
+    control_hex(control, chip8->V, REGISTER_COUNT);
+    control_printf(control, " stack=");
+    for (uint8_t i = 0; i < chip8->SP && i < STACK_SIZE; i++)
+        control_printf(control, "%04x", chip8->stack[i]);
+}
+
+static void control_display(struct control *control)
+{
+    static uint8_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+    const struct chip8_display *display = &control->chip8.display;
+    uint8_t width = chip8_display_width(display);
+    uint8_t height = chip8_display_height(display);
+
+    /* Unpacked low resolution pixels are doubled, take one of each 2x2 block */
+    chip8_display_unpack(display, pixels);
+    uint8_t step = display->hires ? 1 : 2;
+    control_printf(control, "ok %u %u ", width, height);
+    char *out = control_reserve(control, width * height);
+    if (!out)
+        return;
+    for (uint16_t y = 0; y < height; y++)
+    {
+        for (uint16_t x = 0; x < width; x++)
+            *out++ = hex_digits[pixels[y * step * DISPLAY_WIDTH + x * step]];
+    }
+    control->used += width * height;
+}
+
+static void control_snapshot(struct control *control, uint8_t slot)
+{
+    if (!control->snapshots[slot] && !(control->snapshots[slot] = malloc(sizeof(struct control_snapshot))))
+    {
+        control_printf(control, "error out of memory");
+        return;
+    }
+    *control->snapshots[slot] = (struct control_snapshot){control->chip8, control->cycle, control->frame};
+    control_printf(control, "ok");
+}
+
+static void control_restore(struct control *control, uint8_t slot)
+{
+    const struct control_snapshot *snapshot = control->snapshots[slot];
+    if (!snapshot)
+    {
+        control_printf(control, "error empty slot");
+        return;
+    }
+    control_set_machine(control, &snapshot->chip8);
+    control->cycle = snapshot->cycle;
+    control->frame = snapshot->frame;
+    control_printf(control, "ok");
+}
+
+enum control_status control_execute(struct control *control, char *line)
+{
+    enum control_status status = CONTROL_CONTINUE;
+    char *arguments = line + strcspn(line, " ");
+    size_t length = arguments - line;
+    arguments += strspn(arguments, " ");
+    uint64_t a, b;
+
+#define COMMAND(name) (length == sizeof(name) - 1 && !strncmp(line, name, length))
+
+    if (COMMAND("load"))
+    {
+        uint32_t size;
+        const char *error = *arguments ? control_load_rom(control, arguments, &size) : "invalid arguments";
+        if (error)
+            control_printf(control, "error %s", error);
+        else
+            control_printf(control, "ok %u", size);
+    }
+    else if (COMMAND("seed"))
+    {
+        if (parse_argument(&arguments, UINT32_MAX, &a))
+        {
+            control->seed = a;
+            chip8_seed(&control->initial, a);
+            chip8_seed(&control->chip8, a);
+            control_printf(control, "ok");
+        }
+        else
+            control_printf(control, "error invalid arguments");
+    }
+    else if (COMMAND("break") || COMMAND("watch"))
+    {
+        int8_t added = COMMAND("break") ? debugger_parse_breakpoint(control->debugger, arguments)
+                                        : debugger_parse_watchpoint(control->debugger, arguments);
+        if (added)
+            control_printf(control, "ok");
+        else
+            control_printf(control, "error invalid %.*s or table full", (int)length, line);
+    }
+    else if (COMMAND("clear"))
+    {
+        while (control->debugger->breakpoint_count)
+            debugger_remove_breakpoint(control->debugger, control->debugger->breakpoint_count - 1);
+        while (control->debugger->watchpoint_count)
+            debugger_remove_watchpoint(control->debugger, control->debugger->watchpoint_count - 1);
+        control_printf(control, "ok");
+    }
+    else if (COMMAND("quit") || COMMAND("shutdown"))
+    {
+        status = COMMAND("quit") ? CONTROL_QUIT : CONTROL_SHUTDOWN;
+        control_printf(control, "ok");
+    }
+    else if (COMMAND("snapshot") || COMMAND("restore") || COMMAND("memory") || COMMAND("keys") ||
+             COMMAND("reset") || COMMAND("cycles") || COMMAND("frames") || COMMAND("regs") ||
+             COMMAND("display") || COMMAND("hash"))
+    {
+        /* Commands on the machine */
+        if (!control->loaded)
+            control_printf(control, "error no ROM loaded");
+        else if (COMMAND("reset"))
+        {
+            control_set_machine(control, &control->initial);
+            control->cycle = 0;
+            control->frame = 0;
+            control_printf(control, "ok");
+        }
+        else if (COMMAND("keys") && parse_argument(&arguments, UINT16_MAX, &a))
+        {
+            control_keys(control, a);
+            control_printf(control, "ok");
+        }
+        else if (COMMAND("cycles") && parse_argument(&arguments, UINT64_MAX - control->cycle, &a))
+        {
+            const char *reason = control_run(control, control->cycle + a, UINT32_MAX);
+            control_printf(control, "ok %llu %u %s", (unsigned long long)control->cycle, control->frame, reason);
+        }
+        else if (COMMAND("frames") && parse_argument(&arguments, UINT32_MAX - control->frame, &a))
+        {
+            const char *reason = control_run(control, UINT64_MAX, control->frame + a);
+            control_printf(control, "ok %llu %u %s", (unsigned long long)control->cycle, control->frame, reason);
+        }
+        else if (COMMAND("regs"))
+            control_registers(control);
+        else if (COMMAND("memory") && parse_argument(&arguments, MAX_MEMORY - 1, &a) &&
+                 parse_argument(&arguments, MAX_MEMORY - a, &b))
+        {
+            control_printf(control, "ok ");
+            control_hex(control, control->chip8.memory + a, b);
+        }
+        else if (COMMAND("display"))
+            control_display(control);
+        else if (COMMAND("hash"))
+            control_printf(control, "ok %016llx", (unsigned long long)chip8_hash_display(&control->chip8));
+        else if (COMMAND("snapshot") && parse_argument(&arguments, CONTROL_SNAPSHOTS - 1, &a))
+            control_snapshot(control, a);
+        else if (COMMAND("restore") && parse_argument(&arguments, CONTROL_SNAPSHOTS - 1, &a))
+            control_restore(control, a);
+        else
+            control_printf(control, "error invalid arguments");
+    }
+    else
+        control_printf(control, "error unknown command");
+
+#undef COMMAND
+
+    control_printf(control, "\n");
+    return status;
+}
+
+#ifndef _WIN32
+
+/* Send the responses of a batch
+ * @return 0 if the client is gone */
+static int8_t control_flush(struct control *control, int fd)
+{
+    size_t written = 0;
+    while (written < control->used)
+    {
+        ssize_t result = write(fd, control->output + written, control->used - written);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            break;
+        written += result;
+    }
+    int8_t ok = written == control->used;
+    control->used = 0;
+    return ok;
+}
+
+/* Run the commands of one client until it disconnects, quits or shuts the server down */
+static enum control_status control_session(struct control *control, int fd, char *input)
+{
+    size_t used = 0;
+    for (;;)
+    {
+        ssize_t result = read(fd, input + used, CONTROL_INPUT_SIZE - used);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return CONTROL_QUIT;
+        used += result;
+
+        /* Every complete line received so far, then one write for all their responses */
+        enum control_status status = CONTROL_CONTINUE;
+        char *line = input, *newline;
+        while (status == CONTROL_CONTINUE && (newline = memchr(line, '\n', input + used - line)))
+        {
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r')
+                newline[-1] = '\0';
+            status = control_execute(control, line);
+            line = newline + 1;
+        }
+        used -= line - input;
+        memmove(input, line, used);
+
+        if (used == CONTROL_INPUT_SIZE)
+        {
+            control_printf(control, "error line too long\n");
+            used = 0;
+        }
+        if (!control_flush(control, fd) || status != CONTROL_CONTINUE)
+            return status;
+    }
+}
+
+int control_serve(struct control *control, const char *path, const char *rom)
+{
+    uint32_t size;
+    const char *error = rom ? control_load_rom(control, rom, &size) : NULL;
+    if (error)
+    {
+        fprintf(stderr, "Error: %s\n", error);
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, path);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    char *input = malloc(CONTROL_INPUT_SIZE);
+    unlink(path);
+    if (server < 0 || !input || bind(server, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(server, 1) < 0)
+    {
+        fprintf(stderr, "Error: failed to listen on %s: %s\n", path, strerror(errno));
+        if (server >= 0)
+            close(server);
+        free(input);
+        return EXIT_FAILURE;
+    }
+
+    /* A client closing its end mid-response must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Listening on %s\n", path);
+
+    enum control_status status = CONTROL_CONTINUE;
+    while (status != CONTROL_SHUTDOWN)
+    {
+        int client = accept(server, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+            break;
+        }
+        status = control_session(control, client, input);
+        close(client);
+    }
+
+    close(server);
+    unlink(path);
+    free(input);
+    return status == CONTROL_SHUTDOWN ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else
+
+int control_serve(struct control *control, const char *path, const char *rom)
+{
+    (void)control;
+    (void)rom;
+    fprintf(stderr, "Error: the control socket %s needs Unix domain sockets, unavailable on Windows\n", path);
+    return EXIT_FAILURE;
+}
+
+#endif
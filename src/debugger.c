@@ -0,0 +1,343 @@
+#include "debugger.h"
+#include "opcode.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *stop_names[] = {"running", "breakpoint", "watchpoint", "step", "frame"};
+static const char *compare_names[] = {"", "==", "!=", "<", "<=", ">", ">="};
+
+void debugger_init(struct debugger *debugger)
+{
+    memset(debugger, 0, sizeof(*debugger));
+}
+
+/* Rebuild the breakpoint bitmap after a removal, several breakpoints may share an address */
+static void debugger_update_map(struct debugger *debugger)
+{
+    memset(debugger->break_map, 0, sizeof(debugger->break_map));
+    for (uint32_t i = 0; i < debugger->breakpoint_count; i++)
+    {
+        uint16_t address = debugger->breakpoints[i].address;
+        debugger->break_map[address / 8] |= 1 << (address % 8);
+    }
+}
+
+int8_t debugger_add_breakpoint(struct debugger *debugger, uint16_t address, enum debugger_compare compare,
+                               uint8_t reg, uint8_t value)
+{
+    if (debugger->breakpoint_count == DEBUGGER_MAX_BREAKPOINTS)
+        return 0;
+
+    debugger->breakpoints[debugger->breakpoint_count++] = (struct debugger_breakpoint){
+        .address = address,
+        .reg = reg & 0xF,
+        .compare = compare,
+        .value = value,
+    };
+    debugger->break_map[address / 8] |= 1 << (address % 8);
+    return 1;
+}
+
+void debugger_remove_breakpoint(struct debugger *debugger, uint32_t index)
+{
+    if (index >= debugger->breakpoint_count)
+        return;
+
+    memmove(&debugger->breakpoints[index], &debugger->breakpoints[index + 1],
+            (debugger->breakpoint_count - index - 1) * sizeof(*debugger->breakpoints));
+    debugger->breakpoint_count--;
+    debugger_update_map(debugger);
+}
+
+int8_t debugger_add_watchpoint(struct debugger *debugger, uint16_t start, uint16_t end, uint8_t access)
+{
+    if (debugger->watchpoint_count == DEBUGGER_MAX_WATCHPOINTS || end < start || !access)
+        return 0;
+
+    debugger->watchpoints[debugger->watchpoint_count++] = (struct debugger_watchpoint){start, end, access};
+    return 1;
+}
+
+void debugger_remove_watchpoint(struct debugger *debugger, uint32_t index)
+{
+    if (index >= debugger->watchpoint_count)
+        return;
+
+    memmove(&debugger->watchpoints[index], &debugger->watchpoints[index + 1],
+            (debugger->watchpoint_count - index - 1) * sizeof(*debugger->watchpoints));
+    debugger->watchpoint_count--;
+}
+
+/* Parse a 16-bit number, hex with 0x or decimal
+ * @return Address after the number, NULL if there is none */
+static const char *parse_number(const char *text, uint16_t *number)
+{
+    char *end;
+    unsigned long value = strtoul(text, &end, 0);
+    if (end == text || value > 0xFFFF)
+        return NULL;
+    *number = value;
+    return end;
+}
+
+int8_t debugger_parse_breakpoint(struct debugger *debugger, const char *text)
+{
+    uint16_t address;
+    text = parse_number(text, &address);
+    if (!text)
+        return 0;
+    if (!*text)
+        return debugger_add_breakpoint(debugger, address, DEBUGGER_ALWAYS, 0, 0);
+
+    /* ":vX" followed by an operator and a value */
+    if (text[0] != ':' || (text[1] != 'v' && text[1] != 'V'))
+        return 0;
+    char *end;
+    unsigned long reg = strtoul(text + 2, &end, 16);
+    if (end != text + 3 || reg >= REGISTER_COUNT)
+        return 0;
+    text = end;
+
+    /* Longest operators first, "<=" before "<" */
+    static const enum debugger_compare order[] = {
+        DEBUGGER_EQUAL, DEBUGGER_NOT_EQUAL, DEBUGGER_LESS_EQUAL,
+        DEBUGGER_GREATER_EQUAL, DEBUGGER_LESS, DEBUGGER_GREATER,
+    };
+    for (uint8_t i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+    {
+        const char *name = compare_names[order[i]];
+        size_t length = strlen(name);
+        if (strncmp(text, name, length))
+            continue;
+
+        uint16_t value;
+        text = parse_number(text + length, &value);
+        if (!text || *text || value > 0xFF)
+            return 0;
+        return debugger_add_breakpoint(debugger, address, order[i], reg, value);
+    }
+    return 0;
+}
+
+int8_t debugger_parse_watchpoint(struct debugger *debugger, const char *text)
+{
+    uint16_t start, end;
+    text = parse_number(text, &start);
+    if (!text)
+        return 0;
+
+    end = start;
+    if (*text == '-')
+    {
+        text = parse_number(text + 1, &end);
+        if (!text)
+            return 0;
+    }
+
+    uint8_t access = DEBUGGER_READ | DEBUGGER_WRITE;
+    if (*text == ':')
+    {
+        text++;
+        if (!strcmp(text, "r"))
+            access = DEBUGGER_READ;
+        else if (!strcmp(text, "w"))
+            access = DEBUGGER_WRITE;
+        else if (strcmp(text, "rw"))
+            return 0;
+    }
+    else if (*text)
+    {
+        return 0;
+    }
+    return debugger_add_watchpoint(debugger, start, end, access);
+}
+
+void debugger_continue(struct debugger *debugger)
+{
+    debugger->resume = debugger->stop == DEBUGGER_BREAKPOINT || debugger->stop == DEBUGGER_WATCHPOINT;
+    debugger->stop = DEBUGGER_RUNNING;
+}
+
+void debugger_step(struct debugger *debugger, uint32_t n)
+{
+    debugger_continue(debugger);
+    debugger->steps = n;
+}
+
+void debugger_run_frames(struct debugger *debugger, uint32_t n)
+{
+    debugger_continue(debugger);
+    debugger->frames = n;
+}
+
+static uint8_t debugger_compare(enum debugger_compare compare, uint8_t a, uint8_t b)
+{
+    switch (compare)
+    {
+    case DEBUGGER_EQUAL:
+        return a == b;
+    case DEBUGGER_NOT_EQUAL:
+        return a != b;
+    case DEBUGGER_LESS:
+        return a < b;
+    case DEBUGGER_LESS_EQUAL:
+        return a <= b;
+    case DEBUGGER_GREATER:
+        return a > b;
+    case DEBUGGER_GREATER_EQUAL:
+        return a >= b;
+    default:
+        return 1;
+    }
+}
+
+/* Bytes an instruction is about to read or write through I
+ * @return Number of bytes from I, 0 if it does not access memory */
+static uint8_t debugger_access(const struct chip8 *chip8, uint16_t opcode, uint8_t *access)
+{
+    uint8_t x = (opcode >> 8) & 0xF;
+    uint8_t y = (opcode >> 4) & 0xF;
+    uint8_t n = opcode & 0xF;
+    uint8_t registers = (x > y ? x - y : y - x) + 1;
+    uint8_t planes = (chip8->display.plane_mask & 1) + ((chip8->display.plane_mask >> 1) & 1);
+
+    *access = DEBUGGER_READ;
+    switch (chip8_op_classify(opcode))
+    {
+    case OP_DXYN:
+        return n * planes;
+    case OP_DXY0:
+        return 32 * planes;
+    case OP_FX65:
+        return x + 1;
+    case OP_5XY3:
+        return registers;
+    case OP_F002:
+        return AUDIO_PATTERN_SIZE;
+    case OP_FX33:
+        *access = DEBUGGER_WRITE;
+        return 3;
+    case OP_FX55:
+        *access = DEBUGGER_WRITE;
+        return x + 1;
+    case OP_5XY2:
+        *access = DEBUGGER_WRITE;
+        return registers;
+    default:
+        return 0;
+    }
+}
+
+/* @return 1 if the next instruction hits a breakpoint or a watchpoint */
+static uint8_t debugger_check(struct debugger *debugger, const struct chip8 *chip8)
+{
+    uint16_t pc = chip8->PC;
+    if (debugger->break_map[pc / 8] & (1 << (pc % 8)))
+    {
+        for (uint32_t i = 0; i < debugger->breakpoint_count; i++)
+        {
+            const struct debugger_breakpoint *breakpoint = &debugger->breakpoints[i];
+            if (breakpoint->address == pc &&
+                debugger_compare(breakpoint->compare, chip8->V[breakpoint->reg], breakpoint->value))
+            {
+                debugger->stop = DEBUGGER_BREAKPOINT;
+                debugger->hit = i;
+                return 1;
+            }
+        }
+    }
+
+    if (!debugger->watchpoint_count)
+        return 0;
+
+    uint8_t access;
+    uint8_t length = debugger_access(chip8, chip8_fetch(chip8, pc), &access);
+    for (uint8_t i = 0; i < length; i++)
+    {
+        uint16_t address = chip8_address(chip8, chip8->I + i);
+        for (uint32_t w = 0; w < debugger->watchpoint_count; w++)
+        {
+            const struct debugger_watchpoint *watchpoint = &debugger->watchpoints[w];
+            if ((watchpoint->access & access) && address >= watchpoint->start && address <= watchpoint->end)
+            {
+                debugger->stop = DEBUGGER_WATCHPOINT;
+                debugger->hit = w;
+                debugger->hit_address = address;
+                debugger->hit_access = access;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+uint8_t debugger_cycle(struct debugger *debugger, struct chip8 *chip8, const struct chip8_engine *engine,
+                       struct callgraph *profiler)
+{
+    if (debugger->stop != DEBUGGER_RUNNING)
+        return 0;
+
+    if (!debugger->resume && debugger_check(debugger, chip8))
+    {
+        debugger->steps = 0;
+        debugger->frames = 0;
+        return 0;
+    }
+    debugger->resume = 0;
+
+    if (profiler)
+        callgraph_cycle(profiler, chip8);
+    else
+        engine->cycle(chip8);
+
+    if (debugger->steps && !--debugger->steps)
+    {
+        debugger->stop = DEBUGGER_STEP;
+        debugger->frames = 0;
+    }
+    return 1;
+}
+
+uint8_t debugger_frame(struct debugger *debugger)
+{
+    if (debugger->frames && !--debugger->frames)
+    {
+        debugger->stop = DEBUGGER_FRAME;
+        debugger->steps = 0;
+    }
+    return debugger->stop != DEBUGGER_RUNNING;
+}
+
+const char *debugger_stop_name(enum debugger_stop stop)
+{
+    return stop_names[stop];
+}
+
+void debugger_print(const struct debugger *debugger, const struct chip8 *chip8, const struct symbols *symbols,
+                    FILE *out)
+{
+    char name[SYMBOL_NAME_LENGTH + 16];
+    symbols_format(symbols, chip8->PC, name, sizeof(name));
+
+    fprintf(out, "Stopped (%s", stop_names[debugger->stop]);
+    if (debugger->stop == DEBUGGER_BREAKPOINT)
+    {
+        const struct debugger_breakpoint *breakpoint = &debugger->breakpoints[debugger->hit];
+        fprintf(out, " %u", debugger->hit);
+        if (breakpoint->compare != DEBUGGER_ALWAYS)
+            fprintf(out, ", V%X%s%u", breakpoint->reg, compare_names[breakpoint->compare], breakpoint->value);
+    }
+    else if (debugger->stop == DEBUGGER_WATCHPOINT)
+    {
+        fprintf(out, " %u, %s 0x%03x", debugger->hit, debugger->hit_access == DEBUGGER_WRITE ? "write" : "read",
+                debugger->hit_address);
+    }
+
+    uint16_t opcode = chip8_fetch(chip8, chip8->PC);
+    fprintf(out, ") at %s: %04X %s\n", name, opcode, chip8_op_name(chip8_op_classify(opcode)));
+    fprintf(out, "  PC 0x%03x  I 0x%03x  SP %u  DT %u  ST %u\n ", chip8->PC, chip8->I, chip8->SP, chip8->delay_timer,
+            chip8->sound_timer);
+    for (uint8_t i = 0; i < REGISTER_COUNT; i++)
+        fprintf(out, " V%X %02x", i, chip8->V[i]);
+    fprintf(out, "\n");
+}
@@ -0,0 +1,366 @@
+#include "engine.h"
+#include "tier.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void (*opcode_handler)(struct chip8 *chip8);
+
+static void op_0(struct chip8 *chip8);
+static void op_1(struct chip8 *chip8);
+static void op_2(struct chip8 *chip8);
+static void op_3(struct chip8 *chip8);
+static void op_4(struct chip8 *chip8);
+static void op_5(struct chip8 *chip8);
+static void op_6(struct chip8 *chip8);
+static void op_7(struct chip8 *chip8);
+static void op_8(struct chip8 *chip8);
+static void op_9(struct chip8 *chip8);
+static void op_A(struct chip8 *chip8);
+static void op_B(struct chip8 *chip8);
+static void op_C(struct chip8 *chip8);
+static void op_D(struct chip8 *chip8);
+static void op_E(struct chip8 *chip8);
+static void op_F(struct chip8 *chip8);
+
+/* Main table, indexed with opcode group id (first nibble) */
+static const opcode_handler main_table[16] = {op_0, op_1, op_2, op_3, op_4, op_5, op_6, op_7,
+                                              op_8, op_9, op_A, op_B, op_C, op_D, op_E, op_F};
+
+#define OP_X(chip8) (((chip8)->opcode >> 8) & 0xF)
+#define OP_Y(chip8) (((chip8)->opcode >> 4) & 0xF)
+#define OP_N(chip8) ((chip8)->opcode & 0xF)
+#define OP_NN(chip8) ((chip8)->opcode & 0xFF)
+#define OP_NNN(chip8) ((chip8)->opcode & 0xFFF)
+
+static void op_0(struct chip8 *chip8)
+{
+    if (OP_X(chip8) == 0 && OP_Y(chip8) == 0xC)
+    {
+        chip8_scroll_down(chip8, OP_N(chip8));
+        return;
+    }
+    if (OP_X(chip8) == 0 && OP_Y(chip8) == 0xD)
+    {
+        chip8_scroll_up(chip8, OP_N(chip8));
+        return;
+    }
+
+    switch (OP_NN(chip8))
+    {
+    case 0xE0:
+        chip8_clear_display(chip8);
+        break;
+    case 0xEE:
+        chip8->SP--;
+        chip8->PC = chip8->stack[chip8->SP];
+        break;
+    case 0xFB:
+        chip8_scroll_right(chip8);
+        break;
+    case 0xFC:
+        chip8_scroll_left(chip8);
+        break;
+    case 0xFD:
+        chip8->halted = 1;
+        chip8->PC -= 2;
+        break;
+    case 0xFE:
+        chip8_set_hires(chip8, 0);
+        break;
+    case 0xFF:
+        chip8_set_hires(chip8, 1);
+        break;
+    }
+}
+
+static void op_1(struct chip8 *chip8)
+{
+    chip8->PC = OP_NNN(chip8);
+}
+
+static void op_2(struct chip8 *chip8)
+{
+    if (chip8->SP >= STACK_SIZE)
+    {
+        fprintf(stderr, "Stack overflow detected. Terminating program.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    chip8->stack[chip8->SP] = chip8->PC;
+    chip8->SP++;
+    chip8->PC = OP_NNN(chip8);
+}
+
+static void op_3(struct chip8 *chip8)
+{
+    if (chip8->V[OP_X(chip8)] == OP_NN(chip8))
+        chip8_skip(chip8);
+}
+
+static void op_4(struct chip8 *chip8)
+{
+    if (chip8->V[OP_X(chip8)] != OP_NN(chip8))
+        chip8_skip(chip8);
+}
+
+static void op_5(struct chip8 *chip8)
+{
+    uint8_t x = OP_X(chip8);
+    uint8_t y = OP_Y(chip8);
+    uint8_t count = (x > y ? x - y : y - x) + 1;
+    int8_t step = x > y ? -1 : 1;
+
+    switch (OP_N(chip8))
+    {
+    case 0x2:
+        for (uint8_t i = 0; i < count; i++)
+            chip8->memory[chip8_address(chip8, chip8->I + i)] = chip8->V[x + i * step];
+        break;
+    case 0x3:
+        for (uint8_t i = 0; i < count; i++)
+            chip8->V[x + i * step] = chip8->memory[chip8_address(chip8, chip8->I + i)];
+        break;
+    default:
+        if (chip8->V[x] == chip8->V[y])
+            chip8_skip(chip8);
+        break;
+    }
+}
+
+static void op_6(struct chip8 *chip8)
+{
+    chip8->V[OP_X(chip8)] = OP_NN(chip8);
+}
+
+static void op_7(struct chip8 *chip8)
+{
+    chip8->V[OP_X(chip8)] += OP_NN(chip8);
+}
+
+static void op_8(struct chip8 *chip8)
+{
+    uint8_t x = OP_X(chip8);
+    uint8_t y = OP_Y(chip8);
+
+    switch (OP_N(chip8))
+    {
+    case 0x0:
+        chip8->V[x] = chip8->V[y];
+        break;
+    case 0x1:
+        chip8->V[x] |= chip8->V[y];
+        chip8->V[0xF] = 0;
+        break;
+    case 0x2:
+        chip8->V[x] &= chip8->V[y];
+        chip8->V[0xF] = 0;
+        break;
+    case 0x3:
+        chip8->V[x] ^= chip8->V[y];
+        chip8->V[0xF] = 0;
+        break;
+    case 0x4: {
+        uint16_t sum = chip8->V[x] + chip8->V[y];
+        chip8->V[x] = sum;
+        chip8->V[0xF] = (sum >= 0xFF) ? 1 : 0;
+    }
+    break;
+    case 0x5: {
+        uint8_t temp = chip8->V[x];
+        chip8->V[x] -= chip8->V[y];
+        chip8->V[0xF] = (temp >= chip8->V[y]) ? 1 : 0;
+    }
+    break;
+    case 0x6: {
+        chip8->V[x] = chip8->V[y];
+        uint8_t temp = chip8->V[x];
+        chip8->V[x] >>= 1;
+        chip8->V[0xF] = temp & 0x1;
+    }
+    break;
+    case 0x7:
+        chip8->V[x] = chip8->V[y] - chip8->V[x];
+        chip8->V[0xF] = (chip8->V[y] >= chip8->V[x]) ? 1 : 0;
+        break;
+    case 0xE: {
+        chip8->V[x] = chip8->V[y];
+        uint8_t temp = chip8->V[x];
+        chip8->V[x] <<= 1;
+        chip8->V[0xF] = temp >> 7;
+    }
+    break;
+    }
+}
+
+static void op_9(struct chip8 *chip8)
+{
+    if (chip8->V[OP_X(chip8)] != chip8->V[OP_Y(chip8)])
+        chip8_skip(chip8);
+}
+
+static void op_A(struct chip8 *chip8)
+{
+    chip8->I = OP_NNN(chip8);
+}
+
+static void op_B(struct chip8 *chip8)
+{
+    chip8->PC = OP_NNN(chip8) + chip8->V[0];
+}
+
+static void op_C(struct chip8 *chip8)
+{
+    uint8_t r = chip8_random(chip8);
+    chip8->V[OP_X(chip8)] = r & OP_NN(chip8);
+}
+
+static void op_D(struct chip8 *chip8)
+{
+    chip8->draw_flag = 1;
+    chip8->V[0xF] = chip8_draw_sprite(chip8, chip8->V[OP_X(chip8)], chip8->V[OP_Y(chip8)], OP_N(chip8));
+}
+
+static void op_E(struct chip8 *chip8)
+{
+    uint8_t down = chip8_key_down(chip8, chip8->V[OP_X(chip8)]);
+
+    if (OP_NN(chip8) == 0xA1)
+    {
+        if (!down)
+            chip8_skip(chip8);
+    }
+    else if (OP_NN(chip8) == 0x9E)
+    {
+        if (down)
+            chip8_skip(chip8);
+    }
+}
+
+static void op_F(struct chip8 *chip8)
+{
+    uint8_t x = OP_X(chip8);
+
+    switch (OP_NN(chip8))
+    {
+    case 0x00:
+        if (x == 0)
+        {
+            chip8->memory_size = MAX_MEMORY;
+            chip8->I = chip8_fetch(chip8, chip8->PC);
+            chip8->PC += 2;
+        }
+        break;
+    case 0x01:
+        chip8->display.plane_mask = x & ((1 << PLANE_COUNT) - 1);
+        break;
+    case 0x02:
+        if (x == 0)
+        {
+            for (uint8_t i = 0; i < AUDIO_PATTERN_SIZE; i++)
+                chip8->audio_pattern[i] = chip8->memory[chip8_address(chip8, chip8->I + i)];
+            chip8->audio_pattern_loaded = 1;
+            chip8->audio_flag = 1;
+        }
+        break;
+    case 0x07:
+        chip8->V[x] = chip8->delay_timer;
+        break;
+    case 0x0A: {
+        int8_t key = chip8_key_wait(chip8);
+        if (key >= 0)
+            chip8->V[x] = key;
+        else
+            chip8->PC -= 2;
+    }
+    break;
+    case 0x15:
+        chip8->delay_timer = chip8->V[x];
+        break;
+    case 0x18:
+        chip8->sound_timer = chip8->V[x];
+        break;
+    case 0x1E:
+        chip8->I += chip8->V[x];
+        chip8->V[0xF] = chip8->I + chip8->V[x] > 0xFFF ? 1 : 0;
+        break;
+    case 0x29:
+        chip8->I = FONTSET_START_ADDRESS + (5 * chip8->V[x]);
+        break;
+    case 0x30:
+        chip8->I = BIG_FONTSET_START_ADDRESS + (10 * (chip8->V[x] & 0xF));
+        break;
+    case 0x3A:
+        chip8->pitch = chip8->V[x];
+        chip8->audio_flag = 1;
+        break;
+    case 0x33: {
+        uint8_t value = chip8->V[x];
+        chip8->memory[chip8_address(chip8, chip8->I + 2)] = value % 10;
+        value /= 10;
+        chip8->memory[chip8_address(chip8, chip8->I + 1)] = value % 10;
+        value /= 10;
+        chip8->memory[chip8_address(chip8, chip8->I)] = value % 10;
+    }
+    break;
+    case 0x55:
+        for (size_t i = 0; i <= x; i++)
+            chip8->memory[chip8_address(chip8, chip8->I + i)] = chip8->V[i];
+        chip8->I += x + 1;
+        break;
+    case 0x65:
+        for (size_t i = 0; i <= x; i++)
+            chip8->V[i] = chip8->memory[chip8_address(chip8, chip8->I + i)];
+        chip8->I += x + 1;
+        break;
+    case 0x75:
+        for (size_t i = 0; i <= x && i < RPL_COUNT; i++)
+            chip8->rpl[i] = chip8->V[i];
+        break;
+    case 0x85:
+        for (size_t i = 0; i <= x && i < RPL_COUNT; i++)
+            chip8->V[i] = chip8->rpl[i];
+        break;
+    }
+}
+
+static void chip8_table_cycle(struct chip8 *chip8)
+{
+    /* Fetch opcode */
+    chip8->opcode = chip8_fetch(chip8, chip8->PC);
+
+    /* Point to next opcode */
+    chip8->PC += 2;
+
+    /* Decode and execute - index with opcode group id (first nibble) */
+    main_table[(chip8->opcode >> 12) & 0xF](chip8);
+}
+
+static const struct chip8_engine engines[] = {
+    {"switch", "chip8_cycle: nested switch in chip8_decode_and_execute (reference)", chip8_cycle, NULL},
+    {"table", "function pointer table indexed by the opcode group", chip8_table_cycle, NULL},
+    {"tiered", "switch until a block gets hot, then predecoded handlers, see tier.h", tier_cycle, tier_release},
+};
+
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+const struct chip8_engine *chip8_engine_get(uint32_t index)
+{
+    return index < ENGINE_COUNT ? &engines[index] : NULL;
+}
+
+const struct chip8_engine *chip8_engine_find(const char *name)
+{
+    for (uint32_t i = 0; i < ENGINE_COUNT; i++)
+    {
+        if (!strcmp(engines[i].name, name))
+            return &engines[i];
+    }
+    return NULL;
+}
+
+void chip8_engine_release(const struct chip8_engine *engine, struct chip8 *chip8)
+{
+    if (engine->release)
+        engine->release(chip8);
+}
@@ -0,0 +1,513 @@
+#include "filters.h"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FILTERS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/* AVX2 kernels are built with a target attribute and only run after a CPU check */
+#if defined(FILTERS_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILTERS_AVX2 1
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+/* Brightness of the CRT scanline gap and aperture grille column, out of 255 */
+#define CRT_SCANLINE_LEVEL 96
+#define CRT_GRILLE_LEVEL 192
+
+/* Kernels of one instruction set. Rows point at pixel 0 of a padded row */
+struct filter_kernels
+{
+    void (*scale2x_row)(const uint8_t *above, const uint8_t *row, const uint8_t *below, uint8_t *out);
+    void (*scale3x_row)(const uint8_t *above, const uint8_t *row, const uint8_t *below, uint8_t *out);
+    void (*phosphor)(uint8_t *intensity, const uint8_t *display, uint32_t count);
+    void (*expand_palette)(const uint8_t *src, uint32_t *out, uint32_t count, const uint32_t *palette);
+    void (*expand_intensity)(const uint8_t *src, uint32_t *out, uint32_t count, uint8_t level, uint32_t foreground,
+                             uint32_t background);
+};
+
+/*
+ * Scalar kernels, the reference for the vector ones
+ */
+
+/* Scale2x: out holds two rows of 2 * DISPLAY_WIDTH pixels */
+static void scale2x_row_scalar(const uint8_t *above, const uint8_t *row, const uint8_t *below, uint8_t *out)
+{
+    for (uint16_t x = 0; x < DISPLAY_WIDTH; x++)
+    {
+        uint8_t B = above[x], D = row[x - 1], E = row[x], F = row[x + 1], H = below[x];
+        uint8_t *top = out + 2 * x, *bottom = top + 2 * DISPLAY_WIDTH;
+
+        top[0] = B == D && B != F && D != H ? D : E;
+        top[1] = B == F && B != D && F != H ? F : E;
+        bottom[0] = D == H && D != B && H != F ? D : E;
+        bottom[1] = H == F && D != H && B != F ? F : E;
+    }
+}
+
+/* Scale3x: out holds three rows of 3 * DISPLAY_WIDTH pixels */
+static void scale3x_row_scalar(const uint8_t *above, const uint8_t *row, const uint8_t *below, uint8_t *out)
+{
+    for (uint16_t x = 0; x < DISPLAY_WIDTH; x++)
+    {
+        uint8_t A = above[x - 1], B = above[x], C = above[x + 1];
+        uint8_t D = row[x - 1], E = row[x], F = row[x + 1];
+        uint8_t G = below[x - 1], H = below[x], I = below[x + 1];
+        uint8_t *r0 = out + 3 * x, *r1 = r0 + 3 * DISPLAY_WIDTH, *r2 = r1 + 3 * DISPLAY_WIDTH;
+
+        uint8_t up_left = B == D && B != F && D != H;
+        uint8_t up_right = B == F && B != D && F != H;
+        uint8_t down_left = D == H && D != B && H != F;
+        uint8_t down_right = H == F && D != H && B != F;
+
+        r0[0] = up_left ? D : E;
+        r0[1] = (up_left && E != C) || (up_right && E != A) ? B : E;
+        r0[2] = up_right ? F : E;
+        r1[0] = (up_left && E != G) || (down_left && E != A) ? D : E;
+        r1[1] = E;
+        r1[2] = (up_right && E != I) || (down_right && E != C) ? F : E;
+        r2[0] = down_left ? D : E;
+        r2[1] = (down_left && E != I) || (down_right && E != G) ? H : E;
+        r2[2] = down_right ? F : E;
+    }
+}
+
+/* Lit pixels go to full brightness, the others lose a quarter of theirs plus one per frame */
+static void phosphor_scalar(uint8_t *intensity, const uint8_t *display, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t decay = (intensity[i] >> 2) + 1;
+        intensity[i] = display[i] ? 255 : intensity[i] > decay ? intensity[i] - decay : 0;
+    }
+}
+
+static void expand_palette_scalar(const uint8_t *src, uint32_t *out, uint32_t count, const uint32_t *palette)
+{
+    for (uint32_t i = 0; i < count; i++)
+        out[i] = palette[src[i] & (FILTER_COLORS - 1)];
+}
+
+/* Blend a channel between background and foreground, i out of 255 */
+static inline uint32_t blend_channel(uint32_t foreground, uint32_t background, uint32_t i, uint8_t shift)
+{
+    return ((((foreground >> shift) & 0xFF) * i + ((background >> shift) & 0xFF) * (255 - i) + 255) >> 8) << shift;
+}
+
+static void expand_intensity_scalar(const uint8_t *src, uint32_t *out, uint32_t count, uint8_t level,
+                                    uint32_t foreground, uint32_t background)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t value = (src[i] * level + 255) >> 8;
+        out[i] = 0xFF000000 | blend_channel(foreground, background, value, 16) |
+                 blend_channel(foreground, background, value, 8) | blend_channel(foreground, background, value, 0);
+    }
+}
+
+static const struct filter_kernels scalar_kernels = {scale2x_row_scalar, scale3x_row_scalar, phosphor_scalar,
+                                                     expand_palette_scalar, expand_intensity_scalar};
+
+/*
+ * SSE2 kernels, 16 pixels at a time. Pixels are compared as 0x00/0xFF masks
+ */
+#ifdef FILTERS_SSE2
+
+#define SELECT_SSE2(mask, a, b) _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b))
+/* a && !b && !c */
+#define ONLY_SSE2(a, b, c) _mm_andnot_si128(b, _mm_andnot_si128(c, a))
+#define NOT_EQUAL_SSE2(a, b) _mm_xor_si128(_mm_cmpeq_epi8(a, b), _mm_set1_epi8(-1))
+
+static void scale2x_row_sse2(const uint8_t *above, const uint8_t *row, const uint8_t *below, uint8_t *out)
+{
+    for (uint16_t x = 0; x < DISPLAY_WIDTH; x += 16)
+    {
+        __m128i B = _mm_loadu_si128((const __m128i *)(above + x));
+        __m128i D = _mm_loadu_si128((const __m128i *)(row + x - 1));
+        __m128i E = _mm_loadu_si128((const __m128i *)(row + x));
+        __m128i F = _mm_loadu_si128((const __m128i *)(row + x + 1));
+        __m128i H = _mm_loadu_si128((const __m128i *)(below + x));
+
+        __m128i BD = _mm_cmpeq_epi8(B, D), BF = _mm_cmpeq_epi8(B, F);
+        __m128i DH = _mm_cmpeq_epi8(D, H), HF = _mm_cmpeq_epi8(H, F);
+
+        __m128i E0 = SELECT_SSE2(ONLY_SSE2(BD, BF, DH), D, E);
+        __m128i E1 = SELECT_SSE2(ONLY_SSE2(BF, BD, HF), F, E);
+        __m128i E2 = SELECT_SSE2(ONLY_SSE2(DH, BD, HF), D, E);
+        __m128i E3 = SELECT_SSE2(ONLY_SSE2(HF, DH, BF), F, E);
+
+        uint8_t *top = out + 2 * x, *bottom = top + 2 * DISPLAY_WIDTH;
+        _mm_storeu_si128((__m128i *)top, _mm_unpacklo_epi8(E0, E1));
+        _mm_storeu_si128((__m128i *)(top + 16), _mm_unpackhi_epi8(E0, E1));
+        _mm_storeu_si128((__m128i *)bottom, _mm_unpacklo_epi8(E2, E3));
+        _mm_storeu_si128((__m128i *)(bottom + 16), _mm_unpackhi_epi8(E2, E3));
+    }
+}
+
+static void scale3x_row_sse2(const uint8_t *above, const uint8_t *row, const uint8_t *below, uint8_t *out)
+{
+    for (uint16_t x = 0; x < DISPLAY_WIDTH; x += 16)
+    {
+        __m128i A = _mm_loadu_si128((const __m128i *)(above + x - 1));
+        __m128i B = _mm_loadu_si128((const __m128i *)(above + x));
+        __m128i C = _mm_loadu_si128((const __m128i *)(above + x + 1));
+        __m128i D = _mm_loadu_si128((const __m128i *)(row + x - 1));
+        __m128i E = _mm_loadu_si128((const __m128i *)(row + x));
+        __m128i F = _mm_loadu_si128((const __m128i *)(row + x + 1));
+        __m128i G = _mm_loadu_si128((const __m128i *)(below + x - 1));
+        __m128i H = _mm_loadu_si128((const __m128i *)(below + x));
+        __m128i I = _mm_loadu_si128((const __m128i *)(below + x + 1));
+
+        __m128i BD = _mm_cmpeq_epi8(B, D), BF = _mm_cmpeq_epi8(B, F);
+        __m128i DH = _mm_cmpeq_epi8(D, H), HF = _mm_cmpeq_epi8(H, F);
+        __m128i up_left = ONLY_SSE2(BD, BF, DH), up_right = ONLY_SSE2(BF, BD, HF);
+        __m128i down_left = ONLY_SSE2(DH, BD, HF), down_right = ONLY_SSE2(HF, DH, BF);
+        __m128i EA = NOT_EQUAL_SSE2(E, A), EC = NOT_EQUAL_SSE2(E, C);
+        __m128i EG = NOT_EQUAL_SSE2(E, G), EI = NOT_EQUAL_SSE2(E, I);
+
+        /* Row-major 3x3 block per pixel */
+        uint8_t planes[9][16];
+        _mm_storeu_si128((__m128i *)planes[0], SELECT_SSE2(up_left, D, E));
+        _mm_storeu_si128((__m128i *)planes[1],
+                         SELECT_SSE2(_mm_or_si128(_mm_and_si128(up_left, EC), _mm_and_si128(up_right, EA)), B, E));
+        _mm_storeu_si128((__m128i *)planes[2], SELECT_SSE2(up_right, F, E));
+        _mm_storeu_si128((__m128i *)planes[3],
+                         SELECT_SSE2(_mm_or_si128(_mm_and_si128(up_left, EG), _mm_and_si128(down_left, EA)), D, E));
+        _mm_storeu_si128((__m128i *)planes[4], E);
+        _mm_storeu_si128((__m128i *)planes[5],
+                         SELECT_SSE2(_mm_or_si128(_mm_and_si128(up_right, EI), _mm_and_si128(down_right, EC)), F, E));
+        _mm_storeu_si128((__m128i *)planes[6], SELECT_SSE2(down_left, D, E));
+        _mm_storeu_si128((__m128i *)planes[7],
+                         SELECT_SSE2(_mm_or_si128(_mm_and_si128(down_left, EI), _mm_and_si128(down_right, EG)), H, E));
+        _mm_storeu_si128((__m128i *)planes[8], SELECT_SSE2(down_right, F, E));
+
+        /* SSE2 has no byte shuffle, interleave the planes with plain stores */
+        for (uint8_t r = 0; r < 3; r++)
+        {
+            uint8_t *dst = out + r * 3 * DISPLAY_WIDTH + 3 * x;
+            for (uint8_t i = 0; i < 16; i++, dst += 3)
+            {
+                dst[0] = planes[3 * r][i];
+                dst[1] = planes[3 * r + 1][i];
+                dst[2] = planes[3 * r + 2][i];
+            }
+        }
+    }
+}
+
+static void phosphor_sse2(uint8_t *intensity, const uint8_t *display, uint32_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i value = _mm_loadu_si128((const __m128i *)(intensity + i));
+        __m128i lit = NOT_EQUAL_SSE2(_mm_loadu_si128((const __m128i *)(display + i)), zero);
+
+        /* No byte shifts in SSE2: shift 16-bit lanes and drop the bits that crossed over */
+        __m128i decay = _mm_add_epi8(_mm_and_si128(_mm_srli_epi16(value, 2), _mm_set1_epi8(0x3F)), _mm_set1_epi8(1));
+        value = _mm_max_epu8(_mm_subs_epu8(value, decay), lit);
+        _mm_storeu_si128((__m128i *)(intensity + i), value);
+    }
+    phosphor_scalar(intensity + i, display + i, count - i);
+}
+
+/* Pick one of two colors per pixel lane: a where the mask is clear, b where it is set */
+#define BLEND_SSE2(mask, a, b) _mm_xor_si128(a, _mm_and_si128(mask, _mm_xor_si128(a, b)))
+
+static void expand_palette_sse2(const uint8_t *src, uint32_t *out, uint32_t count, const uint32_t *palette)
+{
+    const __m128i c0 = _mm_set1_epi32(palette[0]), c1 = _mm_set1_epi32(palette[1]);
+    const __m128i c2 = _mm_set1_epi32(palette[2]), c3 = _mm_set1_epi32(palette[3]);
+    const __m128i bit0 = _mm_set1_epi8(1), bit1 = _mm_set1_epi8(2);
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i plane0 = _mm_cmpeq_epi8(_mm_and_si128(pixels, bit0), bit0);
+        __m128i plane1 = _mm_cmpeq_epi8(_mm_and_si128(pixels, bit1), bit1);
+
+        /* Widen each byte mask to a pixel mask */
+        __m128i lo0 = _mm_unpacklo_epi8(plane0, plane0), hi0 = _mm_unpackhi_epi8(plane0, plane0);
+        __m128i lo1 = _mm_unpacklo_epi8(plane1, plane1), hi1 = _mm_unpackhi_epi8(plane1, plane1);
+        __m128i masks0[4] = {_mm_unpacklo_epi16(lo0, lo0), _mm_unpackhi_epi16(lo0, lo0),
+                             _mm_unpacklo_epi16(hi0, hi0), _mm_unpackhi_epi16(hi0, hi0)};
+        __m128i masks1[4] = {_mm_unpacklo_epi16(lo1, lo1), _mm_unpackhi_epi16(lo1, lo1),
+                             _mm_unpacklo_epi16(hi1, hi1), _mm_unpackhi_epi16(hi1, hi1)};
+        for (uint8_t j = 0; j < 4; j++)
+        {
+            __m128i without = BLEND_SSE2(masks0[j], c0, c1), with = BLEND_SSE2(masks0[j], c2, c3);
+            _mm_storeu_si128((__m128i *)(out + i + 4 * j), BLEND_SSE2(masks1[j], without, with));
+        }
+    }
+    expand_palette_scalar(src + i, out + i, count - i, palette);
+}
+
+/* Blend 4 pixels of 32-bit intensity lanes. Products stay below 2^16, so 16-bit multiplies do */
+static inline __m128i blend_sse2(__m128i value, __m128i fg_b, __m128i fg_g, __m128i fg_r, __m128i bg_b, __m128i bg_g,
+                                 __m128i bg_r)
+{
+    const __m128i round = _mm_set1_epi32(255);
+    __m128i inverse = _mm_sub_epi32(round, value);
+
+    __m128i b = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi16(fg_b, value), _mm_mullo_epi16(bg_b, inverse)), round);
+    __m128i g = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi16(fg_g, value), _mm_mullo_epi16(bg_g, inverse)), round);
+    __m128i r = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi16(fg_r, value), _mm_mullo_epi16(bg_r, inverse)), round);
+
+    return _mm_or_si128(_mm_or_si128(_mm_set1_epi32((int)0xFF000000), _mm_srli_epi32(b, 8)),
+                        _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(g, 8), 8), _mm_slli_epi32(_mm_srli_epi32(r, 8), 16)));
+}
+
+static void expand_intensity_sse2(const uint8_t *src, uint32_t *out, uint32_t count, uint8_t level,
+                                  uint32_t foreground, uint32_t background)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i scale = _mm_set1_epi32(level), round = _mm_set1_epi32(255);
+    const __m128i fg_b = _mm_set1_epi32(foreground & 0xFF), fg_g = _mm_set1_epi32((foreground >> 8) & 0xFF);
+    const __m128i fg_r = _mm_set1_epi32((foreground >> 16) & 0xFF), bg_b = _mm_set1_epi32(background & 0xFF);
+    const __m128i bg_g = _mm_set1_epi32((background >> 8) & 0xFF), bg_r = _mm_set1_epi32((background >> 16) & 0xFF);
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero), hi = _mm_unpackhi_epi8(bytes, zero);
+        __m128i values[4] = {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero), _mm_unpacklo_epi16(hi, zero),
+                             _mm_unpackhi_epi16(hi, zero)};
+        for (uint8_t j = 0; j < 4; j++)
+        {
+            __m128i value = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(values[j], scale), round), 8);
+            _mm_storeu_si128((__m128i *)(out + i + 4 * j), blend_sse2(value, fg_b, fg_g, fg_r, bg_b, bg_g, bg_r));
+        }
+    }
+    expand_intensity_scalar(src + i, out + i, count - i, level, foreground, background);
+}
+
+static const struct filter_kernels sse2_kernels = {scale2x_row_sse2, scale3x_row_sse2, phosphor_sse2,
+                                                   expand_palette_sse2, expand_intensity_sse2};
+#endif /* FILTERS_SSE2 */
+
+/*
+ * AVX2 kernels for the pixel expansion, which writes most of the bytes. 8 pixels at a time; the byte-level
+ * kernels are too narrow (64 pixels per row) to gain from wider vectors and stay on SSE2
+ */
+#ifdef FILTERS_AVX2
+
+/* The palette fits in one register, a lane permute looks up 8 pixels */
+AVX2_TARGET static void expand_palette_avx2(const uint8_t *src, uint32_t *out, uint32_t count, const uint32_t *palette)
+{
+    const __m256i colors = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)palette));
+    const __m256i index_mask = _mm256_set1_epi32(FILTER_COLORS - 1);
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+        pixels = _mm256_and_si256(pixels, index_mask);
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permutevar8x32_epi32(colors, pixels));
+    }
+    expand_palette_scalar(src + i, out + i, count - i, palette);
+}
+
+AVX2_TARGET static void expand_intensity_avx2(const uint8_t *src, uint32_t *out, uint32_t count, uint8_t level,
+                                              uint32_t foreground, uint32_t background)
+{
+    const __m256i scale = _mm256_set1_epi32(level), round = _mm256_set1_epi32(255);
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i fg_b = _mm256_set1_epi32(foreground & 0xFF), fg_g = _mm256_set1_epi32((foreground >> 8) & 0xFF);
+    const __m256i fg_r = _mm256_set1_epi32((foreground >> 16) & 0xFF), bg_b = _mm256_set1_epi32(background & 0xFF);
+    const __m256i bg_g = _mm256_set1_epi32((background >> 8) & 0xFF);
+    const __m256i bg_r = _mm256_set1_epi32((background >> 16) & 0xFF);
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i value = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+        value = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi16(value, scale), round), 8);
+        __m256i inverse = _mm256_sub_epi32(round, value);
+
+        __m256i b = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi16(fg_b, value), _mm256_mullo_epi16(bg_b, inverse)), round);
+        __m256i g = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi16(fg_g, value), _mm256_mullo_epi16(bg_g, inverse)), round);
+        __m256i r = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi16(fg_r, value), _mm256_mullo_epi16(bg_r, inverse)), round);
+
+        __m256i pixels = _mm256_or_si256(_mm256_or_si256(alpha, _mm256_srli_epi32(b, 8)),
+                                         _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(g, 8), 8),
+                                                         _mm256_slli_epi32(_mm256_srli_epi32(r, 8), 16)));
+        _mm256_storeu_si256((__m256i *)(out + i), pixels);
+    }
+    expand_intensity_scalar(src + i, out + i, count - i, level, foreground, background);
+}
+
+static const struct filter_kernels avx2_kernels = {scale2x_row_sse2, scale3x_row_sse2, phosphor_sse2,
+                                                   expand_palette_avx2, expand_intensity_avx2};
+#endif /* FILTERS_AVX2 */
+
+static const struct filter_kernels *kernels = &scalar_kernels;
+static enum filter_isa current_isa = FILTER_ISA_SCALAR;
+
+static const char *filter_names[FILTER_COUNT] = {"none", "scale2x", "scale3x", "phosphor", "crt"};
+static const uint8_t filter_scales[FILTER_COUNT] = {1, 2, 3, 1, 3};
+
+int8_t filter_find(const char *name, enum filter *filter)
+{
+    for (uint8_t i = 0; i < FILTER_COUNT; i++)
+    {
+        if (!strcmp(name, filter_names[i]))
+        {
+            *filter = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char *filter_name(enum filter filter)
+{
+    return filter < FILTER_COUNT ? filter_names[filter] : "?";
+}
+
+uint8_t filter_scale(enum filter filter)
+{
+    return filter < FILTER_COUNT ? filter_scales[filter] : 1;
+}
+
+uint8_t filter_animated(enum filter filter)
+{
+    return filter == FILTER_PHOSPHOR || filter == FILTER_CRT;
+}
+
+int8_t filter_select_isa(enum filter_isa isa)
+{
+    if (isa == FILTER_ISA_COUNT)
+    {
+        return filter_select_isa(FILTER_ISA_AVX2) || filter_select_isa(FILTER_ISA_SSE2) ||
+               filter_select_isa(FILTER_ISA_SCALAR);
+    }
+
+    switch (isa)
+    {
+    case FILTER_ISA_SCALAR:
+        kernels = &scalar_kernels;
+        break;
+#ifdef FILTERS_SSE2
+    case FILTER_ISA_SSE2:
+        kernels = &sse2_kernels;
+        break;
+#endif
+#ifdef FILTERS_AVX2
+    case FILTER_ISA_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2"))
+            return 0;
+        kernels = &avx2_kernels;
+        break;
+#endif
+    default:
+        return 0;
+    }
+    current_isa = isa;
+    return 1;
+}
+
+enum filter_isa filter_current_isa(void)
+{
+    return current_isa;
+}
+
+const char *filter_isa_name(enum filter_isa isa)
+{
+    static const char *names[FILTER_ISA_COUNT] = {"scalar", "sse2", "avx2"};
+    return isa < FILTER_ISA_COUNT ? names[isa] : "?";
+}
+
+void filter_init(struct filter_state *state, enum filter filter, const uint32_t *palette)
+{
+    memset(state, 0, sizeof(*state));
+    state->filter = filter;
+    memcpy(state->palette, palette, sizeof(state->palette));
+}
+
+/* Copy the display into the padded buffer, repeating the edge pixels into the border */
+static void filter_pad(struct filter_state *state, const uint8_t *display)
+{
+    for (uint16_t y = 0; y < DISPLAY_HEIGHT; y++)
+    {
+        uint8_t *row = state->padded + (y + 1) * FILTER_STRIDE + FILTER_PAD;
+        memcpy(row, display + y * DISPLAY_WIDTH, DISPLAY_WIDTH);
+        row[-1] = row[0];
+        row[DISPLAY_WIDTH] = row[DISPLAY_WIDTH - 1];
+    }
+    memcpy(state->padded, state->padded + FILTER_STRIDE, FILTER_STRIDE);
+    memcpy(state->padded + (DISPLAY_HEIGHT + 1) * FILTER_STRIDE, state->padded + DISPLAY_HEIGHT * FILTER_STRIDE,
+           FILTER_STRIDE);
+}
+
+/* Scale2x or Scale3x into state->scaled */
+static void filter_upscale(struct filter_state *state, const uint8_t *display, uint8_t scale)
+{
+    filter_pad(state, display);
+    for (uint16_t y = 0; y < DISPLAY_HEIGHT; y++)
+    {
+        const uint8_t *row = state->padded + (y + 1) * FILTER_STRIDE + FILTER_PAD;
+        uint8_t *out = state->scaled + y * scale * scale * DISPLAY_WIDTH;
+        if (scale == 2)
+            kernels->scale2x_row(row - FILTER_STRIDE, row, row + FILTER_STRIDE, out);
+        else
+            kernels->scale3x_row(row - FILTER_STRIDE, row, row + FILTER_STRIDE, out);
+    }
+}
+
+/* Phosphor intensities tripled in both directions, with a dimmer third column and row */
+static void filter_crt(struct filter_state *state, uint32_t *out, uint32_t pitch)
+{
+    const uint16_t width = 3 * DISPLAY_WIDTH;
+    for (uint16_t y = 0; y < DISPLAY_HEIGHT; y++)
+    {
+        const uint8_t *intensity = state->intensity + y * DISPLAY_WIDTH;
+        uint8_t *row = state->scaled + y * width;
+        for (uint16_t x = 0; x < DISPLAY_WIDTH; x++)
+        {
+            row[3 * x] = row[3 * x + 1] = intensity[x];
+            row[3 * x + 2] = (intensity[x] * CRT_GRILLE_LEVEL) >> 8;
+        }
+
+        uint32_t *dst = out + 3 * y * pitch;
+        kernels->expand_intensity(row, dst, width, 255, state->palette[1], state->palette[0]);
+        kernels->expand_intensity(row, dst + pitch, width, 255, state->palette[1], state->palette[0]);
+        kernels->expand_intensity(row, dst + 2 * pitch, width, CRT_SCANLINE_LEVEL, state->palette[1],
+                                  state->palette[0]);
+    }
+}
+
+void filter_apply(struct filter_state *state, const uint8_t *display, uint32_t *out, uint32_t pitch)
+{
+    uint8_t scale = filter_scale(state->filter);
+    uint16_t width = DISPLAY_WIDTH * scale;
+    const uint8_t *pixels = display;
+
+    switch (state->filter)
+    {
+    case FILTER_SCALE2X:
+    case FILTER_SCALE3X:
+        filter_upscale(state, display, scale);
+        pixels = state->scaled;
+        break;
+    case FILTER_PHOSPHOR:
+        kernels->phosphor(state->intensity, display, DISPLAY_WIDTH * DISPLAY_HEIGHT);
+        for (uint16_t y = 0; y < DISPLAY_HEIGHT; y++)
+            kernels->expand_intensity(state->intensity + y * DISPLAY_WIDTH, out + y * pitch, DISPLAY_WIDTH, 255,
+                                      state->palette[1], state->palette[0]);
+        return;
+    case FILTER_CRT:
+        kernels->phosphor(state->intensity, display, DISPLAY_WIDTH * DISPLAY_HEIGHT);
+        filter_crt(state, out, pitch);
+        return;
+    default:
+        break;
+    }
+
+    for (uint16_t y = 0; y < DISPLAY_HEIGHT * scale; y++)
+        kernels->expand_palette(pixels + y * width, out + y * pitch, width, state->palette);
+}
@@ -0,0 +1,99 @@
+#include "input_script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Stable insertion sort by cycle, so events on the same cycle keep their file order.
+ * Scripts are short and usually already sorted */
+static void sort_events(struct input_event *events, uint32_t count)
+{
+    for (uint32_t i = 1; i < count; i++)
+    {
+        struct input_event event = events[i];
+        uint32_t j = i;
+        while (j > 0 && events[j - 1].cycle > event.cycle)
+        {
+            events[j] = events[j - 1];
+            j--;
+        }
+        events[j] = event;
+    }
+}
+
+int8_t input_script_load(struct input_script *script, const char *filename, uint32_t cycles_per_frame)
+{
+    script->events = NULL;
+    script->count = 0;
+
+    FILE *file = fopen(filename, "r");
+    if (!file)
+        return 0;
+
+    uint32_t capacity = 0;
+    uint32_t line_number = 0;
+    char line[128];
+    int8_t ok = 1;
+    while (ok && fgets(line, sizeof(line), file))
+    {
+        line_number++;
+
+        char when[32], action[16];
+        unsigned int key;
+        if (line[0] == '#' || sscanf(line, "%31s", when) != 1)
+            continue;
+
+        if (sscanf(line, "%31s %x %15s", when, &key, action) != 3 || key > 0xF ||
+            (strcmp(action, "down") && strcmp(action, "up")))
+        {
+            fprintf(stderr, "Error: %s:%u: expected \"<cycle> <key> <down|up>\"\n", filename, line_number);
+            ok = 0;
+            break;
+        }
+
+        char *end;
+        uint64_t cycle = strtoull(when, &end, 10);
+        if (*end == 'f')
+            cycle *= cycles_per_frame;
+
+        if (script->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            struct input_event *events = realloc(script->events, capacity * sizeof(*events));
+            if (!events)
+            {
+                ok = 0;
+                break;
+            }
+            script->events = events;
+        }
+
+        script->events[script->count++] = (struct input_event){cycle, key, !strcmp(action, "down")};
+    }
+    fclose(file);
+
+    if (!ok)
+    {
+        input_script_free(script);
+        return 0;
+    }
+
+    sort_events(script->events, script->count);
+    return 1;
+}
+
+void input_script_free(struct input_script *script)
+{
+    free(script->events);
+    script->events = NULL;
+    script->count = 0;
+}
+
+uint32_t input_script_apply(const struct input_script *script, uint32_t cursor, uint64_t cycle, struct chip8 *chip8)
+{
+    while (cursor < script->count && script->events[cursor].cycle <= cycle)
+    {
+        const struct input_event *event = &script->events[cursor++];
+        chip8_key_event(chip8, event->key, event->pressed);
+    }
+    return cursor;
+}
@@ -1,93 +1,960 @@
+#include "callgraph.h"
 #include "chip8.h"
+#include "control.h"
+#include "debugger.h"
+#include "engine.h"
+#include "filters.h"
+#include "input_script.h"
+#include "metrics.h"
+#include "opcode.h"
 #include "platform.h"
+#include "platform_audio.h"
+#include "platform_thread.h"
+#include "probes.h"
+#include "steady.h"
+#include "stream.h"
+#include "symbols.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-int main(int argc, char **argv)
+/* 60 Hz display refresh and timer tick, in microseconds */
+#define REFRESH_TIME (1000000.0 / 60.0)
+
+/* Emulation backlog dropped after a stall instead of being caught up, in microseconds */
+#define MAX_BACKLOG 100000.0
+
+/* Synthetic key taps of the latency measurement mode, in microseconds */
+#define LATENCY_TAP_INTERVAL 500000.0
+#define LATENCY_TAP_LENGTH 100000.0
+
+/* Headless exit status of a run stopped by --steady */
+#define EXIT_STEADY 3
+
+/* Per-tile instruction rate text of the mosaic */
+#define TILE_LABEL_SIZE 32
+
+/* Command line options */
+struct options
 {
-    struct window window;
-    platform_init(&window);
+    uint16_t clock_speed;
+    uint8_t vip_timing;         /* COSMAC VIP instruction costs, the clock speed is then unused */
+    const char *filename;       /* First ROM */
+    char **filenames;           /* Every ROM, a window with several shows them as a mosaic */
+    uint16_t roms;
+    uint16_t instances;         /* Instances of each ROM, with consecutive seeds */
+    const char *callgraph_file; /* Folded stacks output, NULL if the profiler is off */
+    const char *symbols_file;   /* Octo labels for the profiler */
+    const char *trace_file;     /* Instruction trace dump, NULL if tracing is off */
+    uint32_t trace_records;     /* Trace ring buffer capacity */
+    int metrics_fd;             /* JSON metrics output, -1 if none */
+    uint8_t vsync;              /* Pace presenting with the display refresh */
+    int8_t latency_key;         /* Key tapped to measure input latency, -1 if off */
+    enum filter filter;         /* Display filter of the window */
+    uint32_t seed;              /* CXNN seed, 0 for a time based one */
+    struct debugger *debugger;  /* Breakpoints, watchpoints and stop frame, NULL if none were given */
+
+    /* Headless mode */
+    uint8_t headless;                /* Run as fast as possible without a window */
+    uint32_t frames;                 /* 60 Hz frames to run */
+    const char *stream_file;         /* Frame output, "-" for stdout, NULL for none */
+    enum stream_format stream_format;
+    uint8_t changed_only;            /* Only stream frames that differ from the previous one */
+    uint8_t steady;                  /* Stop once the machine repeats a state with no input left */
+    const char *input_file;          /* Input script */
+
+    const char *control_path; /* Unix domain socket of the control server, NULL if off */
+
+    const struct chip8_engine *engine; /* Instruction cycle of headless runs and the control server */
+};
+
+static void print_usage(void)
+{
+    printf("Usage: [options] <clock speed> <path/to/rom> [path/to/rom...]\n"
+           "       --control <socket> [options] <clock speed> [path/to/rom]\n"
+           "Options:\n"
+           "  --callgraph <file>  Profile CHIP8 subroutines, write folded stacks to file (- for stdout) on exit\n"
+           "  --symbols <file>    Labels naming subroutines, \"label 0xADDR\" lines written from an Octo source\n"
+           "                      (default: rom path with .sym)\n"
+           "  --trace <file>      Record executed instructions in a ring buffer, dumped to file on a crash,\n"
+           "                      a fatal opcode or SIGUSR1. Decode it with cilly-trace\n"
+           "  --trace-records <n> Trace ring buffer capacity (default: 65536)\n"
+           "  --metrics-fd <fd>   Write performance metrics as one JSON line per second to a file descriptor\n"
+           "  --vsync             Present frames in sync with the display refresh\n"
+           "  --latency <key>     Tap a keypad key (hex) twice a second and report input to present latency\n"
+           "                      percentiles on exit\n"
+           "  --filter <name>     Display filter: none (default), scale2x, scale3x, phosphor or crt\n"
+           "  --instances <n>     Run n instances of each ROM with consecutive seeds. Several ROMs or instances\n"
+           "                      are shown as a mosaic, click a tile to send it the keyboard\n"
+           "  --seed <n>          CXNN random seed (default: time based)\n"
+           "  --timing <mode>     uniform (default): every instruction takes 1 / clock speed, or vip: COSMAC VIP\n"
+           "                      instruction times, with DXYN waiting for the next frame. The clock speed is\n"
+           "                      then unused\n"
+           "  --break <addr>      Stop before the instruction at addr, or only when a register matches, e.g.\n"
+           "                      0x2a4 or 0x2a4:v3==5 (==, !=, <, <=, >, >=)\n"
+           "  --watch <range>     Stop before an instruction reads or writes memory in the range through I, e.g.\n"
+           "                      0x300, 0x300-0x30f (both) or 0x300-0x30f:w (r, w or rw)\n"
+           "  --stop-frame <n>    Stop at the end of frame n\n"
+           "Headless mode:\n"
+           "  --headless          Run without a window, as fast as possible\n"
+           "  --frames <n>        60 Hz frames to run (default: 600)\n"
+           "  --stream <file>     Write the display of every frame to file (- for stdout)\n"
+           "  --stream-format <f> y4m (default, readable by ffmpeg) or raw (1 bit per pixel, MSB first)\n"
+           "  --changed-only      Only write frames that differ from the previous one, raw frames are then\n"
+           "                      preceded by their 32-bit little endian frame number\n"
+           "  --input <script>    Input script, see include/input_script.h\n"
+           "  --steady            Stop with exit status 3 once the machine state at the end of a frame repeats\n"
+           "                      with no input left: a fixed point or a cycle, e.g. a game over screen\n"
+           "  --engine <name>     Execution engine, also of the control server: switch (default), table or tiered\n"
+           "                      (predecodes the blocks that get hot, for long runs), see include/engine.h\n"
+           "Control server:\n"
+           "  --control <socket>  Run headless, driven by commands on a Unix domain socket, see include/control.h\n"
+           "Press F1 in the window to show the performance overlay. F5 continues, F6 pauses, F10 steps one\n"
+           "instruction and F11 runs to the end of the frame; stops are reported on stdout, or stderr when headless\n");
+}
+
+/* Get the debugger of the command line breakpoints, created on first use
+ * @return NULL if out of memory */
+static struct debugger *options_debugger(struct options *options)
+{
+    if (!options->debugger && (options->debugger = malloc(sizeof(*options->debugger))))
+        debugger_init(options->debugger);
+    return options->debugger;
+}
 
-    if (argc != 3)
+/* @return 0 if the arguments are invalid */
+static int8_t parse_options(int argc, char **argv, struct options *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->trace_records = TRACE_DEFAULT_RECORDS;
+    options->metrics_fd = -1;
+    options->latency_key = -1;
+    options->frames = 600;
+    options->instances = 1;
+    options->stream_format = STREAM_Y4M;
+    options->engine = chip8_engine_get(0);
+
+    int arg = 1;
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); arg++)
     {
-        printf("Usage: <clock speed> <path/to/rom>\n");
-        return EXIT_FAILURE;
+        /* Flags without a value */
+        if (!strcmp(argv[arg], "--vsync"))
+        {
+            options->vsync = 1;
+            continue;
+        }
+        if (!strcmp(argv[arg], "--headless"))
+        {
+            options->headless = 1;
+            continue;
+        }
+        if (!strcmp(argv[arg], "--changed-only"))
+        {
+            options->changed_only = 1;
+            continue;
+        }
+        if (!strcmp(argv[arg], "--steady"))
+        {
+            options->steady = 1;
+            continue;
+        }
+
+        if (arg + 1 >= argc)
+            return 0;
+
+        if (!strcmp(argv[arg], "--callgraph"))
+            options->callgraph_file = argv[++arg];
+        else if (!strcmp(argv[arg], "--symbols"))
+            options->symbols_file = argv[++arg];
+        else if (!strcmp(argv[arg], "--trace"))
+            options->trace_file = argv[++arg];
+        else if (!strcmp(argv[arg], "--trace-records"))
+            options->trace_records = strtoul(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "--metrics-fd"))
+            options->metrics_fd = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "--latency"))
+            options->latency_key = strtoul(argv[++arg], NULL, 16) & 0xF;
+        else if (!strcmp(argv[arg], "--frames"))
+            options->frames = strtoul(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "--stream"))
+            options->stream_file = argv[++arg];
+        else if (!strcmp(argv[arg], "--stream-format"))
+        {
+            if (!stream_parse_format(argv[++arg], &options->stream_format))
+                return 0;
+        }
+        else if (!strcmp(argv[arg], "--filter"))
+        {
+            if (!filter_find(argv[++arg], &options->filter))
+                return 0;
+        }
+        else if (!strcmp(argv[arg], "--instances"))
+            options->instances = strtoul(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "--control"))
+            options->control_path = argv[++arg];
+        else if (!strcmp(argv[arg], "--engine"))
+        {
+            if (!(options->engine = chip8_engine_find(argv[++arg])))
+                return 0;
+        }
+        else if (!strcmp(argv[arg], "--input"))
+            options->input_file = argv[++arg];
+        else if (!strcmp(argv[arg], "--seed"))
+            options->seed = strtoul(argv[++arg], NULL, 0);
+        else if (!strcmp(argv[arg], "--break"))
+        {
+            struct debugger *debugger = options_debugger(options);
+            if (!debugger || !debugger_parse_breakpoint(debugger, argv[++arg]))
+                return 0;
+        }
+        else if (!strcmp(argv[arg], "--watch"))
+        {
+            struct debugger *debugger = options_debugger(options);
+            if (!debugger || !debugger_parse_watchpoint(debugger, argv[++arg]))
+                return 0;
+        }
+        else if (!strcmp(argv[arg], "--stop-frame"))
+        {
+            struct debugger *debugger = options_debugger(options);
+            uint32_t frames = strtoul(argv[++arg], NULL, 10);
+            if (!debugger || !frames)
+                return 0;
+            debugger_run_frames(debugger, frames);
+        }
+        else if (!strcmp(argv[arg], "--timing"))
+        {
+            arg++;
+            if (!strcmp(argv[arg], "vip"))
+                options->vip_timing = 1;
+            else if (strcmp(argv[arg], "uniform"))
+                return 0;
+        }
+        else
+            return 0;
     }
 
-    /* get args */
-    uint16_t clock_speed = atoi(argv[1]);
-    /* convert given clock speed to microseconds */
-    double cycle_time = 1000000.0 / clock_speed;
-    const char *filename = argv[2];
+    /* The control server loads its ROM on command */
+    if (argc - arg < (options->control_path ? 1 : 2))
+        return 0;
 
-    /* TODO: figure out a way to use less timers */
-    /* setup chip8 */
-    struct chip8 chip8;
+    options->clock_speed = atoi(argv[arg]);
+    options->filename = argc - arg > 1 ? argv[arg + 1] : NULL;
+    options->filenames = argv + arg + 1;
+    options->roms = argc - arg - 1;
+
+    /* Headless mode and the control server run a single instance, the server with uniform timing */
+    if ((options->headless || options->control_path) && (options->roms > 1 || options->instances > 1))
+        return 0;
+    if (options->control_path && (options->vip_timing || options->headless))
+        return 0;
+    /* The window runs chip8_cycle */
+    if (options->engine != chip8_engine_get(0) && !options->headless && !options->control_path)
+        return 0;
+    return options->clock_speed > 0 && options->instances > 0 && options->roms * options->instances <= UINT16_MAX;
+}
+
+/* Load the symbols given on the command line, or the .sym file next to the ROM if there is one */
+static void load_symbols(const struct options *options, struct symbols *symbols)
+{
+    if (options->symbols_file)
+    {
+        if (!symbols_load(symbols, options->symbols_file))
+            fprintf(stderr, "Warning: failed to open symbol file %s\n", options->symbols_file);
+        return;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s", options->filename);
+    char *extension = strrchr(path, '.');
+    if (extension && !strchr(extension, '/') && !strchr(extension, '\\'))
+        *extension = '\0';
+    strncat(path, ".sym", sizeof(path) - strlen(path) - 1);
+    symbols_load(symbols, path);
+}
+
+static void write_callgraph(const struct options *options, const struct callgraph *callgraph)
+{
+    struct symbols symbols;
+    load_symbols(options, &symbols);
+
+    FILE *out = strcmp(options->callgraph_file, "-") ? fopen(options->callgraph_file, "w") : stdout;
+    if (out)
+    {
+        callgraph_write_folded(callgraph, &symbols, out);
+        if (out != stdout)
+            fclose(out);
+    }
+    else
+    {
+        fprintf(stderr, "Error: failed to write call graph to %s\n", options->callgraph_file);
+    }
+    symbols_free(&symbols);
+}
+
+/* Run one instruction on the engine, through the debugger while it is active
+ * @return 0 if the debugger stopped the machine */
+static uint8_t headless_cycle(struct chip8 *chip8, const struct chip8_engine *engine, struct debugger *debugger)
+{
+    if (debugger && debugger_active(debugger))
+        return debugger_cycle(debugger, chip8, engine, NULL);
+    engine->cycle(chip8);
+    return 1;
+}
+
+/* Run a ROM without SDL, as fast as possible, for a number of 60 Hz frames. Input comes from a script
+ * and the display can be streamed out frame by frame */
+static int run_headless(const struct options *options)
+{
+    static struct chip8 chip8;
     chip8_init(&chip8, START_ADDRESS);
-    chip8_load_rom(&chip8, filename);
-
-    /* setup cycle timers */
-#ifdef WIN
-    LARGE_INTEGER frequency;
-    LARGE_INTEGER current_time, new_time;
-    QueryPerformanceFrequency(&frequency);
-#else
-    struct timespec current_time, new_time;
-#endif
+    chip8_load_rom(&chip8, options->filename);
+    if (options->seed)
+        chip8_seed(&chip8, options->seed);
+
+    /* With VIP timing, script times are VIP machine cycles */
+    uint32_t cycles_per_frame = options->vip_timing ? VIP_CYCLES_PER_FRAME : (options->clock_speed + 30) / 60;
+    struct input_script script = {NULL, 0};
+    if (options->input_file && !input_script_load(&script, options->input_file, cycles_per_frame ? cycles_per_frame : 1))
+    {
+        fprintf(stderr, "Error: failed to load input script %s\n", options->input_file);
+        return EXIT_FAILURE;
+    }
+
+    struct stream stream;
+    if (options->stream_file &&
+        !stream_open(&stream, options->stream_file, options->stream_format, options->changed_only))
+    {
+        fprintf(stderr, "Error: failed to open %s\n", options->stream_file);
+        input_script_free(&script);
+        return EXIT_FAILURE;
+    }
+
+    /* Frame f ends after f * clock_speed / 60 instructions, so fractional rates add up */
+    struct debugger *debugger = options->debugger;
+    uint64_t cycle = 0;
+    uint32_t cursor = 0;
+    int32_t vip_budget = 0;
+    int8_t ok = 1;
+    uint8_t stopped = 0;
+    const char *fatal = NULL; /* The core would exit on the next instruction, see chip8_op_fatal */
+    static struct steady steady;
+    steady_init(&steady);
+    for (uint32_t frame = 0; frame < options->frames && ok && !stopped; frame++)
+    {
+        uint32_t frame_cursor = cursor;
+        uint64_t frame_end = (uint64_t)(frame + 1) * options->clock_speed / 60;
+        for (; !options->vip_timing && cycle < frame_end && !stopped && !fatal && !chip8.halted; cycle++)
+        {
+            cursor = input_script_apply(&script, cursor, cycle, &chip8);
+            if (!(fatal = chip8_op_fatal(&chip8)))
+                stopped = !headless_cycle(&chip8, options->engine, debugger);
+        }
+
+        /* Same frame bursts as the emulation thread, with the clock in machine cycles */
+        uint64_t frame_start = (uint64_t)frame * VIP_CYCLES_PER_FRAME;
+        uint8_t first = 1;
+        vip_budget += options->vip_timing ? VIP_CYCLES_PER_FRAME : 0;
+        for (; vip_budget > 0 && !stopped && !fatal && !chip8.halted; first = 0)
+        {
+            uint16_t opcode = chip8_fetch(&chip8, chip8.PC);
+            if (chip8_op_waits_vblank(opcode) && !first)
+            {
+                vip_budget = 0;
+                break;
+            }
+            cursor = input_script_apply(&script, cursor, frame_start + VIP_CYCLES_PER_FRAME - vip_budget,
+                                        &chip8);
+            if ((fatal = chip8_op_fatal(&chip8)))
+                break;
+            stopped = !headless_cycle(&chip8, options->engine, debugger);
+            if (!stopped)
+                vip_budget -= chip8_op_vip_cycles(opcode);
+        }
 
-    double dt = 0;
-    double dt_refresh = 0;
-    double dt_timer = 0;
+        /* A breakpoint or watchpoint ends the run in the middle of the frame */
+        if (stopped)
+            break;
+        chip8_update_timers(&chip8);
+        chip8.draw_flag = 0;
+        if (debugger)
+            stopped = debugger_frame(debugger);
 
-    get_current_time(&current_time);
+        if (options->stream_file)
+            ok = stream_frame(&stream, &chip8, frame);
+        /* 00FD ends the run after the frame it drew in, and so does an instruction the core would exit on,
+         * so the stream keeps every frame */
+        if (chip8.halted || fatal)
+            break;
 
-    /* TODO: maybe add running to the window struct? */
-    uint8_t running = 1;
-    while (running)
+        /* Only frames after the last input event can repeat for good. The instructions per frame alternate at
+         * clock speeds that are not a multiple of 60, and VIP timing carries the overrun over, so the phase of
+         * the schedule is part of the state */
+        uint64_t phase = options->vip_timing ? (uint32_t)vip_budget : (uint64_t)(frame + 1) * options->clock_speed % 60;
+        if (options->steady && (cursor != frame_cursor || cursor < script.count))
+            steady_reset(&steady);
+        else if (options->steady && steady_frame(&steady, &chip8, phase, frame))
+            break;
+    }
+
+    if (chip8.halted)
+        fprintf(stderr, "Program exited.\n");
+    else if (fatal)
+        fprintf(stderr, "Stopped before 0x%04x at 0x%03x: %s\n", chip8_fetch(&chip8, chip8.PC), chip8.PC, fatal);
+    if (steady.period == 1)
+        fprintf(stderr, "Steady state: fixed point from frame %u\n", steady.first);
+    else if (steady.period)
+        fprintf(stderr, "Steady state: cycle of %u frames from frame %u\n", steady.period, steady.first);
+
+    if (stopped)
     {
-        get_current_time(&new_time);
+        struct symbols symbols;
+        load_symbols(options, &symbols);
+        debugger_print(debugger, &chip8, &symbols, stderr);
+        symbols_free(&symbols);
+    }
 
-#ifdef WIN
-        dt += get_elapsed_time(current_time, new_time, frequency);
-        dt_refresh += get_elapsed_time(current_time, new_time, frequency);
-        dt_timer += get_elapsed_time(current_time, new_time, frequency);
-#else
-        dt += get_elapsed_time(current_time, new_time);
-        dt_refresh += get_elapsed_time(current_time, new_time);
-        dt_timer += get_elapsed_time(current_time, new_time);
+    if (options->stream_file)
+    {
+        ok = stream_close(&stream) && ok;
+        fprintf(stderr, "Wrote %llu frames, %llu bytes\n", (unsigned long long)stream.frames,
+                (unsigned long long)stream.bytes);
+    }
+    input_script_free(&script);
+    chip8_engine_release(options->engine, &chip8);
+
+#ifdef CHIP8_PROFILE
+    profile_report(&chip8, stderr, 20);
 #endif
+    if (!ok || fatal)
+        return EXIT_FAILURE;
+    return steady.period ? EXIT_STEADY : EXIT_SUCCESS;
+}
+
+/* State shared between the emulation thread and the SDL thread. Only the frames, the keys and the atomics
+ * are touched by both */
+struct emulator
+{
+    struct chip8 chip8;
+    struct callgraph *profiler;
+    struct audio audio;
+    double cycle_time;   /* Microseconds per instruction */
+    uint8_t vip_timing;  /* Charge COSMAC VIP machine cycles per instruction instead of cycle_time */
+    int32_t vip_budget;  /* VIP machine cycles left in the current frame, negative when it overran */
+    struct triple_buffer frames;
+    struct key_queue keys;
+    SDL_atomic_t running;
+    SDL_atomic_t cycles; /* Instructions executed, for the metrics */
+    SDL_atomic_t halted; /* The program ran 00FD, the machine stays on its last frame */
+
+    /* Debugger of the first instance, NULL on the others. armed is the same debugger while debugger_active,
+     * else NULL: emulator_step only leaves chip8_cycle for debugger_cycle while there is something to check */
+    struct debugger *debugger;
+    struct debugger *armed;
+    const struct symbols *symbols; /* Labels of the stop reports */
+    SDL_atomic_t debug_command;    /* enum debug_command from the window */
+    uint8_t stop_reported;
+
+    /* frame counters for the frame_start/frame_end probes */
+    uint64_t frame;
+    uint64_t frame_cycles;
+};
+
+/* Hand the display to the SDL thread if it changed since the last publish */
+static void emulator_publish(struct emulator *emulator)
+{
+    struct chip8 *chip8 = &emulator->chip8;
+    if (!chip8->draw_flag)
+        return;
+
+    struct frame *back = triple_buffer_back(&emulator->frames);
+    back->display = chip8->display;
+    back->inputs = SDL_AtomicGet(&emulator->keys.head);
+    triple_buffer_publish(&emulator->frames);
+    chip8->draw_flag = 0;
+}
+
+/* Run one instruction at an emulated time
+ * @return 0 if the debugger stopped the machine before it, or if it halted on 00FD */
+static uint8_t emulator_step(struct emulator *emulator, double time)
+{
+    struct chip8 *chip8 = &emulator->chip8;
+
+    key_queue_drain(&emulator->keys, chip8, time);
+    if (emulator->armed)
+    {
+        if (!debugger_cycle(emulator->armed, chip8, chip8_engine_get(0), emulator->profiler))
+            return 0;
+    }
+    else if (emulator->profiler)
+        callgraph_cycle(emulator->profiler, chip8);
+    else
+        chip8_cycle(chip8);
+
+    /* Freeze on the last frame with the buzzer off, the SDL thread reports it */
+    if (chip8->halted)
+    {
+        emulator_publish(emulator);
+        platform_audio_buzzer(&emulator->audio, 0, time);
+        SDL_AtomicSet(&emulator->halted, 1);
+        return 0;
+    }
+    if (chip8->audio_flag)
+    {
+        platform_audio_pattern(&emulator->audio, chip8->audio_pattern, chip8->audio_pattern_loaded, chip8->pitch,
+                               time);
+        chip8->audio_flag = 0;
+    }
+    platform_audio_buzzer(&emulator->audio, chip8->sound_timer > 0, time);
+    emulator->frame_cycles++;
+    return 1;
+}
+
+/* End a 60 Hz frame at an emulated time: tick the timers and publish the display if it changed
+ * @return 0 if the debugger stopped the machine at the end of the frame */
+static uint8_t emulator_tick(struct emulator *emulator, double time)
+{
+    struct chip8 *chip8 = &emulator->chip8;
+
+    /* Decrement by 1, 60 times per second */
+    chip8_update_timers(chip8);
+    platform_audio_buzzer(&emulator->audio, chip8->sound_timer > 0, time);
+    if (chip8->trace)
+        trace_poll(chip8->trace);
+
+    emulator_publish(emulator);
+    SDL_AtomicAdd(&emulator->cycles, emulator->frame_cycles);
+
+    PROBE2(frame_end, emulator->frame, emulator->frame_cycles);
+    emulator->frame++;
+    emulator->frame_cycles = 0;
+    PROBE1(frame_start, emulator->frame);
+    return !emulator->armed || !debugger_frame(emulator->armed);
+}
+
+/* Run one frame of COSMAC VIP time starting at an emulated time, in a burst: instructions until the frame's
+ * machine cycles are spent, or until DXYN waits for the next frame. The draw, and any overrun, are charged
+ * to the next frame
+ * @return 0 if the debugger stopped the machine, the rest of the frame runs when it resumes, or if it halted */
+static uint8_t emulator_vip_frame(struct emulator *emulator, double start)
+{
+    struct chip8 *chip8 = &emulator->chip8;
+
+    /* A frame the debugger interrupted still has budget left */
+    if (emulator->vip_budget <= 0)
+        emulator->vip_budget += VIP_CYCLES_PER_FRAME;
+    while (emulator->vip_budget > 0)
+    {
+        uint16_t opcode = chip8_fetch(chip8, chip8->PC);
+        if (chip8_op_waits_vblank(opcode) && emulator->frame_cycles)
+        {
+            emulator->vip_budget = 0;
+            break;
+        }
+
+        if (!emulator_step(emulator, start + (VIP_CYCLES_PER_FRAME - emulator->vip_budget) * VIP_CYCLE_US))
+            return 0;
+        emulator->vip_budget -= chip8_op_vip_cycles(opcode);
+    }
+    return 1;
+}
+
+/* Apply the last debugger key of the window, arm or disarm the debugger and report a new stop
+ * @return 1 while the machine is stopped */
+static uint8_t emulator_debug(struct emulator *emulator)
+{
+    struct debugger *debugger = emulator->debugger;
 
-        current_time = new_time;
-        while (dt >= cycle_time)
+    switch (SDL_AtomicSet(&emulator->debug_command, DEBUG_NONE))
+    {
+    case DEBUG_CONTINUE:
+        debugger_continue(debugger);
+        break;
+    case DEBUG_PAUSE:
+        if (debugger->stop == DEBUGGER_RUNNING)
+            debugger_step(debugger, 1);
+        break;
+    case DEBUG_STEP:
+        debugger_step(debugger, 1);
+        break;
+    case DEBUG_FRAME:
+        debugger_run_frames(debugger, 1);
+        break;
+    default:
+        break;
+    }
+    emulator->armed = debugger_active(debugger) ? debugger : NULL;
+
+    if (debugger->stop == DEBUGGER_RUNNING)
+    {
+        emulator->stop_reported = 0;
+        return 0;
+    }
+    if (!emulator->stop_reported)
+    {
+        debugger_print(debugger, &emulator->chip8, emulator->symbols, stdout);
+        fflush(stdout);
+        emulator->stop_reported = 1;
+    }
+    return 1;
+}
+
+/* Run the core at the configured clock speed, independently of rendering. Instructions are laid out on an
+ * emulated timeline that follows the clock: key events take effect at the instruction matching their arrival
+ * time, the timers tick every 60 Hz of emulated time, and a frame is published on every tick where the
+ * display changed. With VIP timing the timeline is in VIP machine cycles and runs a frame at a time */
+static int SDLCALL emulation_thread(void *data)
+{
+    struct emulator *emulator = data;
+
+    double next_cycle = platform_now_us(); /* Emulated time of the next instruction */
+    double next_tick = next_cycle + REFRESH_TIME;
+
+    PROBE1(frame_start, emulator->frame);
+
+    while (SDL_AtomicGet(&emulator->running))
+    {
+        /* Nothing runs after 00FD */
+        if (emulator->chip8.halted)
         {
-            chip8_cycle(&chip8);
-            dt -= cycle_time;
+            SDL_Delay(1);
+            continue;
         }
 
-        /* TODO: symbolic constant 60 hz */
-        /* refresh rate 45 Hz */
-        if (dt_refresh >= 1000000.0 / 60.0)
+        double now = platform_now_us();
+
+        /* The emulated timeline waits while the debugger holds the machine */
+        if (emulator->debugger && emulator_debug(emulator))
         {
-            running = platform_process_input(chip8.keypad);
-            dt_refresh -= 1000000.0 / 60.0;
-            if (chip8.draw_flag)
+            next_tick += now - next_cycle;
+            next_cycle = now;
+            SDL_Delay(1);
+            continue;
+        }
+
+        if (now - next_cycle > MAX_BACKLOG)
+        {
+            next_tick += now - next_cycle;
+            next_cycle = now;
+        }
+
+        if (emulator->vip_timing)
+        {
+            /* A frame runs once all of its time has passed, so every key event in it has arrived */
+            while (next_tick <= now)
             {
-                platform_update(&window, chip8.display, DISPLAY_WIDTH, DISPLAY_HEIGHT);
-                chip8.draw_flag = 0;
+                if (!emulator_vip_frame(emulator, next_tick - REFRESH_TIME))
+                    break;
+                uint8_t running = emulator_tick(emulator, next_tick);
+                next_tick += REFRESH_TIME;
+                if (!running)
+                    break;
             }
+            next_cycle = next_tick - REFRESH_TIME;
         }
 
-        /* Decrement by 1, 60 times per second */
-        /* if dt > 1/60th of a second, decrement timers */
-        if (dt_timer >= 1000000.0 / 60.0)
+        while (!emulator->vip_timing && next_cycle <= now)
         {
-            dt_timer -= 1000000.0 / 60.0;
-            if (chip8.delay_timer > 0)
+            if (!emulator_step(emulator, next_cycle))
+                break;
+            next_cycle += emulator->cycle_time;
+
+            if (next_cycle < next_tick)
+                continue;
+            uint8_t running = emulator_tick(emulator, next_cycle);
+            next_tick += REFRESH_TIME;
+            if (!running)
+                break;
+        }
+
+        /* Give the core back when nothing is due for over a millisecond */
+        double next = emulator->vip_timing ? next_tick : next_cycle;
+        if (next - now > 1000.0)
+            SDL_Delay(1);
+    }
+    return 0;
+}
+
+/* Presenting state of one instance, owned by the SDL thread */
+struct tile
+{
+    const struct frame *display;                    /* Last frame acquired */
+    uint8_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT]; /* The frame unpacked for the filters */
+    uint32_t presented_inputs;                      /* Key events counted in the latency metrics */
+    uint32_t frame_cycles;                          /* Instruction count at the previous refresh */
+    uint32_t rate_cycles;                           /* Instruction count at the previous label update */
+    uint8_t halted;                                 /* 00FD reported */
+    char label[TILE_LABEL_SIZE];
+};
+
+int main(int argc, char **argv)
+{
+    struct options options;
+    if (!parse_options(argc, argv, &options))
+    {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    if (options.headless)
+        return run_headless(&options);
+
+    if (options.control_path)
+    {
+        static struct control control;
+        if (!control_init(&control, options.clock_speed, options.seed, options.engine, options.debugger))
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            return EXIT_FAILURE;
+        }
+        int status = control_serve(&control, options.control_path, options.filename);
+        control_free(&control);
+        free(options.debugger);
+        return status;
+    }
+
+    /* Several ROMs or instances share the window as a mosaic, each on its own emulation thread */
+    uint16_t count = options.roms * options.instances;
+    struct emulator *emulators = calloc(count, sizeof(*emulators));
+    struct tile *tiles = calloc(count, sizeof(*tiles));
+    SDL_Thread **threads = calloc(count, sizeof(*threads));
+    struct key_queue **keys = calloc(count, sizeof(*keys));
+    const uint8_t **displays = calloc(count, sizeof(*displays));
+    const char **labels = calloc(count, sizeof(*labels));
+    if (!emulators || !tiles || !threads || !keys || !displays || !labels)
+    {
+        fprintf(stderr, "Error: not enough memory for %u instances\n", count);
+        return EXIT_FAILURE;
+    }
+
+    struct window window;
+    platform_init(&window, options.vsync, options.filter);
+    if (count > 1 && !platform_set_tiles(&window, count))
+    {
+        platform_close(&window);
+        return EXIT_FAILURE;
+    }
+
+    /* setup chip8, a mosaic gives every instance its own seed */
+    uint32_t seed = options.seed ? options.seed : (uint32_t)time(NULL);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        struct emulator *emulator = &emulators[i];
+        chip8_init(&emulator->chip8, START_ADDRESS);
+        chip8_load_rom(&emulator->chip8, options.filenames[i / options.instances]);
+        if (options.seed || count > 1)
+            chip8_seed(&emulator->chip8, seed + i);
+
+        /* convert given clock speed to microseconds */
+        emulator->cycle_time = 1000000.0 / options.clock_speed;
+        emulator->vip_timing = options.vip_timing;
+        triple_buffer_init(&emulator->frames);
+        key_queue_init(&emulator->keys);
+        SDL_AtomicSet(&emulator->running, 1);
+        SDL_AtomicSet(&emulator->cycles, 0);
+        SDL_AtomicSet(&emulator->halted, 0);
+
+        keys[i] = &emulator->keys;
+        tiles[i].display = &emulator->frames.frames[emulator->frames.front];
+        labels[i] = tiles[i].label;
+    }
+    struct chip8 *chip8 = &emulators[0].chip8;
+
+    /* setup guest profiler, on the first instance */
+    struct callgraph callgraph;
+    if (options.callgraph_file)
+    {
+        if (callgraph_init(&callgraph, START_ADDRESS))
+            emulators[0].profiler = &callgraph;
+        else
+            fprintf(stderr, "Warning: not enough memory for the call graph profiler\n");
+    }
+
+    /* setup debugger, on the first instance. It only enters the instruction cycle once something is set */
+    struct debugger *debugger = options.debugger;
+    if (!debugger && (debugger = malloc(sizeof(*debugger))))
+        debugger_init(debugger);
+    struct symbols symbols;
+    load_symbols(&options, &symbols);
+    emulators[0].debugger = debugger;
+    emulators[0].symbols = &symbols;
+    SDL_AtomicSet(&emulators[0].debug_command, DEBUG_NONE);
+
+    /* setup instruction trace, on the first instance */
+    struct trace trace;
+    if (options.trace_file)
+    {
+        if (trace_init(&trace, options.trace_records, options.trace_file))
+        {
+            chip8->trace = &trace;
+            trace_install_handlers(&trace);
+        }
+        else
+        {
+            fprintf(stderr, "Warning: not enough memory for the instruction trace\n");
+        }
+    }
+
+    /* setup performance metrics, they follow the focused tile */
+    struct metrics metrics;
+    metrics_init(&metrics, options.clock_speed, options.metrics_fd);
+    metrics_format(&metrics, window.hud_text, sizeof(window.hud_text));
+
+    /* setup buzzer, the emulator runs muted without it. A mosaic stays muted rather than mixing instances */
+    if (count == 1)
+        platform_audio_open(&emulators[0].audio);
+
+    uint16_t started = 0;
+    for (; started < count; started++)
+    {
+        threads[started] = SDL_CreateThread(emulation_thread, "emulation", &emulators[started]);
+        if (!threads[started])
+        {
+            fprintf(stderr, "Emulation thread could not be created. Error: %s\n", SDL_GetError());
+            break;
+        }
+    }
+
+    /* This thread only handles input and presents the frames the emulation threads publish */
+    double frame_time = platform_now_us();
+    double rate_time = frame_time;
+    double next_present = frame_time + REFRESH_TIME;
+    double next_tap = frame_time + LATENCY_TAP_INTERVAL;
+    uint8_t tap_down = 0;
+
+    int8_t running = started == count;
+    while (running > 0)
+    {
+        /* Without vsync, wait for input until the next refresh; with it, presenting blocks instead */
+        running = platform_process_input(&window, keys, options.vsync ? 0 : next_present);
+        if (window.debug != DEBUG_NONE)
+        {
+            SDL_AtomicSet(&emulators[0].debug_command, window.debug);
+            window.debug = DEBUG_NONE;
+        }
+
+        double now = platform_now_us();
+        if (options.latency_key >= 0 && now >= next_tap)
+        {
+            tap_down = !tap_down;
+            key_queue_push(keys[window.focus], options.latency_key, tap_down, now);
+            next_tap += tap_down ? LATENCY_TAP_LENGTH : LATENCY_TAP_INTERVAL - LATENCY_TAP_LENGTH;
+        }
+
+        /* the overlay changes every second and phosphor fades every frame, so keep presenting for those */
+        uint8_t changed = 0;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            const struct frame *frame = triple_buffer_acquire(&emulators[i].frames);
+            if (frame)
+            {
+                tiles[i].display = frame;
+                chip8_display_unpack(&frame->display, tiles[i].pixels);
+                changed = 1;
+            }
+            displays[i] = tiles[i].pixels;
+        }
+
+        double update_us = 0;
+        if (changed || window.show_hud || options.vsync || filter_animated(options.filter))
+        {
+            double update_start = platform_now_us();
+            platform_update(&window, displays, count > 1 ? labels : NULL);
+            now = platform_now_us();
+            update_us = now - update_start;
+
+            /* Every key event applied before this frame was drawn is on screen now */
+            for (uint16_t i = 0; i < count; i++)
+            {
+                struct tile *tile = &tiles[i];
+                uint32_t pushed = SDL_AtomicGet(&emulators[i].keys.tail);
+                for (; tile->presented_inputs != tile->display->inputs; tile->presented_inputs++)
+                    if (pushed - tile->presented_inputs <= KEY_QUEUE_SIZE)
+                        metrics_input(&metrics, now - key_queue_time(&emulators[i].keys, tile->presented_inputs));
+            }
+        }
+
+        /* An instance that ran 00FD stays on its last frame, the window closes once all of them have */
+        uint16_t halted = 0;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            if (!SDL_AtomicGet(&emulators[i].halted))
+                continue;
+            if (!tiles[i].halted)
+            {
+                if (count > 1)
+                    printf("Tile %u: program exited.\n", i);
+                else
+                    printf("Program exited.\n");
+                fflush(stdout);
+                tiles[i].halted = 1;
+            }
+            halted++;
+        }
+        if (halted == count)
+            running = 0;
+
+        metrics_audio(&metrics, platform_audio_underruns(&emulators[0].audio));
+        uint32_t focus_cycles = 0;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            uint32_t cycles = SDL_AtomicGet(&emulators[i].cycles);
+            if (i == window.focus)
+                focus_cycles = cycles - tiles[i].frame_cycles;
+            tiles[i].frame_cycles = cycles;
+        }
+        if (metrics_frame(&metrics, now - frame_time, update_us, focus_cycles))
+        {
+            metrics_format(&metrics, window.hud_text, sizeof(window.hud_text));
+
+            /* tile labels follow the overlay, once a second */
+            for (uint16_t i = 0; i < count; i++)
             {
-                chip8.delay_timer--;
+                uint32_t cycles = tiles[i].frame_cycles;
+                snprintf(tiles[i].label, sizeof(tiles[i].label), "%u: %.0f IPS", i,
+                         (cycles - tiles[i].rate_cycles) * 1000000.0 / (now - rate_time));
+                tiles[i].rate_cycles = cycles;
             }
+            rate_time = now;
         }
+        frame_time = now;
+
+        next_present += REFRESH_TIME;
+        if (next_present < now)
+            next_present = now + REFRESH_TIME;
     }
+
+    for (uint16_t i = 0; i < started; i++)
+    {
+        SDL_AtomicSet(&emulators[i].running, 0);
+        SDL_WaitThread(threads[i], NULL);
+    }
+    platform_audio_close(&emulators[0].audio);
     platform_close(&window);
-    return EXIT_SUCCESS;
+
+    if (chip8->trace)
+        trace_free(chip8->trace);
+    free(debugger);
+    symbols_free(&symbols);
+
+    if (emulators[0].profiler)
+    {
+        write_callgraph(&options, emulators[0].profiler);
+        callgraph_free(emulators[0].profiler);
+    }
+
+    if (options.latency_key >= 0)
+        metrics_report_latency(&metrics, stderr);
+
+#ifdef CHIP8_PROFILE
+    profile_report(chip8, stderr, 20);
+#endif
+
+    free(emulators);
+    free(tiles);
+    free(threads);
+    free(keys);
+    free(displays);
+    free(labels);
+    return started == count ? EXIT_SUCCESS : EXIT_FAILURE;
 }
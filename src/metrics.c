@@ -0,0 +1,158 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+void metrics_init(struct metrics *metrics, uint32_t clock_speed, int fd)
+{
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->target_ips = clock_speed;
+    metrics->snapshot.target_ips = clock_speed;
+    metrics->fd = fd;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double lhs = *(const double *)a;
+    double rhs = *(const double *)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+double metrics_percentile(const double *samples, uint32_t count, double p)
+{
+    if (!count)
+        return 0;
+
+    double *sorted = malloc(count * sizeof(*sorted));
+    if (!sorted)
+        return 0;
+    memcpy(sorted, samples, count * sizeof(*sorted));
+    qsort(sorted, count, sizeof(*sorted), compare_doubles);
+
+    /* Nearest rank: ceil(p / 100 * count), 1-based */
+    double exact_rank = p / 100.0 * count;
+    uint32_t rank = (uint32_t)exact_rank;
+    if (rank < exact_rank)
+        rank++;
+    if (rank > 0)
+        rank--;
+    if (rank >= count)
+        rank = count - 1;
+
+    double value = sorted[rank];
+    free(sorted);
+    return value;
+}
+
+static void metrics_write_json(const struct metrics *metrics)
+{
+    const struct metrics_snapshot *snapshot = &metrics->snapshot;
+    char line[256];
+
+    int length = snprintf(line, sizeof(line),
+                          "{\"time_s\":%.3f,\"frames\":%llu,\"ips\":%.1f,\"target_ips\":%.1f,\"frame_ms\":%.3f,"
+                          "\"frame_p99_ms\":%.3f,\"update_ms\":%.3f,\"cycle_surplus\":%.2f,\"inputs\":%llu,"
+                          "\"input_p50_ms\":%.3f,\"input_p99_ms\":%.3f,\"audio_underruns\":%u}\n",
+                          metrics->elapsed_us / 1000000.0, (unsigned long long)snapshot->frames, snapshot->ips,
+                          snapshot->target_ips, snapshot->frame_ms, snapshot->frame_p99_ms, snapshot->update_ms,
+                          snapshot->cycle_surplus, (unsigned long long)snapshot->inputs, snapshot->input_p50_ms,
+                          snapshot->input_p99_ms, snapshot->audio_underruns);
+
+    if (length > 0 && length < (int)sizeof(line) && write(metrics->fd, line, length) != length)
+        fprintf(stderr, "Warning: failed to write metrics\n");
+}
+
+int8_t metrics_frame(struct metrics *metrics, double frame_us, double update_us, uint64_t cycles)
+{
+    metrics->frame_us[metrics->frame_index] = frame_us;
+    metrics->frame_index = (metrics->frame_index + 1) % METRICS_WINDOW;
+    if (metrics->frame_count < METRICS_WINDOW)
+        metrics->frame_count++;
+
+    metrics->period_us += frame_us;
+    metrics->period_update_us += update_us;
+    metrics->period_cycles += cycles;
+    metrics->period_frames++;
+    metrics->frames++;
+    metrics->elapsed_us += frame_us;
+
+    if (metrics->period_us < METRICS_PERIOD)
+        return 0;
+
+    struct metrics_snapshot *snapshot = &metrics->snapshot;
+    double expected_cycles = metrics->target_ips * metrics->period_us / 1000000.0;
+
+    snapshot->ips = metrics->period_cycles * 1000000.0 / metrics->period_us;
+    snapshot->frame_ms = metrics->period_us / metrics->period_frames / 1000.0;
+    snapshot->frame_p99_ms = metrics_percentile(metrics->frame_us, metrics->frame_count, 99.0) / 1000.0;
+    snapshot->update_ms = metrics->period_update_us / metrics->period_frames / 1000.0;
+    snapshot->cycle_surplus = (metrics->period_cycles - expected_cycles) / metrics->period_frames;
+    snapshot->frames = metrics->frames;
+    snapshot->inputs = metrics->inputs;
+    snapshot->input_p50_ms = metrics_percentile(metrics->latency_us, metrics->latency_count, 50.0) / 1000.0;
+    snapshot->input_p99_ms = metrics_percentile(metrics->latency_us, metrics->latency_count, 99.0) / 1000.0;
+
+    metrics->period_us = 0;
+    metrics->period_update_us = 0;
+    metrics->period_cycles = 0;
+    metrics->period_frames = 0;
+
+    if (metrics->fd >= 0)
+        metrics_write_json(metrics);
+    return 1;
+}
+
+void metrics_audio(struct metrics *metrics, uint32_t underruns)
+{
+    metrics->snapshot.audio_underruns = underruns;
+}
+
+void metrics_input(struct metrics *metrics, double latency_us)
+{
+    metrics->latency_us[metrics->latency_index] = latency_us;
+    metrics->latency_index = (metrics->latency_index + 1) % METRICS_WINDOW;
+    if (metrics->latency_count < METRICS_WINDOW)
+        metrics->latency_count++;
+    metrics->inputs++;
+}
+
+void metrics_report_latency(const struct metrics *metrics, FILE *out)
+{
+    if (!metrics->latency_count)
+    {
+        fprintf(out, "Input latency: no key event reached the screen\n");
+        return;
+    }
+
+    fprintf(out, "Input to present latency over the last %u of %llu key events:\n", metrics->latency_count,
+            (unsigned long long)metrics->inputs);
+    static const char *labels[] = {"p50", "p90", "p99", "max"};
+    static const double percentiles[] = {50.0, 90.0, 99.0, 100.0};
+    for (uint32_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+        fprintf(out, "  %-4s %7.2f ms\n", labels[i],
+                metrics_percentile(metrics->latency_us, metrics->latency_count, percentiles[i]) / 1000.0);
+}
+
+void metrics_format(const struct metrics *metrics, char *buf, uint32_t size)
+{
+    const struct metrics_snapshot *snapshot = &metrics->snapshot;
+
+    snprintf(buf, size,
+             "IPS %.0f/%.0f\n"
+             "FRAME %.2f MS\n"
+             "P99 %.2f MS\n"
+             "UPDATE %.2f MS\n"
+             "CYCLES %+.1f/FRAME\n"
+             "INPUT %.1f/%.1f MS\n"
+             "AUDIO XRUN %u",
+             snapshot->ips, snapshot->target_ips, snapshot->frame_ms, snapshot->frame_p99_ms, snapshot->update_ms,
+             snapshot->cycle_surplus, snapshot->input_p50_ms, snapshot->input_p99_ms,
+             snapshot->audio_underruns);
+}
@@ -0,0 +1,165 @@
+#include "opcode.h"
+#include "chip8.h"
+
+static const char *op_names[OP_COUNT] = {
+    "0NNN", "00E0", "00EE", "00CN", "00DN", "00FB", "00FC", "00FD", "00FE", "00FF", "1NNN", "2NNN",
+    "3XNN", "4XNN", "5XY0", "5XY2", "5XY3", "6XNN", "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4",
+    "8XY5", "8XY6", "8XY7", "8XYE", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "DXY0", "EX9E", "EXA1",
+    "F000", "FN01", "F002", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX30", "FX33", "FX3A",
+    "FX55", "FX65", "FX75", "FX85", "????",
+};
+
+enum chip8_op chip8_op_classify(uint16_t opcode)
+{
+    uint8_t n = opcode & 0xF;
+    uint8_t nn = opcode & 0xFF;
+
+    switch ((opcode >> 12) & 0xF)
+    {
+    case 0x0:
+        if (opcode == 0x00E0)
+            return OP_00E0;
+        if (opcode == 0x00EE)
+            return OP_00EE;
+        if ((opcode & 0xFFF0) == 0x00C0)
+            return OP_00CN;
+        if ((opcode & 0xFFF0) == 0x00D0)
+            return OP_00DN;
+        if (opcode >= 0x00FB && opcode <= 0x00FF)
+            return OP_00FB + (opcode - 0x00FB);
+        return OP_0NNN;
+    case 0x1:
+        return OP_1NNN;
+    case 0x2:
+        return OP_2NNN;
+    case 0x3:
+        return OP_3XNN;
+    case 0x4:
+        return OP_4XNN;
+    case 0x5:
+        if (n == 2)
+            return OP_5XY2;
+        if (n == 3)
+            return OP_5XY3;
+        return n == 0 ? OP_5XY0 : OP_UNKNOWN;
+    case 0x6:
+        return OP_6XNN;
+    case 0x7:
+        return OP_7XNN;
+    case 0x8:
+        if (n <= 0x7)
+            return OP_8XY0 + n;
+        return n == 0xE ? OP_8XYE : OP_UNKNOWN;
+    case 0x9:
+        return n == 0 ? OP_9XY0 : OP_UNKNOWN;
+    case 0xA:
+        return OP_ANNN;
+    case 0xB:
+        return OP_BNNN;
+    case 0xC:
+        return OP_CXNN;
+    case 0xD:
+        return n == 0 ? OP_DXY0 : OP_DXYN;
+    case 0xE:
+        if (nn == 0x9E)
+            return OP_EX9E;
+        return nn == 0xA1 ? OP_EXA1 : OP_UNKNOWN;
+    case 0xF:
+        switch (nn)
+        {
+        case 0x00:
+            return opcode == 0xF000 ? OP_F000 : OP_UNKNOWN;
+        case 0x01:
+            return OP_FN01;
+        case 0x02:
+            return opcode == 0xF002 ? OP_F002 : OP_UNKNOWN;
+        case 0x07:
+            return OP_FX07;
+        case 0x0A:
+            return OP_FX0A;
+        case 0x15:
+            return OP_FX15;
+        case 0x18:
+            return OP_FX18;
+        case 0x1E:
+            return OP_FX1E;
+        case 0x29:
+            return OP_FX29;
+        case 0x30:
+            return OP_FX30;
+        case 0x33:
+            return OP_FX33;
+        case 0x3A:
+            return OP_FX3A;
+        case 0x55:
+            return OP_FX55;
+        case 0x65:
+            return OP_FX65;
+        case 0x75:
+            return OP_FX75;
+        case 0x85:
+            return OP_FX85;
+        }
+        break;
+    }
+    return OP_UNKNOWN;
+}
+
+/* Machine cycles per instruction class, from the measured VIP instruction times linked in the README. 0 marks
+ * the classes with a variable part, see chip8_op_vip_cycles */
+static const uint8_t vip_cycles[OP_COUNT] = {
+    [OP_0NNN] = 23, [OP_00E0] = 24, [OP_00EE] = 23, [OP_1NNN] = 23, [OP_2NNN] = 23, [OP_3XNN] = 12,
+    [OP_4XNN] = 12, [OP_5XY0] = 16, [OP_6XNN] = 6,  [OP_7XNN] = 10, [OP_8XY0] = 44, [OP_8XY1] = 44,
+    [OP_8XY2] = 44, [OP_8XY3] = 44, [OP_8XY4] = 44, [OP_8XY5] = 44, [OP_8XY6] = 44, [OP_8XY7] = 44,
+    [OP_8XYE] = 44, [OP_9XY0] = 16, [OP_ANNN] = 12, [OP_BNNN] = 23, [OP_CXNN] = 36, [OP_EX9E] = 16,
+    [OP_EXA1] = 16, [OP_FX07] = 10, [OP_FX0A] = 10, [OP_FX15] = 10, [OP_FX18] = 10, [OP_FX1E] = 19,
+    [OP_FX29] = 20, [OP_FX33] = 204,
+};
+
+/* Sprite drawing, per call and per row of 8 pixels */
+#define VIP_DRAW_CYCLES 16
+#define VIP_DRAW_ROW_CYCLES 12
+/* FX55/FX65, per call and per register */
+#define VIP_LOAD_STORE_CYCLES 24
+#define VIP_REGISTER_CYCLES 14
+/* Instructions the VIP does not have */
+#define VIP_EXTENSION_CYCLES 23
+
+uint16_t chip8_op_vip_cycles(uint16_t opcode)
+{
+    enum chip8_op op = chip8_op_classify(opcode);
+    switch (op)
+    {
+    case OP_DXYN:
+        return VIP_DRAW_CYCLES + VIP_DRAW_ROW_CYCLES * (opcode & 0xF);
+    case OP_DXY0:
+        return VIP_DRAW_CYCLES + VIP_DRAW_ROW_CYCLES * 32;
+    case OP_FX55:
+    case OP_FX65:
+        return VIP_LOAD_STORE_CYCLES + VIP_REGISTER_CYCLES * (((opcode >> 8) & 0xF) + 1);
+    default:
+        return vip_cycles[op] ? vip_cycles[op] : VIP_EXTENSION_CYCLES;
+    }
+}
+
+const char *chip8_op_name(enum chip8_op op)
+{
+    if (op >= OP_COUNT)
+        op = OP_UNKNOWN;
+    return op_names[op];
+}
+
+const char *chip8_op_fatal(const struct chip8 *chip8)
+{
+    switch (chip8_op_classify(chip8_fetch(chip8, chip8->PC)))
+    {
+    case OP_UNKNOWN:
+        return "unknown-opcode";
+    case OP_2NNN:
+        return chip8->SP >= STACK_SIZE ? "stack-overflow" : NULL;
+    case OP_00EE:
+        return chip8->SP == 0 ? "stack-underflow" : NULL;
+    default:
+        return NULL;
+    }
+}
@@ -1,13 +1,88 @@
 #include "platform.h"
+#include "platform_thread.h"
+#include "probes.h"
 #include <stdio.h>
 #include <stdlib.h>
 
 #define INVALID_KEY -1
 
-void platform_init(struct window *window)
+/* Display colors, ARGB8888 */
+#define COLOR_FOREGROUND 0xFFFFFFFF
+#define COLOR_BACKGROUND 0xFF000000
+/* XO-CHIP second plane alone and both planes, as in Octo */
+#define COLOR_PLANE2 0xFFFF6600
+#define COLOR_BOTH_PLANES 0xFF662200
+/* Tile borders of the mosaic */
+#define COLOR_BORDER 0xFF404040
+#define COLOR_FOCUS 0xFFFFC800
+
+/* Performance counter frequency for platform_now_us, set once in platform_init */
+static double ticks_per_us = 1.0;
+
+/* Glyph size of the overlay font */
+#define FONT_WIDTH 3
+#define FONT_HEIGHT 5
+/* Glyph pixels drawn per SDL_RenderFillRects call, about one line of overlay text */
+#define TEXT_BATCH_SIZE 256
+
+/* 3x5 glyphs for the overlay, 3 bits per row from the top row down */
+#define GLYPH(r0, r1, r2, r3, r4) (((r0) << 12) | ((r1) << 9) | ((r2) << 6) | ((r3) << 3) | (r4))
+
+static uint16_t platform_get_glyph(char c)
+{
+    static const uint16_t digits[10] = {
+        GLYPH(7, 5, 5, 5, 7), GLYPH(2, 6, 2, 2, 7), GLYPH(6, 1, 2, 4, 7), GLYPH(6, 1, 2, 1, 6),
+        GLYPH(5, 5, 7, 1, 1), GLYPH(7, 4, 6, 1, 6), GLYPH(3, 4, 7, 5, 7), GLYPH(7, 1, 2, 2, 2),
+        GLYPH(7, 5, 7, 5, 7), GLYPH(7, 5, 7, 1, 6),
+    };
+    static const uint16_t letters[26] = {
+        GLYPH(2, 5, 7, 5, 5), GLYPH(6, 5, 6, 5, 6), GLYPH(3, 4, 4, 4, 3), GLYPH(6, 5, 5, 5, 6), /* A-D */
+        GLYPH(7, 4, 6, 4, 7), GLYPH(7, 4, 6, 4, 4), GLYPH(3, 4, 5, 5, 3), GLYPH(5, 5, 7, 5, 5), /* E-H */
+        GLYPH(7, 2, 2, 2, 7), GLYPH(1, 1, 1, 5, 2), GLYPH(5, 5, 6, 5, 5), GLYPH(4, 4, 4, 4, 7), /* I-L */
+        GLYPH(5, 7, 7, 5, 5), GLYPH(6, 5, 5, 5, 5), GLYPH(2, 5, 5, 5, 2), GLYPH(6, 5, 6, 4, 4), /* M-P */
+        GLYPH(2, 5, 5, 6, 3), GLYPH(6, 5, 6, 5, 5), GLYPH(3, 4, 2, 1, 6), GLYPH(7, 2, 2, 2, 2), /* Q-T */
+        GLYPH(5, 5, 5, 5, 7), GLYPH(5, 5, 5, 5, 2), GLYPH(5, 5, 7, 7, 5), GLYPH(5, 5, 2, 5, 5), /* U-X */
+        GLYPH(5, 5, 2, 2, 2), GLYPH(7, 1, 2, 4, 7),                                             /* Y-Z */
+    };
+
+    if (c >= '0' && c <= '9')
+        return digits[c - '0'];
+    if (c >= 'A' && c <= 'Z')
+        return letters[c - 'A'];
+    if (c >= 'a' && c <= 'z')
+        return letters[c - 'a'];
+
+    switch (c)
+    {
+    case '.':
+        return GLYPH(0, 0, 0, 0, 2);
+    case ':':
+        return GLYPH(0, 2, 0, 2, 0);
+    case '-':
+        return GLYPH(0, 0, 7, 0, 0);
+    case '+':
+        return GLYPH(0, 2, 7, 2, 0);
+    case '/':
+        return GLYPH(1, 1, 2, 4, 4);
+    case '%':
+        return GLYPH(5, 1, 2, 4, 5);
+    default:
+        return 0;
+    }
+}
+
+void platform_init(struct window *window, uint8_t vsync, enum filter filter)
 {
     // int8_t success = 0;
     window->w = NULL;
+    window->texture = NULL;
+    window->filter = filter;
+    window->filters = NULL;
+    window->tiles = 0;
+    window->show_hud = 0;
+    window->debug = DEBUG_NONE;
+    window->hud_text[0] = '\0';
+    ticks_per_us = SDL_GetPerformanceFrequency() / 1000000.0;
 
     /* return -1 if fails */
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
@@ -30,16 +105,65 @@ void platform_init(struct window *window)
             fprintf(stderr, "Window could not be created. Error: %s\n", SDL_GetError());
         }
 
-        window->renderer = SDL_CreateRenderer(window->w, -1, 0);
+        window->renderer = SDL_CreateRenderer(window->w, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
         if (!window->renderer)
         {
             fprintf(stderr, "Renderer could not be created. Error: %s\n", SDL_GetError());
         }
+
+        /* the display is filtered on the CPU into a streaming texture, the renderer scales it up */
+        filter_select_isa(FILTER_ISA_COUNT);
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+        platform_set_tiles(window, 1);
+    }
+}
+
+/* Size of a tile in texels: the display, plus a border of one CHIP8 pixel in a mosaic */
+static void platform_get_tile_size(const struct window *window, int *w, int *h)
+{
+    uint8_t scale = filter_scale(window->filter);
+    uint8_t border = window->tiles > 1 ? 2 : 0;
+    *w = (DISPLAY_WIDTH + border) * scale;
+    *h = (DISPLAY_HEIGHT + border) * scale;
+}
+
+int8_t platform_set_tiles(struct window *window, uint16_t count)
+{
+    struct filter_state *filters = realloc(window->filters, count * sizeof(*filters));
+    if (!filters)
+        return 0;
+    window->filters = filters;
+    static const uint32_t palette[FILTER_COLORS] = {COLOR_BACKGROUND, COLOR_FOREGROUND, COLOR_PLANE2,
+                                                    COLOR_BOTH_PLANES};
+    for (uint16_t i = 0; i < count; i++)
+        filter_init(&filters[i], window->filter, palette);
+
+    /* as many columns as rows, tiles and windows are both 2:1 */
+    window->tiles = count;
+    window->columns = 1;
+    while (window->columns * window->columns < count)
+        window->columns++;
+    window->rows = (count + window->columns - 1) / window->columns;
+    window->focus = 0;
+    window->held = 0;
+
+    int w, h;
+    platform_get_tile_size(window, &w, &h);
+    SDL_DestroyTexture(window->texture);
+    window->texture = SDL_CreateTexture(window->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                        w * window->columns, h * window->rows);
+    if (!window->texture)
+    {
+        fprintf(stderr, "Texture could not be created. Error: %s\n", SDL_GetError());
+        return 0;
     }
+    return 1;
 }
 
 void platform_close(struct window *window)
 {
+    SDL_DestroyTexture(window->texture);
+    free(window->filters);
     SDL_DestroyWindow(window->w);
     SDL_DestroyRenderer(window->renderer);
     SDL_Quit();
@@ -106,13 +230,49 @@ uint8_t platform_get_key_from_keycode(SDL_KeyCode keycode)
     }
 }
 
-int8_t platform_process_input(uint8_t *keypad)
+/* Move keyboard input to the tile under a click. Keys held on the previous tile are released there, or they
+ * would stay down */
+static void platform_focus_tile(struct window *window, struct key_queue *const *keys, int x, int y, double time_us)
+{
+    if (window->tiles < 2 || x < window->view.x || y < window->view.y || x >= window->view.x + window->view.w ||
+        y >= window->view.y + window->view.h)
+        return;
+
+    uint16_t column = (x - window->view.x) * window->columns / window->view.w;
+    uint16_t row = (y - window->view.y) * window->rows / window->view.h;
+    uint16_t tile = row * window->columns + column;
+    if (tile >= window->tiles || tile == window->focus)
+        return;
+
+    for (uint8_t key = 0; key < 16; key++)
+        if (window->held & (1 << key))
+            key_queue_push(keys[window->focus], key, 0, time_us);
+    window->held = 0;
+    window->focus = tile;
+}
+
+int8_t platform_process_input(struct window *window, struct key_queue *const *keys, double deadline_us)
 {
     int8_t running = 1;
 
     SDL_Event e;
-    while (SDL_PollEvent(&e))
+    while (running > 0)
     {
+        /* Sleep in the event wait rather than elsewhere, so events are handled as soon as they arrive */
+        double remaining_us = deadline_us - platform_now_us();
+        if (remaining_us >= 1000.0 ? !SDL_WaitEventTimeout(&e, remaining_us / 1000.0) : !SDL_PollEvent(&e))
+        {
+            if (remaining_us < 1000.0)
+                break;
+            continue;
+        }
+
+        /* SDL stamps events in milliseconds when it receives them, move that to the microsecond clock */
+        double now_us = platform_now_us();
+        double arrival_us = now_us - (Uint32)(SDL_GetTicks() - e.common.timestamp) * 1000.0;
+        if (arrival_us > now_us)
+            arrival_us = now_us;
+
         switch (e.type)
         {
         case SDL_QUIT:
@@ -125,67 +285,173 @@ int8_t platform_process_input(uint8_t *keypad)
 
             if (keycode == SDLK_ESCAPE)
                 running = 0;
-            else if (key != INVALID_KEY)
+            else if (keycode == SDLK_F1)
+                window->show_hud = !window->show_hud;
+            else if (keycode == SDLK_F5)
+                window->debug = DEBUG_CONTINUE;
+            else if (keycode == SDLK_F6)
+                window->debug = DEBUG_PAUSE;
+            else if (keycode == SDLK_F10)
+                window->debug = DEBUG_STEP;
+            else if (keycode == SDLK_F11)
+                window->debug = DEBUG_FRAME;
+            else if (key != INVALID_KEY && !e.key.repeat)
+            {
                 /* key pressed */
-                keypad[key] = 1;
+                key_queue_push(keys[window->focus], key, 1, arrival_us);
+                window->held |= 1 << key;
+                PROBE1(key_down, key);
+            }
         }
         break;
         case SDL_KEYUP: {
             /* Get the corresponding key for the current keycode */
             int8_t key = platform_get_key_from_keycode(e.key.keysym.sym);
             if (key != INVALID_KEY)
-                keypad[key] = 2;
+            {
+                key_queue_push(keys[window->focus], key, 0, arrival_us);
+                window->held &= ~(1 << key);
+                PROBE1(key_up, key);
+            }
 
             break;
         }
+        case SDL_MOUSEBUTTONDOWN:
+            if (e.button.button == SDL_BUTTON_LEFT)
+                platform_focus_tile(window, keys, e.button.x, e.button.y, arrival_us);
+            break;
         }
     }
     return running;
 }
 
-void platform_update(struct window *window, uint8_t *display_buffer, uint8_t display_width, uint8_t display_height)
+void platform_update(struct window *window, const uint8_t *const *displays, const char *const *labels)
 {
-    SDL_Rect rect;
-    uint16_t min_scale;
+    PROBE0(update_begin);
+
+    int tile_w, tile_h;
+    platform_get_tile_size(window, &tile_w, &tile_h);
+    uint8_t scale = filter_scale(window->filter);
+    uint8_t border = window->tiles > 1 ? scale : 0;
+
+    /* Composite every tile, then upload once */
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(window->texture, NULL, &pixels, &pitch) == 0)
+    {
+        uint32_t stride = pitch / sizeof(uint32_t);
+        for (uint16_t i = 0; i < window->tiles; i++)
+        {
+            uint32_t *tile =
+                (uint32_t *)pixels + (i / window->columns) * tile_h * stride + (i % window->columns) * tile_w;
+            if (border)
+            {
+                uint32_t color = i == window->focus ? COLOR_FOCUS : COLOR_BORDER;
+                for (int y = 0; y < tile_h; y++)
+                    for (int x = 0; x < tile_w; x++)
+                        tile[y * stride + x] = color;
+            }
+            filter_apply(&window->filters[i], displays[i], tile + border * stride + border, stride);
+        }
+        SDL_UnlockTexture(window->texture);
+    }
 
     /* TODO: change this to calculate only when window is resized. might need SDL_Event and min_scale in the window struct */
-    /* calculate minimum scale */
+    /* fit the texture to the window, in whole window pixels per texel when it is large enough */
+    int texture_w = tile_w * window->columns, texture_h = tile_h * window->rows;
+    double fit = 1.0;
     if (SDL_GetWindowFlags(window->w) & SDL_WINDOW_RESIZABLE)
     {
         int w, h;
         SDL_GetWindowSize(window->w, &w, &h);
-        min_scale = SDL_min(w / display_width, h / display_height);
+        fit = SDL_min((double)w / texture_w, (double)h / texture_h);
+        if (fit >= 1.0)
+            fit = (int)fit;
     }
-    else
+    window->view = (SDL_Rect){0, 0, texture_w * fit, texture_h * fit};
+
+    SDL_SetRenderDrawColor(window->renderer, 0, 0, 0, 255);
+    SDL_RenderClear(window->renderer);
+    SDL_RenderCopy(window->renderer, window->texture, NULL, &window->view);
+
+    /* window pixels per low resolution CHIP8 pixel */
+    int pixel = SDL_max((int)(fit * scale * DISPLAY_WIDTH / LORES_WIDTH), 1);
+    if (labels)
     {
-        min_scale = 1;
+        for (uint16_t i = 0; i < window->tiles; i++)
+            platform_draw_text(window, labels[i], (i % window->columns) * tile_w * fit + pixel,
+                               (i / window->columns) * tile_h * fit + pixel, SDL_max(pixel / 3, 1));
     }
 
-    for (uint8_t y = 0; y < display_height; y++)
-    {
-        uint16_t y_scaled_pos = y * min_scale;
-        uint16_t rect_h = (y + 1) * min_scale - y_scaled_pos;
+    if (window->show_hud)
+        platform_draw_text(window, window->hud_text, pixel / 2, pixel / 2, SDL_max(pixel / 4, 1));
+
+    SDL_RenderPresent(window->renderer);
 
-        for (uint8_t x = 0; x < display_width; x++)
+    PROBE0(update_end);
+}
+
+void platform_draw_text(struct window *window, const char *text, int x, int y, int scale)
+{
+    /* Measure the text for the background */
+    int columns = 0, lines = 1, column = 0;
+    for (const char *c = text; *c; c++)
+    {
+        if (*c == '\n')
         {
-            uint16_t x_scaled_pos = x * min_scale;
-            uint16_t rect_w = (x + 1) * min_scale - x_scaled_pos;
+            lines++;
+            column = 0;
+            continue;
+        }
+        column++;
+        columns = SDL_max(columns, column);
+    }
 
-            rect.x = x_scaled_pos;
-            rect.y = y_scaled_pos;
-            rect.w = rect_w;
-            rect.h = rect_h;
+    SDL_Rect background = {x, y, (columns * (FONT_WIDTH + 1) + 1) * scale, (lines * (FONT_HEIGHT + 1) + 1) * scale};
+    SDL_SetRenderDrawBlendMode(window->renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(window->renderer, 0, 0, 0, 192);
+    SDL_RenderFillRect(window->renderer, &background);
 
-            if (display_buffer[y * display_width + x])
-                SDL_SetRenderDrawColor(window->renderer, 255, 255, 255, 255);
-            else
-                SDL_SetRenderDrawColor(window->renderer, 0, 0, 0, 255);
+    /* Batch the glyph pixels, a few draw calls per text */
+    SDL_Rect pixels[TEXT_BATCH_SIZE];
+    int count = 0;
+    int pen_x = x + scale, pen_y = y + scale;
 
-            SDL_RenderFillRect(window->renderer, &rect);
+    SDL_SetRenderDrawColor(window->renderer, 255, 200, 0, 255);
+    for (const char *c = text; *c; c++)
+    {
+        if (*c == '\n')
+        {
+            pen_x = x + scale;
+            pen_y += (FONT_HEIGHT + 1) * scale;
+            continue;
         }
+
+        uint16_t glyph = platform_get_glyph(*c);
+        for (int row = 0; row < FONT_HEIGHT; row++)
+        {
+            for (int col = 0; col < FONT_WIDTH; col++)
+            {
+                if (!((glyph >> ((FONT_HEIGHT - 1 - row) * FONT_WIDTH + (FONT_WIDTH - 1 - col))) & 1))
+                    continue;
+                if (count == TEXT_BATCH_SIZE)
+                {
+                    SDL_RenderFillRects(window->renderer, pixels, count);
+                    count = 0;
+                }
+                pixels[count++] = (SDL_Rect){pen_x + col * scale, pen_y + row * scale, scale, scale};
+            }
+        }
+        pen_x += (FONT_WIDTH + 1) * scale;
     }
 
-    SDL_RenderPresent(window->renderer);
+    SDL_RenderFillRects(window->renderer, pixels, count);
+    SDL_SetRenderDrawBlendMode(window->renderer, SDL_BLENDMODE_NONE);
+}
+
+double platform_now_us(void)
+{
+    return SDL_GetPerformanceCounter() / ticks_per_us;
 }
 
 #ifdef WIN
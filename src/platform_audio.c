@@ -0,0 +1,172 @@
+#include "platform_audio.h"
+#include <stdio.h>
+#include <string.h>
+
+#define AUDIO_PATTERN_BITS (AUDIO_PATTERN_SIZE * 8)
+#define PITCH_STEP 1.0145453349467997 /* 2^(1/48): one pitch unit */
+
+/* XO-CHIP pattern playback rate, 4000 * 2^((pitch - 64) / 48) Hz */
+static double platform_audio_pattern_rate(uint8_t pitch)
+{
+    double rate = 4000.0;
+    for (int i = 64; i < pitch; i++)
+        rate *= PITCH_STEP;
+    for (int i = pitch; i < 64; i++)
+        rate /= PITCH_STEP;
+    return rate;
+}
+
+/* Fill one buffer. The buffer stands for the time since the previous callback, so a change at an emulated
+ * time lands at the matching sample, one buffer later */
+static void SDLCALL platform_audio_callback(void *data, Uint8 *stream, int length)
+{
+    struct audio *audio = data;
+    int16_t *samples = (int16_t *)stream;
+    int count = length / (int)sizeof(*samples);
+
+    double now_us = platform_now_us();
+    double buffer_us = count * 1000000.0 / audio->frequency;
+
+    /* The device played out everything it had before asking again */
+    if (audio->callback_us && now_us - audio->callback_us > 2 * buffer_us)
+        SDL_AtomicAdd(&audio->underruns, 1);
+    audio->callback_us = now_us;
+
+    double start_us = now_us - buffer_us;
+    double step = AUDIO_TONE / audio->frequency;
+
+    int head = SDL_AtomicGet(&audio->head);
+    int tail = SDL_AtomicGet(&audio->tail);
+    SDL_MemoryBarrierAcquire();
+
+    for (int i = 0; i < count;)
+    {
+        /* Samples until the next change, or the end of the buffer */
+        int end = count;
+        if (head != tail)
+        {
+            const struct buzzer_event *event = &audio->events[head & (AUDIO_QUEUE_SIZE - 1)];
+            /* Rounded down to a sample, past changes apply at once */
+            double offset = (event->time_us - start_us) * audio->frequency / 1000000.0;
+            if (offset < i + 1)
+            {
+                if (event->set_pattern)
+                {
+                    /* A pitch change before any F002 keeps the tone, only the rate is kept for later */
+                    audio->pattern_step = platform_audio_pattern_rate(event->pitch) / audio->frequency;
+                    if (event->pattern_loaded)
+                    {
+                        memcpy(audio->pattern, event->pattern, sizeof(audio->pattern));
+                        if (!audio->pattern_loaded)
+                            audio->phase = 0;
+                    }
+                    audio->pattern_loaded = event->pattern_loaded;
+                }
+                else
+                {
+                    audio->on = event->on;
+                }
+                head++;
+                continue;
+            }
+            if (offset < count)
+                end = (int)offset;
+        }
+
+        if (!audio->on)
+        {
+            memset(samples + i, 0, (end - i) * sizeof(*samples));
+            i = end;
+            continue;
+        }
+
+        if (audio->pattern_loaded)
+        {
+            /* 1-bit samples, most significant bit of the first byte first */
+            for (; i < end; i++)
+            {
+                uint8_t bit = (uint8_t)audio->phase;
+                uint8_t high = (audio->pattern[bit / 8] >> (7 - bit % 8)) & 1;
+                samples[i] = high ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+                audio->phase += audio->pattern_step;
+                if (audio->phase >= AUDIO_PATTERN_BITS)
+                    audio->phase -= AUDIO_PATTERN_BITS;
+            }
+            continue;
+        }
+
+        for (; i < end; i++)
+        {
+            samples[i] = audio->phase < 0.5 ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+            audio->phase += step;
+            if (audio->phase >= 1.0)
+                audio->phase -= 1.0;
+        }
+    }
+
+    SDL_AtomicSet(&audio->head, head);
+}
+
+int8_t platform_audio_open(struct audio *audio)
+{
+    memset(audio, 0, sizeof(*audio));
+    SDL_AtomicSet(&audio->head, 0);
+    SDL_AtomicSet(&audio->tail, 0);
+    SDL_AtomicSet(&audio->underruns, 0);
+
+    /* Largest power of 2 buffer within AUDIO_BUFFER_US */
+    uint16_t samples = 1;
+    while (samples * 2 * 1000000.0 / AUDIO_FREQUENCY <= AUDIO_BUFFER_US)
+        samples *= 2;
+
+    SDL_AudioSpec desired, obtained;
+    memset(&desired, 0, sizeof(desired));
+    desired.freq = AUDIO_FREQUENCY;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = samples;
+    desired.callback = platform_audio_callback;
+    desired.userdata = audio;
+
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!audio->device)
+    {
+        fprintf(stderr, "Audio device could not be opened, the buzzer is muted. Error: %s\n", SDL_GetError());
+        return 0;
+    }
+
+    audio->frequency = obtained.freq;
+    audio->samples = obtained.samples;
+    SDL_PauseAudioDevice(audio->device, 0);
+    return 1;
+}
+
+void platform_audio_pattern(struct audio *audio, const uint8_t *pattern, uint8_t loaded, uint8_t pitch,
+                            double time_us)
+{
+    if (!audio->device)
+        return;
+
+    struct buzzer_event *event = platform_audio_event(audio);
+    if (!event)
+        return;
+
+    event->time_us = time_us;
+    event->set_pattern = 1;
+    event->pattern_loaded = loaded;
+    event->pitch = pitch;
+    memcpy(event->pattern, pattern, sizeof(event->pattern));
+    platform_audio_publish(audio);
+}
+
+void platform_audio_close(struct audio *audio)
+{
+    if (audio->device)
+        SDL_CloseAudioDevice(audio->device);
+    audio->device = 0;
+}
+
+uint32_t platform_audio_underruns(struct audio *audio)
+{
+    return SDL_AtomicGet(&audio->underruns);
+}
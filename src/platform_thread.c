@@ -0,0 +1,87 @@
+#include "platform_thread.h"
+#include <string.h>
+
+void triple_buffer_init(struct triple_buffer *buffer)
+{
+    memset(buffer->frames, 0, sizeof(buffer->frames));
+    buffer->back = 0;
+    SDL_AtomicSet(&buffer->middle, 1);
+    buffer->front = 2;
+}
+
+struct frame *triple_buffer_back(struct triple_buffer *buffer)
+{
+    return &buffer->frames[buffer->back];
+}
+
+void triple_buffer_publish(struct triple_buffer *buffer)
+{
+    /* Frame contents must be visible before the index that hands them over */
+    SDL_MemoryBarrierRelease();
+    int previous = SDL_AtomicSet(&buffer->middle, buffer->back | TRIPLE_BUFFER_FRESH);
+    buffer->back = previous & ~TRIPLE_BUFFER_FRESH;
+}
+
+const struct frame *triple_buffer_acquire(struct triple_buffer *buffer)
+{
+    if (!(SDL_AtomicGet(&buffer->middle) & TRIPLE_BUFFER_FRESH))
+        return NULL;
+
+    /* Only the consumer clears the flag, so the middle buffer is still fresh here */
+    int previous = SDL_AtomicSet(&buffer->middle, buffer->front);
+    SDL_MemoryBarrierAcquire();
+    buffer->front = previous & ~TRIPLE_BUFFER_FRESH;
+    return &buffer->frames[buffer->front];
+}
+
+void key_queue_init(struct key_queue *queue)
+{
+    memset(queue->events, 0, sizeof(queue->events));
+    SDL_AtomicSet(&queue->head, 0);
+    SDL_AtomicSet(&queue->tail, 0);
+}
+
+int8_t key_queue_push(struct key_queue *queue, uint8_t key, uint8_t pressed, double time_us)
+{
+    int tail = SDL_AtomicGet(&queue->tail);
+    if (tail - SDL_AtomicGet(&queue->head) == KEY_QUEUE_SIZE)
+        return 0;
+
+    struct key_event *event = &queue->events[tail & (KEY_QUEUE_SIZE - 1)];
+    event->time_us = time_us;
+    event->event = (key & 0xF) | (pressed ? KEY_EVENT_PRESSED : 0);
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&queue->tail, tail + 1);
+    return 1;
+}
+
+uint32_t key_queue_drain(struct key_queue *queue, struct chip8 *chip8, double time_us)
+{
+    int head = SDL_AtomicGet(&queue->head);
+    int tail = SDL_AtomicGet(&queue->tail);
+    if (head == tail)
+        return 0;
+    SDL_MemoryBarrierAcquire();
+
+    uint16_t seen = 0;
+    uint32_t applied = 0;
+    for (; head != tail; head++, applied++)
+    {
+        const struct key_event *event = &queue->events[head & (KEY_QUEUE_SIZE - 1)];
+        uint8_t key = event->event & 0xF;
+        if (event->time_us > time_us || (seen & (1 << key)))
+            break;
+
+        seen |= 1 << key;
+        chip8_key_event(chip8, key, event->event & KEY_EVENT_PRESSED);
+    }
+
+    if (applied)
+        SDL_AtomicSet(&queue->head, head);
+    return applied;
+}
+
+double key_queue_time(const struct key_queue *queue, uint32_t index)
+{
+    return queue->events[index & (KEY_QUEUE_SIZE - 1)].time_us;
+}
@@ -0,0 +1,97 @@
+#include "profile.h"
+#include "chip8.h"
+#include <stdlib.h>
+
+#ifdef CHIP8_PROFILE
+
+struct hot_address
+{
+    uint16_t address;
+    uint64_t count;
+};
+
+static int compare_hot_addresses(const void *a, const void *b)
+{
+    const struct hot_address *lhs = a;
+    const struct hot_address *rhs = b;
+
+    if (lhs->count != rhs->count)
+        return lhs->count < rhs->count ? 1 : -1;
+    return lhs->address - rhs->address;
+}
+
+/* qsort has no context argument, so the op comparison reads the counts from here */
+static const uint64_t *sort_counts;
+
+static int compare_ops(const void *a, const void *b)
+{
+    uint8_t lhs = *(const uint8_t *)a;
+    uint8_t rhs = *(const uint8_t *)b;
+
+    if (sort_counts[lhs] != sort_counts[rhs])
+        return sort_counts[lhs] < sort_counts[rhs] ? 1 : -1;
+    return lhs - rhs;
+}
+
+void profile_report(const struct chip8 *chip8, FILE *out, uint16_t max_addresses)
+{
+    const struct chip8_profile *profile = &chip8->profile;
+    double total = profile->instructions ? (double)profile->instructions : 1.0;
+
+    fprintf(out, "\n=== Instruction profile: %llu instructions ===\n", (unsigned long long)profile->instructions);
+    fprintf(out, "DXYN rows drawn: %llu, FX0A wait cycles: %llu (%.2f%%)\n",
+            (unsigned long long)profile->dxyn_rows, (unsigned long long)profile->fx0a_wait_cycles,
+            100.0 * profile->fx0a_wait_cycles / total);
+
+    /* Instruction mix, most executed first */
+    uint8_t ops[OP_COUNT];
+    for (uint8_t op = 0; op < OP_COUNT; op++)
+        ops[op] = op;
+    sort_counts = profile->op_count;
+    qsort(ops, OP_COUNT, sizeof(ops[0]), compare_ops);
+
+    fprintf(out, "\nInstruction mix:\n");
+    for (uint8_t i = 0; i < OP_COUNT && profile->op_count[ops[i]]; i++)
+    {
+        uint64_t count = profile->op_count[ops[i]];
+        fprintf(out, "  %s %14llu %6.2f%%\n", chip8_op_name(ops[i]), (unsigned long long)count, 100.0 * count / total);
+    }
+
+    /* Hottest addresses */
+    struct hot_address *hot = malloc(PROFILE_ADDRESS_COUNT * sizeof(*hot));
+    if (!hot)
+        return;
+
+    uint32_t used = 0;
+    for (uint32_t address = 0; address < PROFILE_ADDRESS_COUNT; address++)
+    {
+        if (profile->pc_count[address])
+        {
+            hot[used].address = address;
+            hot[used].count = profile->pc_count[address];
+            used++;
+        }
+    }
+    qsort(hot, used, sizeof(*hot), compare_hot_addresses);
+
+    fprintf(out, "\nHottest addresses:\n");
+    for (uint32_t i = 0; i < used && i < max_addresses; i++)
+    {
+        uint16_t address = hot[i].address;
+        uint16_t opcode = chip8_fetch(chip8, address);
+        fprintf(out, "  0x%03x %04x %s %14llu %6.2f%%\n", address, opcode, chip8_op_name(chip8_op_classify(opcode)),
+                (unsigned long long)hot[i].count, 100.0 * hot[i].count / total);
+    }
+    free(hot);
+}
+
+#else
+
+void profile_report(const struct chip8 *chip8, FILE *out, uint16_t max_addresses)
+{
+    (void)chip8;
+    (void)max_addresses;
+    fprintf(out, "Instruction profiling is disabled, rebuild with profile=1\n");
+}
+
+#endif /* CHIP8_PROFILE */
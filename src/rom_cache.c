@@ -0,0 +1,257 @@
+#include "rom_cache.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define mkdir(path, mode) _mkdir(path)
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define ROM_CACHE_MAGIC "CILLYAN"
+
+/* Cache file layout: this header, the ROM bytes, the whole memory map, the blocks and the issues */
+struct rom_cache_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t rom_size;
+    uint64_t hash;
+    uint16_t start;
+    uint16_t block_size; /* Structure sizes, a build with another layout misses */
+    uint16_t issue_size;
+    uint8_t platform;
+    uint32_t block_count;
+    uint32_t issue_count;
+};
+
+static uint64_t rom_hash(const uint8_t *data, uint32_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* Map a whole file read-only, without mmap the file is read into a buffer
+ * @return NULL if it cannot be opened, is empty or is larger than max_size */
+static const uint8_t *map_file(const char *path, size_t max_size, size_t *size, void **mapping)
+{
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0L, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    uint8_t *data = length > 0 && (size_t)length <= max_size ? malloc(length) : NULL;
+    if (data && fread(data, 1, length, file) != (size_t)length)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = length;
+    *mapping = data;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat status;
+    void *data = MAP_FAILED;
+    if (!fstat(fd, &status) && status.st_size > 0 && (size_t)status.st_size <= max_size)
+        data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    *size = status.st_size;
+    *mapping = data;
+    return data;
+#endif
+}
+
+static void unmap_file(void *mapping, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    free(mapping);
+#else
+    munmap(mapping, size);
+#endif
+}
+
+const char *rom_image_open(struct rom_image *image, const char *path)
+{
+    memset(image, 0, sizeof(*image));
+
+    /* Too large and empty files get the loader's error, the loader checks the size again from its start address */
+    size_t size;
+    image->data = map_file(path, MAX_MEMORY, &size, &image->mapping);
+    if (!image->data)
+    {
+        FILE *file = fopen(path, "rb");
+        if (!file)
+            return "Failed to open the ROM file.";
+        fseek(file, 0L, SEEK_END);
+        long length = ftell(file);
+        fclose(file);
+        const char *error = length < 0 ? NULL : chip8_check_rom_size(0, length);
+        return error ? error : "Failed to read the ROM file.";
+    }
+
+    image->size = size;
+    image->hash = rom_hash(image->data, image->size);
+    return NULL;
+}
+
+void rom_image_close(struct rom_image *image)
+{
+    if (image->mapping)
+        unmap_file(image->mapping, image->size);
+    memset(image, 0, sizeof(*image));
+}
+
+/* @return 0 if the path does not fit */
+static uint8_t rom_cache_path(char *path, size_t length, const char *directory, uint64_t hash)
+{
+    int written = snprintf(path, length, "%s/%016llx.analysis", directory, (unsigned long long)hash);
+    return written >= 0 && (size_t)written < length;
+}
+
+/* @return 1 if a cache file holds the analysis of this ROM loaded at start by this build */
+static uint8_t rom_cache_valid(const uint8_t *data, size_t size, const struct rom_image *image, uint16_t start,
+                               struct rom_cache_header *header)
+{
+    if (size < sizeof(*header))
+        return 0;
+    memcpy(header, data, sizeof(*header));
+
+    size_t blocks_size = (size_t)header->block_count * sizeof(struct analysis_block);
+    size_t issues_size = (size_t)header->issue_count * sizeof(struct analysis_issue);
+    return !memcmp(header->magic, ROM_CACHE_MAGIC, sizeof(ROM_CACHE_MAGIC)) &&
+           header->version == ROM_CACHE_VERSION && header->hash == image->hash &&
+           header->rom_size == image->size && header->start == start &&
+           header->block_size == sizeof(struct analysis_block) &&
+           header->issue_size == sizeof(struct analysis_issue) &&
+           size == sizeof(*header) + image->size + MAX_MEMORY + blocks_size + issues_size &&
+           !memcmp(data + sizeof(*header), image->data, image->size);
+}
+
+/* Copy an analysis out of a cache file
+ * @return -1 if out of memory, 0 if the file is missing or does not match, 1 on success */
+static int8_t rom_cache_read(const char *path, const struct rom_image *image, uint16_t start,
+                             struct analysis *analysis)
+{
+    size_t size;
+    void *mapping;
+    const uint8_t *data = map_file(path, SIZE_MAX, &size, &mapping);
+    if (!data)
+        return 0;
+
+    struct rom_cache_header header;
+    if (!rom_cache_valid(data, size, image, start, &header))
+    {
+        unmap_file(mapping, size);
+        return 0;
+    }
+
+    size_t blocks_size = (size_t)header.block_count * sizeof(*analysis->blocks);
+    size_t issues_size = (size_t)header.issue_count * sizeof(*analysis->issues);
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->blocks = malloc(blocks_size ? blocks_size : 1);
+    analysis->issues = malloc(issues_size ? issues_size : 1);
+    if (!analysis->blocks || !analysis->issues)
+    {
+        analysis_free(analysis);
+        unmap_file(mapping, size);
+        return -1;
+    }
+
+    analysis->start = start;
+    analysis->end = start + image->size;
+    analysis->platform = header.platform;
+    data += sizeof(header) + image->size;
+    memcpy(analysis->map, data, MAX_MEMORY);
+    memcpy(analysis->blocks, data + MAX_MEMORY, blocks_size);
+    memcpy(analysis->issues, data + MAX_MEMORY + blocks_size, issues_size);
+    analysis->block_count = header.block_count;
+    analysis->issue_count = analysis->issue_capacity = header.issue_count;
+
+    unmap_file(mapping, size);
+    return 1;
+}
+
+/* Write a cache file under a temporary name first, so concurrent runs never map a partial file */
+static void rom_cache_write(const char *path, const struct rom_image *image, const struct analysis *analysis)
+{
+    struct rom_cache_header header = {
+        .magic = ROM_CACHE_MAGIC,
+        .version = ROM_CACHE_VERSION,
+        .rom_size = image->size,
+        .hash = image->hash,
+        .start = analysis->start,
+        .block_size = sizeof(struct analysis_block),
+        .issue_size = sizeof(struct analysis_issue),
+        .platform = analysis->platform,
+        .block_count = analysis->block_count,
+        .issue_count = analysis->issue_count,
+    };
+
+    char temporary[1024 + 32];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid());
+    FILE *file = fopen(temporary, "wb");
+    if (!file)
+        return;
+
+    int8_t ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                fwrite(image->data, 1, image->size, file) == image->size &&
+                fwrite(analysis->map, sizeof(analysis->map), 1, file) == 1 &&
+                fwrite(analysis->blocks, sizeof(*analysis->blocks), analysis->block_count, file) ==
+                    analysis->block_count &&
+                fwrite(analysis->issues, sizeof(*analysis->issues), analysis->issue_count, file) ==
+                    analysis->issue_count;
+    ok = !fclose(file) && ok;
+#ifdef _WIN32
+    /* rename does not replace an existing file */
+    remove(path);
+#endif
+    if (!ok || rename(temporary, path))
+        remove(temporary);
+}
+
+int8_t rom_cache_analysis(const char *directory, const struct rom_image *image, const struct chip8 *chip8,
+                          struct analysis *analysis)
+{
+    /* A directory whose file names would be truncated is not used */
+    char path[1024];
+    if (directory && !rom_cache_path(path, sizeof(path), directory, image->hash))
+        directory = NULL;
+    if (directory)
+    {
+        int8_t result = rom_cache_read(path, image, chip8->PC, analysis);
+        if (result)
+            return result;
+    }
+
+    if (!analysis_run(analysis, chip8, chip8->PC, image->size))
+        return -1;
+
+    if (directory && (!mkdir(directory, 0755) || errno == EEXIST))
+        rom_cache_write(path, image, analysis);
+    return 0;
+}
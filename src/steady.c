@@ -0,0 +1,37 @@
+#include "steady.h"
+#include <string.h>
+
+void steady_init(struct steady *steady)
+{
+    memset(steady, 0, sizeof(*steady));
+}
+
+void steady_reset(struct steady *steady)
+{
+    steady->count = 0;
+    steady->next = 0;
+}
+
+uint32_t steady_frame(struct steady *steady, const struct chip8 *chip8, uint64_t phase, uint32_t frame)
+{
+    uint64_t hash = chip8_hash_state(chip8) ^ (phase + 1) * 0x9e3779b97f4a7c15ull;
+
+    /* The most recent match gives the shortest period */
+    for (uint32_t i = 1; i <= steady->count; i++)
+    {
+        uint32_t index = (steady->next + STEADY_HISTORY - i) % STEADY_HISTORY;
+        if (steady->hashes[index] == hash)
+        {
+            steady->period = frame - steady->frames[index];
+            steady->first = steady->frames[index];
+            return steady->period;
+        }
+    }
+
+    steady->hashes[steady->next] = hash;
+    steady->frames[steady->next] = frame;
+    steady->next = (steady->next + 1) % STEADY_HISTORY;
+    if (steady->count < STEADY_HISTORY)
+        steady->count++;
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define write _write
+#define close _close
+#define STREAM_OPEN_FLAGS (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY)
+#else
+#include <unistd.h>
+#define STREAM_OPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC)
+#endif
+
+#define Y4M_FRAME_HEADER "FRAME\n"
+/* Grey level of each pixel color: off, first plane, second plane, both */
+static const uint8_t y4m_levels[4] = {0, 255, 85, 170};
+/* Largest frame record: changed_only frame number or Y4M frame header, plus the pixels */
+#define STREAM_MAX_FRAME (sizeof(Y4M_FRAME_HEADER) + DISPLAY_WIDTH * DISPLAY_HEIGHT)
+
+int8_t stream_parse_format(const char *name, enum stream_format *format)
+{
+    if (!strcmp(name, "y4m"))
+        *format = STREAM_Y4M;
+    else if (!strcmp(name, "raw"))
+        *format = STREAM_RAW;
+    else
+        return 0;
+    return 1;
+}
+
+/* Write the whole buffer, a pipe may take it in several parts */
+static void stream_flush(struct stream *stream)
+{
+    size_t written = 0;
+    while (!stream->error && written < stream->used)
+    {
+        int result = write(stream->fd, stream->buffer + written, stream->used - written);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+        {
+            fprintf(stderr, "Error: failed to write the frame stream: %s\n", strerror(errno));
+            stream->error = 1;
+            break;
+        }
+        written += result;
+    }
+    stream->bytes += written;
+    stream->used = 0;
+}
+
+int8_t stream_open(struct stream *stream, const char *path, enum stream_format format, uint8_t changed_only)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->format = format;
+    stream->changed_only = changed_only;
+
+    stream->buffer = malloc(STREAM_BUFFER_SIZE);
+    if (!stream->buffer)
+        return 0;
+
+    stream->fd = strcmp(path, "-") ? open(path, STREAM_OPEN_FLAGS, 0644) : 1;
+#ifdef _WIN32
+    if (stream->fd == 1)
+        _setmode(1, _O_BINARY);
+#endif
+    if (stream->fd < 0)
+    {
+        free(stream->buffer);
+        stream->buffer = NULL;
+        return 0;
+    }
+
+    if (format == STREAM_Y4M)
+        stream->used = snprintf((char *)stream->buffer, STREAM_BUFFER_SIZE, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n",
+                                DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    return 1;
+}
+
+int8_t stream_frame(struct stream *stream, const struct chip8 *chip8, uint32_t frame)
+{
+    if (stream->error)
+        return 0;
+
+    if (stream->changed_only)
+    {
+        if (stream->frames && stream->last.hires == chip8->display.hires &&
+            !memcmp(stream->last.planes, chip8->display.planes, sizeof(stream->last.planes)))
+            return 1;
+        stream->last = chip8->display;
+    }
+
+    if (STREAM_BUFFER_SIZE - stream->used < STREAM_MAX_FRAME)
+        stream_flush(stream);
+
+    /* Convert straight into the output buffer */
+    chip8_display_unpack(&chip8->display, stream->pixels);
+    uint8_t *out = stream->buffer + stream->used;
+    if (stream->format == STREAM_Y4M)
+    {
+        memcpy(out, Y4M_FRAME_HEADER, sizeof(Y4M_FRAME_HEADER) - 1);
+        out += sizeof(Y4M_FRAME_HEADER) - 1;
+        for (uint16_t i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; i++)
+            *out++ = y4m_levels[stream->pixels[i]];
+    }
+    else
+    {
+        if (stream->changed_only)
+        {
+            for (uint8_t i = 0; i < 4; i++)
+                *out++ = frame >> (8 * i);
+        }
+        for (uint16_t i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; i += 8)
+        {
+            uint8_t byte = 0;
+            for (uint8_t bit = 0; bit < 8; bit++)
+                byte = (byte << 1) | (stream->pixels[i + bit] != 0);
+            *out++ = byte;
+        }
+    }
+
+    stream->used = out - stream->buffer;
+    stream->frames++;
+    return !stream->error;
+}
+
+int8_t stream_close(struct stream *stream)
+{
+    if (stream->buffer)
+    {
+        stream_flush(stream);
+        free(stream->buffer);
+        stream->buffer = NULL;
+    }
+    if (stream->fd > 1)
+        close(stream->fd);
+    return !stream->error;
+}
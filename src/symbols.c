@@ -0,0 +1,114 @@
+#include "symbols.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Labels further than this from an address are not used to name it */
+#define SYMBOL_MAX_OFFSET 0x100
+
+static int compare_symbols(const void *a, const void *b)
+{
+    return ((const struct symbol *)a)->address - ((const struct symbol *)b)->address;
+}
+
+static int8_t parse_address(const char *token, uint16_t *address)
+{
+    char *end;
+    unsigned long value;
+
+    if (token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+        value = strtoul(token + 2, &end, 16);
+    else if (isdigit((unsigned char)token[0]))
+        value = strtoul(token, &end, 10);
+    else
+        return 0;
+
+    if (*end || value > 0xFFFF)
+        return 0;
+    *address = value;
+    return 1;
+}
+
+int8_t symbols_load(struct symbols *symbols, const char *filename)
+{
+    symbols->entries = NULL;
+    symbols->count = 0;
+
+    FILE *file = fopen(filename, "r");
+    if (!file)
+        return 0;
+
+    uint32_t capacity = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        const char *name = NULL;
+        uint16_t address = 0;
+        int8_t has_address = 0;
+
+        for (char *token = strtok(line, " \t\r\n=:,"); token; token = strtok(NULL, " \t\r\n=:,"))
+        {
+            if (token[0] == '#')
+                break;
+            if (!has_address && parse_address(token, &address))
+                has_address = 1;
+            else if (!name && (isalpha((unsigned char)token[0]) || token[0] == '_'))
+                name = token;
+        }
+
+        if (!name || !has_address)
+            continue;
+
+        if (symbols->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            struct symbol *entries = realloc(symbols->entries, capacity * sizeof(*entries));
+            if (!entries)
+                break;
+            symbols->entries = entries;
+        }
+
+        struct symbol *symbol = &symbols->entries[symbols->count++];
+        symbol->address = address;
+        snprintf(symbol->name, sizeof(symbol->name), "%s", name);
+    }
+    fclose(file);
+
+    qsort(symbols->entries, symbols->count, sizeof(*symbols->entries), compare_symbols);
+    return 1;
+}
+
+void symbols_free(struct symbols *symbols)
+{
+    free(symbols->entries);
+    symbols->entries = NULL;
+    symbols->count = 0;
+}
+
+void symbols_format(const struct symbols *symbols, uint16_t address, char *buf, size_t size)
+{
+    /* Find the last label at or before the address */
+    const struct symbol *found = NULL;
+    uint32_t lo = 0, hi = symbols ? symbols->count : 0;
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (symbols->entries[mid].address <= address)
+        {
+            found = &symbols->entries[mid];
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (!found || address - found->address > SYMBOL_MAX_OFFSET)
+        snprintf(buf, size, "0x%03x", address);
+    else if (found->address == address)
+        snprintf(buf, size, "%s", found->name);
+    else
+        snprintf(buf, size, "%s+0x%x", found->name, address - found->address);
+}
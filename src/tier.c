@@ -0,0 +1,431 @@
+#include "tier.h"
+#include "opcode.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Promoted handlers, only for the instructions worth predecoding. Anything that can end the run (00FD halting,
+ * unknown opcodes, a 2NNN stack overflow) goes back through chip8_decode_and_execute, so it ends exactly as in the
+ * reference engine */
+
+static void tier_interpret(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8_decode_and_execute(chip8, op->opcode);
+}
+
+static void tier_00E0(struct chip8 *chip8, const struct tier_op *op)
+{
+    (void)op;
+    chip8_clear_display(chip8);
+}
+
+static void tier_00EE(struct chip8 *chip8, const struct tier_op *op)
+{
+    (void)op;
+    chip8->SP--;
+    chip8->PC = chip8->stack[chip8->SP];
+}
+
+static void tier_1NNN(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->PC = op->opcode & 0xFFF;
+}
+
+static void tier_2NNN(struct chip8 *chip8, const struct tier_op *op)
+{
+    if (chip8->SP >= STACK_SIZE)
+    {
+        chip8_decode_and_execute(chip8, op->opcode);
+        return;
+    }
+
+    chip8->stack[chip8->SP] = chip8->PC;
+    chip8->SP++;
+    chip8->PC = op->opcode & 0xFFF;
+}
+
+static void tier_3XNN(struct chip8 *chip8, const struct tier_op *op)
+{
+    if (chip8->V[op->x] == (op->opcode & 0xFF))
+        chip8_skip(chip8);
+}
+
+static void tier_4XNN(struct chip8 *chip8, const struct tier_op *op)
+{
+    if (chip8->V[op->x] != (op->opcode & 0xFF))
+        chip8_skip(chip8);
+}
+
+static void tier_5XY0(struct chip8 *chip8, const struct tier_op *op)
+{
+    if (chip8->V[op->x] == chip8->V[op->y])
+        chip8_skip(chip8);
+}
+
+static void tier_6XNN(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->V[op->x] = op->opcode & 0xFF;
+}
+
+static void tier_7XNN(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->V[op->x] += op->opcode & 0xFF;
+}
+
+static void tier_8XY0(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->V[op->x] = chip8->V[op->y];
+}
+
+static void tier_8XY1(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->V[op->x] |= chip8->V[op->y];
+    chip8->V[0xF] = 0;
+}
+
+static void tier_8XY2(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->V[op->x] &= chip8->V[op->y];
+    chip8->V[0xF] = 0;
+}
+
+static void tier_8XY3(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->V[op->x] ^= chip8->V[op->y];
+    chip8->V[0xF] = 0;
+}
+
+static void tier_8XY4(struct chip8 *chip8, const struct tier_op *op)
+{
+    uint16_t sum = chip8->V[op->x] + chip8->V[op->y];
+    chip8->V[op->x] = sum;
+    chip8->V[0xF] = (sum >= 0xFF) ? 1 : 0;
+}
+
+static void tier_8XY5(struct chip8 *chip8, const struct tier_op *op)
+{
+    uint8_t temp = chip8->V[op->x];
+    chip8->V[op->x] -= chip8->V[op->y];
+    chip8->V[0xF] = (temp >= chip8->V[op->y]) ? 1 : 0;
+}
+
+static void tier_8XY6(struct chip8 *chip8, const struct tier_op *op)
+{
+    uint8_t temp = chip8->V[op->y];
+    chip8->V[op->x] = temp >> 1;
+    chip8->V[0xF] = temp & 0x1;
+}
+
+static void tier_8XY7(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->V[op->x] = chip8->V[op->y] - chip8->V[op->x];
+    chip8->V[0xF] = (chip8->V[op->y] >= chip8->V[op->x]) ? 1 : 0;
+}
+
+static void tier_8XYE(struct chip8 *chip8, const struct tier_op *op)
+{
+    uint8_t temp = chip8->V[op->y];
+    chip8->V[op->x] = temp << 1;
+    chip8->V[0xF] = temp >> 7;
+}
+
+static void tier_9XY0(struct chip8 *chip8, const struct tier_op *op)
+{
+    if (chip8->V[op->x] != chip8->V[op->y])
+        chip8_skip(chip8);
+}
+
+static void tier_ANNN(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->I = op->opcode & 0xFFF;
+}
+
+static void tier_BNNN(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->PC = (op->opcode & 0xFFF) + chip8->V[0];
+}
+
+static void tier_CXNN(struct chip8 *chip8, const struct tier_op *op)
+{
+    uint8_t r = chip8_random(chip8);
+    chip8->V[op->x] = r & (op->opcode & 0xFF);
+}
+
+static void tier_DXYN(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->draw_flag = 1;
+    chip8->V[0xF] = chip8_draw_sprite(chip8, chip8->V[op->x], chip8->V[op->y], op->opcode & 0xF);
+}
+
+static void tier_EX9E(struct chip8 *chip8, const struct tier_op *op)
+{
+    if (chip8_key_down(chip8, chip8->V[op->x]))
+        chip8_skip(chip8);
+}
+
+static void tier_EXA1(struct chip8 *chip8, const struct tier_op *op)
+{
+    if (!chip8_key_down(chip8, chip8->V[op->x]))
+        chip8_skip(chip8);
+}
+
+static void tier_FX07(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->V[op->x] = chip8->delay_timer;
+}
+
+static void tier_FX15(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->delay_timer = chip8->V[op->x];
+}
+
+static void tier_FX18(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->sound_timer = chip8->V[op->x];
+}
+
+static void tier_FX1E(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->I += chip8->V[op->x];
+    chip8->V[0xF] = chip8->I + chip8->V[op->x] > 0xFFF ? 1 : 0;
+}
+
+static void tier_FX29(struct chip8 *chip8, const struct tier_op *op)
+{
+    chip8->I = FONTSET_START_ADDRESS + (5 * chip8->V[op->x]);
+}
+
+static void tier_FX65(struct chip8 *chip8, const struct tier_op *op)
+{
+    for (uint8_t i = 0; i <= op->x; i++)
+        chip8->V[i] = chip8->memory[chip8_address(chip8, chip8->I + i)];
+    chip8->I += op->x + 1;
+}
+
+static void tier_written(struct tier *tier, struct chip8 *chip8, uint16_t address, uint16_t opcode);
+
+/* FX33, FX55 and 5XY2 run interpreted, then demote whatever they wrote over */
+static void tier_store(struct chip8 *chip8, const struct tier_op *op)
+{
+    uint16_t address = chip8->I;
+    uint16_t opcode = op->opcode;
+
+    chip8_decode_and_execute(chip8, opcode);
+    tier_written(chip8->tier, chip8, address, opcode);
+}
+
+/* @return Number of bytes a store instruction writes from I, 0 for any other instruction */
+static uint8_t tier_store_length(uint16_t opcode)
+{
+    uint8_t x = (opcode >> 8) & 0xF;
+    uint8_t y = (opcode >> 4) & 0xF;
+
+    if ((opcode & 0xF0FF) == 0xF033)
+        return 3;
+    if ((opcode & 0xF0FF) == 0xF055)
+        return x + 1;
+    if ((opcode & 0xF00F) == 0x5002)
+        return (x > y ? x - y : y - x) + 1;
+    return 0;
+}
+
+/* Handler of a promoted instruction, and whether the block ends with it. Blocks end on every instruction that
+ * can leave the straight line: jumps, calls, returns, skips, FX0A (which repeats itself while it waits) and
+ * F000 NNNN (its second word is data). The stores end a block too, they may overwrite the rest of it */
+static tier_handler tier_select(uint16_t opcode, uint8_t *last)
+{
+    *last = 0;
+    switch (chip8_op_classify(opcode))
+    {
+    case OP_00E0:
+        return tier_00E0;
+    case OP_00EE:
+        *last = 1;
+        return tier_00EE;
+    case OP_1NNN:
+        *last = 1;
+        return tier_1NNN;
+    case OP_2NNN:
+        *last = 1;
+        return tier_2NNN;
+    case OP_3XNN:
+        *last = 1;
+        return tier_3XNN;
+    case OP_4XNN:
+        *last = 1;
+        return tier_4XNN;
+    case OP_5XY0:
+        *last = 1;
+        return tier_5XY0;
+    case OP_6XNN:
+        return tier_6XNN;
+    case OP_7XNN:
+        return tier_7XNN;
+    case OP_8XY0:
+        return tier_8XY0;
+    case OP_8XY1:
+        return tier_8XY1;
+    case OP_8XY2:
+        return tier_8XY2;
+    case OP_8XY3:
+        return tier_8XY3;
+    case OP_8XY4:
+        return tier_8XY4;
+    case OP_8XY5:
+        return tier_8XY5;
+    case OP_8XY6:
+        return tier_8XY6;
+    case OP_8XY7:
+        return tier_8XY7;
+    case OP_8XYE:
+        return tier_8XYE;
+    case OP_9XY0:
+        *last = 1;
+        return tier_9XY0;
+    case OP_ANNN:
+        return tier_ANNN;
+    case OP_BNNN:
+        *last = 1;
+        return tier_BNNN;
+    case OP_CXNN:
+        return tier_CXNN;
+    case OP_DXYN:
+    case OP_DXY0:
+        return tier_DXYN;
+    case OP_EX9E:
+        *last = 1;
+        return tier_EX9E;
+    case OP_EXA1:
+        *last = 1;
+        return tier_EXA1;
+    case OP_FX07:
+        return tier_FX07;
+    case OP_FX15:
+        return tier_FX15;
+    case OP_FX18:
+        return tier_FX18;
+    case OP_FX1E:
+        return tier_FX1E;
+    case OP_FX29:
+        return tier_FX29;
+    case OP_FX65:
+        return tier_FX65;
+    case OP_FX33:
+    case OP_FX55:
+    case OP_5XY2:
+        *last = 1;
+        return tier_store;
+    case OP_00FD:
+    case OP_FX0A:
+    case OP_F000:
+    case OP_UNKNOWN:
+        *last = 1;
+        return tier_interpret;
+    default:
+        return tier_interpret;
+    }
+}
+
+/* Predecode the block entered at address, up to the first instruction that ends it or an address that already
+ * belongs to a promoted block */
+static void tier_promote(struct tier *tier, const struct chip8 *chip8, uint16_t address)
+{
+    uint16_t pc = address;
+    uint8_t last = 0;
+
+    for (uint16_t i = 0; i < TIER_BLOCK_LENGTH && !last; i++, pc += 2)
+    {
+        struct tier_op *op = &tier->ops[pc];
+        if (i && op->handler)
+            break;
+
+        op->opcode = chip8_fetch(chip8, pc);
+        op->x = (op->opcode >> 8) & 0xF;
+        op->y = (op->opcode >> 4) & 0xF;
+        op->block = address;
+        op->handler = tier_select(op->opcode, &last);
+    }
+    tier->hot[address] = 0;
+    tier->promotions++;
+}
+
+/* Send the block entered at address back to the interpreter */
+static void tier_demote(struct tier *tier, uint16_t address)
+{
+    uint16_t pc = address;
+
+    for (uint16_t i = 0; i < TIER_BLOCK_LENGTH; i++, pc += 2)
+    {
+        struct tier_op *op = &tier->ops[pc];
+        if (!op->handler || op->block != address)
+            break;
+        op->handler = NULL;
+    }
+    tier->demotions++;
+}
+
+/* Demote every block a store instruction, run with I at address, wrote over */
+static void tier_written(struct tier *tier, struct chip8 *chip8, uint16_t address, uint16_t opcode)
+{
+    uint8_t length = tier_store_length(opcode);
+
+    for (uint8_t i = 0; i < length; i++)
+    {
+        /* The byte is the first or the second half of an instruction */
+        uint16_t written = chip8_address(chip8, address + i);
+        uint16_t starts[2] = {written, (uint16_t)(written - 1)};
+
+        for (uint8_t j = 0; j < 2; j++)
+        {
+            if (tier->ops[starts[j]].handler)
+                tier_demote(tier, tier->ops[starts[j]].block);
+        }
+    }
+}
+
+void tier_cycle(struct chip8 *chip8)
+{
+    struct tier *tier = chip8->tier;
+    if (!tier)
+    {
+        tier = chip8->tier = calloc(1, sizeof(*tier));
+        if (!tier)
+        {
+            fprintf(stderr, "Error: not enough memory for the tiered engine\n");
+            exit(EXIT_FAILURE);
+        }
+        /* No instruction ran yet, so the first one is an entry */
+        tier->fallthrough = chip8->PC + 1;
+    }
+
+    uint16_t pc = chip8->PC;
+    uint16_t opcode = chip8_fetch(chip8, pc);
+    const struct tier_op *op = &tier->ops[pc];
+
+    if (op->handler)
+    {
+        /* Memory changed without a store instruction, e.g. a machine restored from a copy */
+        if (op->opcode != opcode)
+            tier_demote(tier, op->block);
+    }
+    else if (pc != tier->fallthrough && ++tier->hot[pc] >= TIER_THRESHOLD)
+        tier_promote(tier, chip8, pc);
+
+    chip8->PC = pc + 2;
+    if (op->handler)
+    {
+        op->handler(chip8, op);
+        return;
+    }
+
+    tier->fallthrough = pc + 2;
+    uint16_t address = chip8->I;
+    chip8_decode_and_execute(chip8, opcode);
+    if (tier_store_length(opcode))
+        tier_written(tier, chip8, address, opcode);
+}
+
+void tier_release(struct chip8 *chip8)
+{
+    free(chip8->tier);
+    chip8->tier = NULL;
+}
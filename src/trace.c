@@ -0,0 +1,141 @@
+#include "trace.h"
+#include "chip8.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define write _write
+#define close _close
+#define TRACE_OPEN_FLAGS (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY)
+#else
+#include <unistd.h>
+#define TRACE_OPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC)
+#endif
+
+_Static_assert(sizeof(struct trace_record) == 12, "trace records must stay packed");
+
+/* Trace dumped from the signal handlers */
+static struct trace *installed_trace;
+static volatile sig_atomic_t dump_requested;
+
+int8_t trace_init(struct trace *trace, uint32_t records, const char *path)
+{
+    memset(trace, 0, sizeof(*trace));
+
+    uint32_t capacity = 1;
+    while (capacity < records && capacity < (1u << 31))
+        capacity <<= 1;
+
+    trace->records = malloc(capacity * sizeof(*trace->records));
+    if (!trace->records)
+        return 0;
+
+    trace->mask = capacity - 1;
+    strncpy(trace->path, path, sizeof(trace->path) - 1);
+    return 1;
+}
+
+void trace_free(struct trace *trace)
+{
+    if (installed_trace == trace)
+        installed_trace = NULL;
+    free(trace->records);
+    trace->records = NULL;
+}
+
+static int8_t write_all(int fd, const void *data, size_t size)
+{
+    const char *bytes = data;
+    while (size > 0)
+    {
+        int written = write(fd, bytes, size > 0x40000000 ? 0x40000000 : size);
+        if (written <= 0)
+            return 0;
+        bytes += written;
+        size -= written;
+    }
+    return 1;
+}
+
+int8_t trace_dump(const struct trace *trace)
+{
+    int fd = open(trace->path, TRACE_OPEN_FLAGS, 0644);
+    if (fd < 0)
+        return 0;
+
+    struct trace_header header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(struct trace_record);
+    header.count = trace->count;
+    header.reserved = 0;
+    header.cycle = trace->cycle ? trace->cycle - 1 : 0;
+
+    /* Oldest record is at head once the ring has wrapped */
+    uint32_t capacity = trace->mask + 1;
+    uint32_t oldest = trace->count < capacity ? 0 : trace->head;
+    uint32_t first = capacity - oldest < trace->count ? capacity - oldest : trace->count;
+
+    int8_t ok = write_all(fd, &header, sizeof(header)) &&
+                write_all(fd, trace->records + oldest, first * sizeof(struct trace_record)) &&
+                write_all(fd, trace->records, (trace->count - first) * sizeof(struct trace_record));
+    close(fd);
+    return ok;
+}
+
+static void crash_handler(int signal_number)
+{
+    if (installed_trace)
+        trace_dump(installed_trace);
+
+    /* Let the default action terminate the process */
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+#ifdef SIGUSR1
+static void request_handler(int signal_number)
+{
+    (void)signal_number;
+    dump_requested = 1;
+}
+#endif
+
+void trace_install_handlers(struct trace *trace)
+{
+    installed_trace = trace;
+
+    signal(SIGSEGV, crash_handler);
+    signal(SIGILL, crash_handler);
+    signal(SIGFPE, crash_handler);
+    signal(SIGABRT, crash_handler);
+#ifdef SIGBUS
+    signal(SIGBUS, crash_handler);
+#endif
+#ifdef SIGUSR1
+    signal(SIGUSR1, request_handler);
+#endif
+}
+
+void trace_poll(struct trace *trace)
+{
+    if (!dump_requested)
+        return;
+
+    dump_requested = 0;
+    trace_dump(trace);
+}
+
+void trace_fault(struct chip8 *chip8, uint16_t opcode)
+{
+    if (!chip8->trace)
+        return;
+
+    /* PC already points past the faulting instruction */
+    trace_record(chip8->trace, chip8->PC - 2, opcode, chip8->I, chip8->V);
+    trace_dump(chip8->trace);
+}
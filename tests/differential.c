@@ -0,0 +1,304 @@
+#include "chip8.h"
+#include "engine.h"
+#include "input_script.h"
+#include "opcode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Lockstep differential checker: runs a reference and a candidate engine on the same ROM, seed and
+ * input script, and reports the first instruction after which their machine states differ */
+
+#define DEFAULT_CYCLES 10000000
+#define DEFAULT_CYCLES_PER_FRAME 12
+/* Minimum instructions between two saved states to bisect from */
+#define CHECKPOINT_INTERVAL 4096
+
+struct instance
+{
+    struct chip8 chip8;
+    uint32_t cursor; /* Next input script event */
+};
+
+struct checker
+{
+    const struct chip8_engine *reference;
+    const struct chip8_engine *candidate;
+    struct input_script script;
+    uint32_t cycles_per_frame;
+};
+
+/* Emulate one instruction, with input and timers driven by the instruction count only */
+static void step(const struct checker *checker, const struct chip8_engine *engine, struct instance *instance,
+                 uint64_t cycle)
+{
+    instance->cursor = input_script_apply(&checker->script, instance->cursor, cycle, &instance->chip8);
+    engine->cycle(&instance->chip8);
+    if ((cycle + 1) % checker->cycles_per_frame == 0)
+        chip8_update_timers(&instance->chip8);
+}
+
+static void step_both(const struct checker *checker, struct instance *reference, struct instance *candidate,
+                      uint64_t cycle)
+{
+    step(checker, checker->reference, reference, cycle);
+    step(checker, checker->candidate, candidate, cycle);
+}
+
+#define COMPARE_FIELD(name, field)                                                                                     \
+    if (a->field != b->field)                                                                                          \
+    {                                                                                                                  \
+        snprintf(detail, size, "%s: reference 0x%x, candidate 0x%x", name, (unsigned)a->field, (unsigned)b->field);   \
+        return 0;                                                                                                      \
+    }
+
+#define COMPARE_ARRAY(name, field, count)                                                                              \
+    for (uint32_t i = 0; i < (count); i++)                                                                             \
+    {                                                                                                                  \
+        if (a->field[i] != b->field[i])                                                                                \
+        {                                                                                                              \
+            snprintf(detail, size, "%s[0x%x]: reference 0x%x, candidate 0x%x", name, i, (unsigned)a->field[i],       \
+                     (unsigned)b->field[i]);                                                                           \
+            return 0;                                                                                                  \
+        }                                                                                                              \
+    }
+
+/* Compare the full machine state; the opcode field is engine scratch space and is skipped
+ * @return 0 and a description of the first difference if the states differ */
+static int8_t compare_state(const struct chip8 *a, const struct chip8 *b, char *detail, size_t size)
+{
+    /* Fast path for the common case */
+    if (a->PC == b->PC && a->I == b->I && a->SP == b->SP && a->delay_timer == b->delay_timer &&
+        a->sound_timer == b->sound_timer && a->draw_flag == b->draw_flag && a->rng == b->rng &&
+        !memcmp(a->V, b->V, sizeof(a->V)) && !memcmp(a->stack, b->stack, sizeof(a->stack)) &&
+        a->keys_down == b->keys_down && a->keys_released == b->keys_released && a->key_wait == b->key_wait &&
+        a->halted == b->halted && a->memory_size == b->memory_size &&
+        !memcmp(a->memory, b->memory, a->memory_size) && !memcmp(a->rpl, b->rpl, sizeof(a->rpl)) &&
+        a->display.hires == b->display.hires && a->display.plane_mask == b->display.plane_mask &&
+        !memcmp(a->display.planes, b->display.planes, sizeof(a->display.planes)) && a->pitch == b->pitch &&
+        a->audio_pattern_loaded == b->audio_pattern_loaded && a->audio_flag == b->audio_flag &&
+        !memcmp(a->audio_pattern, b->audio_pattern, sizeof(a->audio_pattern)))
+        return 1;
+
+    COMPARE_FIELD("PC", PC);
+    COMPARE_FIELD("I", I);
+    COMPARE_FIELD("SP", SP);
+    COMPARE_ARRAY("V", V, REGISTER_COUNT);
+    COMPARE_ARRAY("stack", stack, STACK_SIZE);
+    COMPARE_FIELD("delay_timer", delay_timer);
+    COMPARE_FIELD("sound_timer", sound_timer);
+    COMPARE_FIELD("draw_flag", draw_flag);
+    COMPARE_FIELD("rng", rng);
+    COMPARE_FIELD("keys_down", keys_down);
+    COMPARE_FIELD("keys_released", keys_released);
+    COMPARE_FIELD("key_wait", key_wait);
+    COMPARE_FIELD("halted", halted);
+    COMPARE_FIELD("memory_size", memory_size);
+    COMPARE_ARRAY("memory", memory, a->memory_size);
+    COMPARE_ARRAY("rpl", rpl, RPL_COUNT);
+    COMPARE_FIELD("hires", display.hires);
+    COMPARE_FIELD("plane_mask", display.plane_mask);
+    for (uint8_t plane = 0; plane < PLANE_COUNT; plane++)
+    {
+        for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++)
+        {
+            for (uint8_t word = 0; word < DISPLAY_WORDS; word++)
+            {
+                if (a->display.planes[plane][y][word] != b->display.planes[plane][y][word])
+                {
+                    snprintf(detail, size,
+                             "display plane %u row %u pixels %u-%u: reference 0x%016llx, candidate 0x%016llx", plane,
+                             y, word * 64, word * 64 + 63, (unsigned long long)a->display.planes[plane][y][word],
+                             (unsigned long long)b->display.planes[plane][y][word]);
+                    return 0;
+                }
+            }
+        }
+    }
+    COMPARE_FIELD("pitch", pitch);
+    COMPARE_FIELD("audio_pattern_loaded", audio_pattern_loaded);
+    COMPARE_FIELD("audio_flag", audio_flag);
+    COMPARE_ARRAY("audio_pattern", audio_pattern, AUDIO_PATTERN_SIZE);
+    return 1;
+}
+
+static void print_registers(const char *label, const struct chip8 *chip8)
+{
+    printf("  %-9s PC=0x%03x I=0x%03x SP=%u DT=%u ST=%u V=", label, chip8->PC, chip8->I, chip8->SP,
+           chip8->delay_timer, chip8->sound_timer);
+    for (uint8_t i = 0; i < REGISTER_COUNT; i++)
+        printf("%02x%s", chip8->V[i], i + 1 < REGISTER_COUNT ? " " : "\n");
+}
+
+/* Find the first step that makes the engines diverge, by bisecting over replays from a checkpoint
+ * @param start States at the checkpoint, known to match
+ * @param length Steps since the checkpoint, the states after all of them are known to differ */
+static void report_divergence(const struct checker *checker, const struct instance start[2], uint64_t first_cycle,
+                              uint64_t length)
+{
+    struct instance reference, candidate;
+    char detail[128];
+
+    /* Invariant: equal after lo steps, different after hi steps */
+    uint64_t lo = 0, hi = length;
+    while (hi - lo > 1)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        reference = start[0];
+        candidate = start[1];
+        for (uint64_t i = 0; i < mid; i++)
+            step_both(checker, &reference, &candidate, first_cycle + i);
+
+        if (compare_state(&reference.chip8, &candidate.chip8, detail, sizeof(detail)))
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    reference = start[0];
+    candidate = start[1];
+    for (uint64_t i = 0; i < lo; i++)
+        step_both(checker, &reference, &candidate, first_cycle + i);
+
+    uint64_t cycle = first_cycle + lo;
+    uint16_t pc = reference.chip8.PC;
+    uint16_t opcode = chip8_fetch(&reference.chip8, pc);
+
+    printf("DIVERGED at instruction %llu (frame %llu)\n", (unsigned long long)cycle,
+           (unsigned long long)(cycle / checker->cycles_per_frame));
+    printf("  opcode    0x%04x (%s) at 0x%03x\n", opcode, chip8_op_name(chip8_op_classify(opcode)), pc);
+    print_registers("before", &reference.chip8);
+
+    step_both(checker, &reference, &candidate, cycle);
+    compare_state(&reference.chip8, &candidate.chip8, detail, sizeof(detail));
+    printf("  first difference: %s\n", detail);
+    print_registers(checker->reference->name, &reference.chip8);
+    print_registers(checker->candidate->name, &candidate.chip8);
+}
+
+/* Free the engine state of both instances, the checkpoint and bisection copies share it */
+static void release_instances(const struct checker *checker, struct instance instances[2])
+{
+    chip8_engine_release(checker->reference, &instances[0].chip8);
+    chip8_engine_release(checker->candidate, &instances[1].chip8);
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options] <path/to/rom>\n"
+           "Options:\n"
+           "  -r <engine>   Reference engine (default: switch)\n"
+           "  -c <engine>   Candidate engine (default: table)\n"
+           "  -n <cycles>   Instructions to run (default: %d)\n"
+           "  -e <n>        Compare every n instructions, bisect on mismatch (default: 1)\n"
+           "  -s <seed>     CXNN random seed (default: 1)\n"
+           "  -i <script>   Input script, see include/input_script.h\n"
+           "  -f <cycles>   Instructions per 60 Hz timer tick (default: %d)\n"
+           "Engines:\n",
+           program, DEFAULT_CYCLES, DEFAULT_CYCLES_PER_FRAME);
+
+    const struct chip8_engine *engine;
+    for (uint32_t i = 0; (engine = chip8_engine_get(i)); i++)
+        printf("  %-12s %s\n", engine->name, engine->description);
+}
+
+int main(int argc, char **argv)
+{
+    struct checker checker = {chip8_engine_find("switch"), chip8_engine_find("table"), {NULL, 0},
+                              DEFAULT_CYCLES_PER_FRAME};
+    uint64_t num_cycles = DEFAULT_CYCLES;
+    uint64_t every = 1;
+    uint32_t seed = 1;
+    const char *script_file = NULL;
+
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-' && strlen(argv[arg]) == 2; arg += 2)
+    {
+        const char *value = argv[arg + 1];
+        switch (argv[arg][1])
+        {
+        case 'r':
+            checker.reference = chip8_engine_find(value);
+            break;
+        case 'c':
+            checker.candidate = chip8_engine_find(value);
+            break;
+        case 'n':
+            num_cycles = strtoull(value, NULL, 10);
+            break;
+        case 'e':
+            every = strtoull(value, NULL, 10);
+            break;
+        case 's':
+            seed = strtoul(value, NULL, 0);
+            break;
+        case 'i':
+            script_file = value;
+            break;
+        case 'f':
+            checker.cycles_per_frame = strtoul(value, NULL, 10);
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (arg + 1 != argc || !checker.reference || !checker.candidate || !every || !checker.cycles_per_frame)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (script_file && !input_script_load(&checker.script, script_file, checker.cycles_per_frame))
+    {
+        fprintf(stderr, "Error: failed to load input script %s\n", script_file);
+        return EXIT_FAILURE;
+    }
+
+    /* Both instances start from the same state */
+    static struct instance instances[2];
+    chip8_init(&instances[0].chip8, START_ADDRESS);
+    chip8_load_rom(&instances[0].chip8, argv[arg]);
+    chip8_seed(&instances[0].chip8, seed);
+    instances[1] = instances[0];
+
+    /* Compare every `every` instructions, and save a checkpoint on a compare point
+     * at least CHECKPOINT_INTERVAL instructions apart */
+    uint64_t checkpoint_interval = (CHECKPOINT_INTERVAL + every - 1) / every * every;
+    static struct instance checkpoint[2];
+    uint64_t checkpoint_cycle = 0;
+    memcpy(checkpoint, instances, sizeof(checkpoint));
+
+    /* Stop once both halted on 00FD, the states compared equal so far */
+    char detail[128];
+    uint64_t cycle = 0;
+    while (cycle < num_cycles && !instances[0].chip8.halted)
+    {
+        uint64_t length = num_cycles - cycle < every ? num_cycles - cycle : every;
+
+        for (uint64_t i = 0; i < length; i++)
+            step_both(&checker, &instances[0], &instances[1], cycle + i);
+        cycle += length;
+
+        if (!compare_state(&instances[0].chip8, &instances[1].chip8, detail, sizeof(detail)))
+        {
+            report_divergence(&checker, checkpoint, checkpoint_cycle, cycle - checkpoint_cycle);
+            release_instances(&checker, instances);
+            input_script_free(&checker.script);
+            return EXIT_FAILURE;
+        }
+
+        if (cycle - checkpoint_cycle >= checkpoint_interval)
+        {
+            memcpy(checkpoint, instances, sizeof(checkpoint));
+            checkpoint_cycle = cycle;
+        }
+    }
+
+    printf("OK: %s and %s agree for %llu instructions%s\n", checker.reference->name, checker.candidate->name,
+           (unsigned long long)cycle, instances[0].chip8.halted ? ", until the program exited" : "");
+    release_instances(&checker, instances);
+    input_script_free(&checker.script);
+    return EXIT_SUCCESS;
+}
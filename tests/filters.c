@@ -0,0 +1,137 @@
+#include "filters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Display filter checker: runs every filter with every instruction set the CPU supports over random and
+ * sprite-like displays, compares the output with the scalar kernels and reports the time per frame */
+
+#define DEFAULT_FRAMES 2000
+static const uint32_t palette[FILTER_COLORS] = {0xFF101820, 0xFF33FF66, 0xFFAA4400, 0xFFFFEE88};
+#define MAX_PIXELS (FILTER_MAX_SCALE * FILTER_MAX_SCALE * DISPLAY_WIDTH * DISPLAY_HEIGHT)
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+/* Mix of noise, solid blocks and diagonals in all four colors so every Scale2x/Scale3x rule gets hit */
+static void make_display(uint8_t *display, uint32_t frame)
+{
+    for (uint16_t y = 0; y < DISPLAY_HEIGHT; y++)
+    {
+        for (uint16_t x = 0; x < DISPLAY_WIDTH; x++)
+        {
+            uint8_t pixel;
+            switch ((frame + x / 16) % 3)
+            {
+            case 0:
+                pixel = next_random() & 3;
+                break;
+            case 1:
+                pixel = ((x + y + frame) % 5) < 2;
+                break;
+            default:
+                pixel = (x / 4 + y / 3 + frame) & 1;
+                break;
+            }
+            display[y * DISPLAY_WIDTH + x] = pixel;
+        }
+    }
+}
+
+static double now_ms(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+/* Run a filter over the same frames with the current kernels
+ * @return milliseconds spent filtering */
+static double run(enum filter filter, uint32_t frames, uint32_t *out, uint32_t *checksums)
+{
+    static struct filter_state state;
+    static uint8_t display[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+    uint32_t pitch = DISPLAY_WIDTH * filter_scale(filter);
+
+    filter_init(&state, filter, palette);
+    random_state = 1;
+
+    double elapsed = 0;
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        make_display(display, frame);
+        double start = now_ms();
+        filter_apply(&state, display, out, pitch);
+        elapsed += now_ms() - start;
+
+        /* Keep the last frame for a full comparison, checksum the others */
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < pitch * DISPLAY_HEIGHT * filter_scale(filter); i++)
+            sum = sum * 31 + out[i];
+        checksums[frame] = sum;
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t frames = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_FRAMES;
+    if (!frames)
+    {
+        fprintf(stderr, "Usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+
+    static uint32_t expected[MAX_PIXELS], actual[MAX_PIXELS];
+    uint32_t *expected_sums = malloc(frames * sizeof(uint32_t));
+    uint32_t *actual_sums = malloc(frames * sizeof(uint32_t));
+    if (!expected_sums || !actual_sums)
+        return 2;
+
+    int failures = 0;
+    for (enum filter filter = 0; filter < FILTER_COUNT; filter++)
+    {
+        filter_select_isa(FILTER_ISA_SCALAR);
+        double scalar_ms = run(filter, frames, expected, expected_sums);
+        printf("%-9s scalar %7.2f us/frame\n", filter_name(filter), scalar_ms * 1000.0 / frames);
+
+        for (enum filter_isa isa = FILTER_ISA_SCALAR + 1; isa < FILTER_ISA_COUNT; isa++)
+        {
+            if (!filter_select_isa(isa))
+            {
+                printf("%-9s %-6s unsupported\n", filter_name(filter), filter_isa_name(isa));
+                continue;
+            }
+
+            double ms = run(filter, frames, actual, actual_sums);
+            uint32_t pixels = DISPLAY_WIDTH * DISPLAY_HEIGHT * filter_scale(filter) * filter_scale(filter);
+            uint32_t frame = 0;
+            while (frame < frames && expected_sums[frame] == actual_sums[frame])
+                frame++;
+
+            if (frame < frames || memcmp(expected, actual, pixels * sizeof(uint32_t)))
+            {
+                printf("%-9s %-6s FAIL: output differs from scalar at frame %u\n", filter_name(filter),
+                       filter_isa_name(isa), frame);
+                failures++;
+                continue;
+            }
+            printf("%-9s %-6s %7.2f us/frame (%.1fx)\n", filter_name(filter), filter_isa_name(isa),
+                   ms * 1000.0 / frames, ms > 0 ? scalar_ms / ms : 0);
+        }
+    }
+
+    free(expected_sums);
+    free(actual_sums);
+    if (failures)
+        printf("%d filter kernels differ from scalar\n", failures);
+    return failures ? 1 : 0;
+}
@@ -1,33 +1,24 @@
 #include "chip8.h"
+#include "engine.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-#define NUM_CYCLES 1000000000
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
-void test_chip8_fptr_cycle(struct chip8 *chip8)
-{
-    /* Fetch opcode */
-    chip8->opcode = chip8->memory[chip8->PC];
-    chip8->opcode <<= 8;
-    chip8->opcode |= chip8->memory[chip8->PC + 1];
-
-    /* Point to next opcode */
-    chip8->PC += 2;
-
-    /* Decode and execute - index with opcode group id (first nibble) */
-    chip8->main_table[(chip8->opcode >> 12) & 0xF](chip8);
-
-    /* Set released keys to idle */
-    chip8_reset_released_keys(chip8);
-}
+/* Default number of emulated instructions per run, override with -n */
+#define NUM_CYCLES 50000000
 
 void test_chip8_switch_cycle(struct chip8 *chip8)
 {
     /* Fetch opcode */
-    uint16_t opcode = chip8->memory[chip8->PC];
-    opcode <<= 8;
-    opcode |= chip8->memory[chip8->PC + 1];
+    uint16_t opcode = chip8_fetch(chip8, chip8->PC);
 
     uint8_t group_id = (opcode >> 12) & 0xF;
 
@@ -72,7 +63,7 @@ void test_chip8_switch_cycle(struct chip8 *chip8)
     case 0x2:
         if (chip8->SP >= STACK_SIZE)
         {
-            printf("Stack overflow detected. Terminating program.\n");
+            fprintf(stderr, "Stack overflow detected. Terminating program.\n");
             exit(EXIT_FAILURE);
         }
 
@@ -217,77 +208,32 @@ void test_chip8_switch_cycle(struct chip8 *chip8)
 
     /* CXNN */
     case 0xC: {
-        uint8_t r = rand();
+        uint8_t r = chip8_random(chip8);
 
         chip8->V[x] = r & nn;
     }
     break;
 
     /* DXYN */
-    case 0xD: {
+    case 0xD:
         chip8->draw_flag = 1;
-        uint8_t x_pos = chip8->V[x];
-        uint8_t y_pos = chip8->V[y];
-
-        chip8->V[0xF] = 0;
-        /* Draw sprite from address in I to N */
-        for (uint8_t row = 0; row < n; row++)
-        {
-            /* Stop drawing if bottom edge is reached */
-            if (y_pos + row >= DISPLAY_HEIGHT)
-                break;
-
-            /* Extract byte at current row */
-            uint8_t sprite_byte = chip8->memory[chip8->I + row];
-
-            /* Iterate over extracted byte */
-            for (uint8_t col = 0; col < 8; col++)
-            {
-                /* Stop drawing if right edge is reached */
-                if (x_pos + col >= DISPLAY_WIDTH)
-                    break;
-
-                /* Extract current bit */
-                uint8_t sprite_pixel = (sprite_byte >> (7 - col)) & 0x1;
-                /* Get current pixel value from display buffer */
-                uint8_t *display_pixel = &chip8->display[((y_pos + row) * DISPLAY_WIDTH) + (x_pos + col)];
-
-                /* Extracted bit from sprite is set */
-                if (sprite_pixel)
-                {
-                    /* Current pixel from display is set */
-                    if (*display_pixel)
-                        /* Collision: set VF to 1 */
-                        chip8->V[0xF] = 1;
-
-                    /* Set display pixel if it's currently 0, or unset it if it's currently 1 */
-                    *display_pixel ^= 1;
-                }
-            }
-        }
+        chip8->V[0xF] = chip8_draw_sprite(chip8, chip8->V[x], chip8->V[y], n);
         break;
-    }
 
     case 0xE:
         switch (nn)
         {
         /* EXA1 */
-        case 0xA1: {
-            uint8_t key = chip8->V[x];
-
-            if (chip8->keypad[key] != 1)
+        case 0xA1:
+            if (!chip8_key_down(chip8, chip8->V[x]))
                 chip8->PC += 2;
-        }
-        break;
+            break;
 
         /* EX9E */
-        case 0x9E: {
-            uint8_t key = chip8->V[x];
-
-            if (chip8->keypad[key] == 1)
+        case 0x9E:
+            if (chip8_key_down(chip8, chip8->V[x]))
                 chip8->PC += 2;
-        }
-        break;
+            break;
 
         default:
             /* Unknown opcode */
@@ -305,22 +251,11 @@ void test_chip8_switch_cycle(struct chip8 *chip8)
 
         /* FX0A */
         case 0xA: {
-            uint8_t key_released = 0;
-
-            for (uint8_t i = 0; i < KEY_COUNT; i++)
-            {
-                if (chip8->keypad[i] == 2)
-                {
-                    chip8->V[x] = i;
-                    key_released = 1;
-                    break;
-                }
-            }
-
-            if (!key_released)
-            {
+            int8_t key = chip8_key_wait(chip8);
+            if (key >= 0)
+                chip8->V[x] = key;
+            else
                 chip8->PC -= 2;
-            }
         }
         break;
 
@@ -355,13 +290,13 @@ void test_chip8_switch_cycle(struct chip8 *chip8)
         case 0x33: {
             uint8_t value = chip8->V[x];
 
-            chip8->memory[chip8->I + 2] = value % 10;
+            chip8->memory[chip8_address(chip8, chip8->I + 2)] = value % 10;
             value /= 10;
 
-            chip8->memory[chip8->I + 1] = value % 10;
+            chip8->memory[chip8_address(chip8, chip8->I + 1)] = value % 10;
             value /= 10;
 
-            chip8->memory[chip8->I] = value % 10;
+            chip8->memory[chip8_address(chip8, chip8->I)] = value % 10;
         }
         break;
 
@@ -369,7 +304,7 @@ void test_chip8_switch_cycle(struct chip8 *chip8)
         case 0x55:
             for (size_t i = 0; i <= x; i++)
             {
-                chip8->memory[chip8->I + i] = chip8->V[i];
+                chip8->memory[chip8_address(chip8, chip8->I + i)] = chip8->V[i];
             }
             /* TODO(nael): support legacy config/quirks */
             /* COSMAC-VIP specific */
@@ -381,7 +316,7 @@ void test_chip8_switch_cycle(struct chip8 *chip8)
 
             for (size_t i = 0; i <= x; i++)
             {
-                chip8->V[i] = chip8->memory[chip8->I + i];
+                chip8->V[i] = chip8->memory[chip8_address(chip8, chip8->I + i)];
             }
             /* TODO(nael): support legacy config/quirks */
             /* COSMAC-VIP specific */
@@ -398,38 +333,239 @@ void test_chip8_switch_cycle(struct chip8 *chip8)
         /* Unknown opcode */
         break;
     }
-    /* Set released keys to idle */
-    chip8_reset_released_keys(chip8);
 }
 
-int main(int argc, char **argv)
+/* Copy of the switch inlined into the cycle, benchmarked next to the engines of engine.h */
+static const struct chip8_engine switch_inline_engine = {"switch-inline", "switch inlined into the cycle",
+                                                         test_chip8_switch_cycle, NULL};
+
+/* Hardware counters read around each run */
+enum counter
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1D_MISSES,
+    COUNTER_L1I_MISSES,
+    COUNTER_COUNT
+};
+
+static const char *counter_names[COUNTER_COUNT] = {"cycles", "instructions", "branch-misses", "L1d-misses",
+                                                   "L1i-misses"};
+
+struct counters
+{
+    int fd[COUNTER_COUNT];
+    uint64_t value[COUNTER_COUNT];
+    /* 0 if the counter could not be opened or read */
+    uint8_t valid[COUNTER_COUNT];
+};
+
+#ifdef __linux__
+static int counter_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    /* Scale the counts if the PMU had to multiplex counters */
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cache_miss_config(uint64_t cache)
 {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+#endif
+
+/* Open every counter independently so that one unsupported event
+ * (common in VMs) does not take the others down with it */
+static void counters_open(struct counters *counters)
+{
+    memset(counters, 0, sizeof(*counters));
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        counters->fd[i] = -1;
+
+#ifdef __linux__
+    counters->fd[COUNTER_CYCLES] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters->fd[COUNTER_INSTRUCTIONS] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters->fd[COUNTER_BRANCH_MISSES] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters->fd[COUNTER_L1D_MISSES] =
+        counter_open(PERF_TYPE_HW_CACHE, cache_miss_config(PERF_COUNT_HW_CACHE_L1D));
+    counters->fd[COUNTER_L1I_MISSES] =
+        counter_open(PERF_TYPE_HW_CACHE, cache_miss_config(PERF_COUNT_HW_CACHE_L1I));
+#endif
+}
 
+static void counters_start(struct counters *counters)
+{
+#ifdef __linux__
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (counters->fd[i] < 0)
+            continue;
+        ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)counters;
+#endif
+}
+
+static void counters_stop(struct counters *counters)
+{
+#ifdef __linux__
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        counters->valid[i] = 0;
+        if (counters->fd[i] < 0)
+            continue;
+        ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        /* value, time enabled, time running */
+        uint64_t data[3];
+        if (read(counters->fd[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+            continue;
+
+        counters->value[i] = data[0];
+        if (data[2] < data[1])
+            counters->value[i] = (uint64_t)((double)data[0] * data[1] / data[2]);
+        counters->valid[i] = 1;
+    }
+#else
+    (void)counters;
+#endif
+}
+
+static void counters_close(struct counters *counters)
+{
+#ifdef __linux__
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (counters->fd[i] >= 0)
+            close(counters->fd[i]);
+    }
+#else
+    (void)counters;
+#endif
+}
+
+static double elapsed_seconds(struct timespec start, struct timespec end)
+{
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+}
+
+static void print_counter(const struct counters *counters, enum counter counter)
+{
+    if (counters->valid[counter])
+        printf(" %14llu", (unsigned long long)counters->value[counter]);
+    else
+        printf(" %14s", "n/a");
+}
+
+static void run_engine(const struct chip8_engine *engine, const char *filename, uint64_t num_cycles,
+                       struct counters *counters)
+{
     struct chip8 chip8;
     chip8_init(&chip8, START_ADDRESS);
-    chip8_load_rom(&chip8, argv[1]);
+    chip8_load_rom(&chip8, filename);
+    chip8_seed(&chip8, 1);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    counters_start(counters);
+
+    for (uint64_t i = 0; i < num_cycles; i++)
+        engine->cycle(&chip8);
+
+    counters_stop(counters);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = elapsed_seconds(start, end);
+    printf("%-28.28s %-14s %9.3f %10.2f", filename, engine->name, seconds, num_cycles / seconds / 1000000.0);
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        print_counter(counters, i);
+
+    if (counters->valid[COUNTER_CYCLES] && counters->valid[COUNTER_INSTRUCTIONS] && counters->value[COUNTER_CYCLES])
+        printf(" %6.2f", (double)counters->value[COUNTER_INSTRUCTIONS] / counters->value[COUNTER_CYCLES]);
+    else
+        printf(" %6s", "n/a");
+
+    /* Mispredictions per emulated instruction is the number to watch when changing dispatch */
+    if (counters->valid[COUNTER_BRANCH_MISSES])
+        printf(" %10.4f", (double)counters->value[COUNTER_BRANCH_MISSES] / num_cycles);
+    else
+        printf(" %10s", "n/a");
+    printf("\n");
+
+#ifdef CHIP8_PROFILE
+    profile_report(&chip8, stdout, 10);
+#endif
+    chip8_engine_release(engine, &chip8);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t num_cycles = NUM_CYCLES;
+    const char *engine_name = NULL;
+    int first_rom = 1;
+
+    /* Usage: [-n cycles] [-e engine] <rom>... */
+    while (first_rom < argc && argv[first_rom][0] == '-')
+    {
+        if (!strcmp(argv[first_rom], "-n") && first_rom + 1 < argc)
+            num_cycles = strtoull(argv[first_rom + 1], NULL, 10);
+        else if (!strcmp(argv[first_rom], "-e") && first_rom + 1 < argc)
+            engine_name = argv[first_rom + 1];
+        else
+            break;
+        first_rom += 2;
+    }
 
-    uint32_t i = 0;
-    clock_t start_fptr_tables = clock();
-    while (i < NUM_CYCLES)
+    if (first_rom >= argc || num_cycles == 0)
     {
-        test_chip8_fptr_cycle(&chip8);
-        i++;
+        printf("Usage: %s [-n cycles] [-e engine] <path/to/rom>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct counters counters;
+    counters_open(&counters);
+
+    int available = 0;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (counters.fd[i] >= 0)
+            available++;
+        else
+            fprintf(stderr, "Warning: hardware counter %s is unavailable\n", counter_names[i]);
+    }
+    if (!available)
+        fprintf(stderr, "Warning: no hardware counters (check /proc/sys/kernel/perf_event_paranoid), "
+                        "reporting wall time only\n");
+
+    printf("%-28s %-14s %9s %10s", "rom", "engine", "time(s)", "Mops/s");
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        printf(" %14s", counter_names[i]);
+    printf(" %6s %10s\n", "IPC", "bmiss/op");
+
+    for (int rom = first_rom; rom < argc; rom++)
+    {
+        const struct chip8_engine *engine;
+        for (uint32_t e = 0; (engine = chip8_engine_get(e)); e++)
+        {
+            if (!engine_name || !strcmp(engine_name, engine->name))
+                run_engine(engine, argv[rom], num_cycles, &counters);
+        }
+        if (!engine_name || !strcmp(engine_name, switch_inline_engine.name))
+            run_engine(&switch_inline_engine, argv[rom], num_cycles, &counters);
     }
 
-    clock_t end_fptr_tables = clock();
-    double ptr_elapsed_time = ((double)(end_fptr_tables - start_fptr_tables)) / CLOCKS_PER_SEC;
-
-    // clock_t start_switch = clock();
-    // while (i < NUM_CYCLES)
-    // {
-            // test_chip8_switch_cycle(&chip8);
-            // i++;
-    // }
-    // clock_t end_switch = clock();
-    // double switch_elapsed_time = ((double)(end_switch - start_switch)) / CLOCKS_PER_SEC;
-
-    printf("Function pointer table execution time: %f seconds\n", ptr_elapsed_time);
-    // printf("Switch statement execution time: %f seconds\n", switch_elapsed_time);
-    // printf("Average time per cycle: %f seconds\n", ptr_elapsed_time / NUM_CYCLES);
+    counters_close(&counters);
+    return EXIT_SUCCESS;
 }
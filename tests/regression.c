@@ -0,0 +1,531 @@
+#include "chip8.h"
+#include "engine.h"
+#include "input_script.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Golden-frame regression runner: runs every ROM of a corpus headless, one process per ROM and as many
+ * in parallel as there are cores, with a fixed seed and input script. The display hash at chosen frames
+ * and the exit status are compared against a golden file */
+
+#define DEFAULT_CORPUS "roms"
+#define DEFAULT_GOLDEN "tests/golden.txt"
+#define DEFAULT_SCRIPT "tests/regression.keys"
+#define DEFAULT_FRAMES "60,300,600,1200,1800"
+#define DEFAULT_CYCLES_PER_FRAME 12
+#define MAX_CHECKPOINTS 32
+/* Result lines of one ROM: one per checkpoint plus the exit status */
+#define RESULT_SIZE ((MAX_CHECKPOINTS + 1) * 32)
+
+struct config
+{
+    const struct chip8_engine *engine;
+    const char *script_file; /* Input script for ROMs without their own .keys file, empty for none */
+    uint32_t frames[MAX_CHECKPOINTS];
+    uint32_t frame_count;
+    uint32_t cycles_per_frame;
+    uint32_t seed;
+    uint8_t verbose;
+};
+
+struct rom
+{
+    char path[1024];
+    char result[RESULT_SIZE]; /* "<frame> <hash>" lines, then "exit <status>" */
+    size_t result_length;
+    const char *golden; /* Expected result, NULL if the ROM is new */
+    double elapsed_ms;
+    pid_t pid;
+    int fd;
+};
+
+struct corpus
+{
+    struct rom *roms;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+static double now_ms(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+static int has_extension(const char *name, const char *extension)
+{
+    size_t length = strlen(name), extension_length = strlen(extension);
+    return length > extension_length && !strcmp(name + length - extension_length, extension);
+}
+
+/* Collect the .ch8 files under a directory, recursively */
+static void corpus_scan(struct corpus *corpus, const char *directory)
+{
+    DIR *dir = opendir(directory);
+    if (!dir)
+    {
+        fprintf(stderr, "Error: failed to open %s: %s\n", directory, strerror(errno));
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+
+        struct stat info;
+        if (stat(path, &info))
+            continue;
+
+        if (S_ISDIR(info.st_mode))
+        {
+            corpus_scan(corpus, path);
+        }
+        else if (S_ISREG(info.st_mode) && has_extension(entry->d_name, ".ch8"))
+        {
+            if (corpus->count == corpus->capacity)
+            {
+                corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 64;
+                corpus->roms = realloc(corpus->roms, corpus->capacity * sizeof(*corpus->roms));
+                if (!corpus->roms)
+                {
+                    fprintf(stderr, "Error: out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            struct rom *rom = &corpus->roms[corpus->count++];
+            memset(rom, 0, sizeof(*rom));
+            snprintf(rom->path, sizeof(rom->path), "%s", path);
+        }
+    }
+    closedir(dir);
+}
+
+static int compare_roms(const void *a, const void *b)
+{
+    return strcmp(((const struct rom *)a)->path, ((const struct rom *)b)->path);
+}
+
+/* Run one ROM and write its checkpoint hashes to fd. Runs in the worker process, so the core is free
+ * to exit() on a fatal opcode; the parent reads that from the exit status */
+static void run_rom(const struct config *config, const char *path, int fd)
+{
+    /* A ROM can carry its own input next to it as <name>.keys */
+    char script_file[1024];
+    snprintf(script_file, sizeof(script_file), "%.*s.keys", (int)(strlen(path) - strlen(".ch8")), path);
+    if (access(script_file, R_OK))
+        snprintf(script_file, sizeof(script_file), "%s", config->script_file);
+
+    struct input_script script = {NULL, 0};
+    if (script_file[0] && !input_script_load(&script, script_file, config->cycles_per_frame))
+    {
+        fprintf(stderr, "Error: failed to load input script %s\n", script_file);
+        exit(EXIT_FAILURE);
+    }
+
+    static struct chip8 chip8;
+    chip8_init(&chip8, START_ADDRESS);
+    chip8_load_rom(&chip8, path);
+    chip8_seed(&chip8, config->seed);
+
+    uint32_t cursor = 0;
+    uint64_t cycle = 0;
+    uint32_t checkpoint = 0;
+    for (uint32_t frame = 1; checkpoint < config->frame_count; frame++)
+    {
+        for (uint32_t i = 0; i < config->cycles_per_frame; i++, cycle++)
+        {
+            cursor = input_script_apply(&script, cursor, cycle, &chip8);
+            config->engine->cycle(&chip8);
+        }
+        /* 00FD ends the run like the exit it stands for, the hashes stop there */
+        if (chip8.halted)
+            break;
+        chip8_update_timers(&chip8);
+
+        if (frame == config->frames[checkpoint])
+        {
+            /* One line per write, so the result is complete up to a fatal opcode */
+            char line[32];
+            int length = snprintf(line, sizeof(line), "%u %016llx\n", frame,
+                                  (unsigned long long)chip8_hash_display(&chip8));
+            if (write(fd, line, length) != length)
+                exit(EXIT_FAILURE);
+            checkpoint++;
+        }
+    }
+    chip8_engine_release(config->engine, &chip8);
+    input_script_free(&script);
+}
+
+static void rom_start(const struct config *config, struct rom *rom)
+{
+    int fds[2];
+    if (pipe(fds))
+    {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    rom->elapsed_ms = now_ms();
+    rom->pid = fork();
+    if (rom->pid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!rom->pid)
+    {
+        close(fds[0]);
+        if (!config->verbose)
+        {
+            /* The core reports fatal opcodes on stderr */
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        run_rom(config, rom->path, fds[1]);
+        /* Not _exit: instrumented builds write their profile at exit (see make release-pgo) */
+        exit(EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    rom->fd = fds[0];
+}
+
+/* Collect the output and exit status of a finished worker */
+static void rom_finish(struct rom *rom, int status)
+{
+    rom->elapsed_ms = now_ms() - rom->elapsed_ms;
+
+    ssize_t length;
+    while ((length = read(rom->fd, rom->result + rom->result_length,
+                          sizeof(rom->result) - rom->result_length - 1)) > 0)
+        rom->result_length += length;
+    close(rom->fd);
+
+    if (WIFEXITED(status))
+        snprintf(rom->result + rom->result_length, sizeof(rom->result) - rom->result_length, "exit %d\n",
+                 WEXITSTATUS(status));
+    else
+        snprintf(rom->result + rom->result_length, sizeof(rom->result) - rom->result_length, "signal %d\n",
+                 WTERMSIG(status));
+    rom->result_length = strlen(rom->result);
+}
+
+/* Run all ROMs, at most jobs at a time */
+static void corpus_run(const struct config *config, struct corpus *corpus, uint32_t jobs)
+{
+    uint32_t next = 0, running = 0;
+    while (next < corpus->count || running)
+    {
+        if (next < corpus->count && running < jobs)
+        {
+            rom_start(config, &corpus->roms[next++]);
+            running++;
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+        {
+            perror("wait");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Workers write a few hundred bytes at most, well under the pipe capacity, so reading
+         * after they exit cannot deadlock */
+        for (uint32_t i = 0; i < next; i++)
+        {
+            if (corpus->roms[i].pid == pid)
+            {
+                rom_finish(&corpus->roms[i], status);
+                corpus->roms[i].pid = 0;
+                running--;
+                break;
+            }
+        }
+    }
+}
+
+/* Golden file format: "<rom path>\t<result line>" per line, in corpus order. Lines starting with # are ignored
+ * @return the file contents, NULL if there is no golden file */
+static char *golden_load(const char *filename, struct corpus *corpus)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    /* Room for the result strings, which are rebuilt in place without the paths */
+    char *contents = malloc(size + 1);
+    char *results = malloc(size + corpus->count + 1);
+    if (!contents || !results || fread(contents, 1, size, file) != (size_t)size)
+    {
+        fclose(file);
+        free(contents);
+        free(results);
+        return NULL;
+    }
+    fclose(file);
+    contents[size] = '\0';
+
+    /* Concatenate the lines of each ROM into one result string */
+    char *out = results;
+    struct rom *rom = NULL;
+    for (char *line = strtok(contents, "\r\n"); line; line = strtok(NULL, "\r\n"))
+    {
+        char *tab = strchr(line, '\t');
+        if (line[0] == '#' || !tab)
+            continue;
+        *tab = '\0';
+
+        if (!rom || strcmp(rom->path, line))
+        {
+            *out++ = '\0';
+            rom = NULL;
+            for (uint32_t i = 0; i < corpus->count && !rom; i++)
+                if (!strcmp(corpus->roms[i].path, line))
+                    rom = &corpus->roms[i];
+            if (rom)
+                rom->golden = out;
+            else
+                fprintf(stderr, "Warning: %s is in the golden file but not in the corpus\n", line);
+        }
+        if (rom)
+            out += sprintf(out, "%s\n", tab + 1);
+    }
+    *out = '\0';
+
+    free(contents);
+    return results;
+}
+
+static int8_t golden_write(const char *filename, const struct config *config, const struct corpus *corpus,
+                           const char *frames)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        return 0;
+
+    fprintf(file, "# Regression runner golden results, regenerate with: regression -u\n");
+    fprintf(file, "# frames %s, %u instructions per frame, seed %u, input %s\n", frames, config->cycles_per_frame,
+            config->seed, config->script_file[0] ? config->script_file : "none");
+    for (uint32_t i = 0; i < corpus->count; i++)
+    {
+        const struct rom *rom = &corpus->roms[i];
+        for (const char *line = rom->result; *line;)
+        {
+            const char *end = strchr(line, '\n');
+            fprintf(file, "%s\t%.*s\n", rom->path, (int)(end - line), line);
+            line = end + 1;
+        }
+    }
+    return !fclose(file);
+}
+
+/* Print the first line that differs between a result and its golden value */
+static void print_mismatch(const struct rom *rom)
+{
+    const char *actual = rom->result, *expected = rom->golden;
+    while (*actual && *expected)
+    {
+        size_t actual_length = strcspn(actual, "\n"), expected_length = strcspn(expected, "\n");
+        if (actual_length != expected_length || strncmp(actual, expected, actual_length))
+            break;
+        actual += actual_length + 1;
+        expected += expected_length + 1;
+    }
+    printf("  expected: %.*s\n  actual:   %.*s\n", (int)strcspn(expected, "\n"), expected,
+           (int)strcspn(actual, "\n"), actual);
+}
+
+/* @return 0 if the frame list is invalid */
+static int8_t parse_frames(const char *list, struct config *config)
+{
+    config->frame_count = 0;
+    for (const char *c = list; *c;)
+    {
+        char *end;
+        unsigned long frame = strtoul(c, &end, 10);
+        if (end == c || !frame || config->frame_count == MAX_CHECKPOINTS ||
+            (config->frame_count && frame <= config->frames[config->frame_count - 1]))
+            return 0;
+
+        config->frames[config->frame_count++] = frame;
+        c = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',')
+            return 0;
+    }
+    return config->frame_count > 0;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options] [corpus directory (default: %s)]\n"
+           "Options:\n"
+           "  -g <file>     Golden file (default: %s)\n"
+           "  -u            Write the results to the golden file instead of comparing\n"
+           "  -F <frames>   Comma separated frames to hash the display at, the last one ends the run\n"
+           "                (default: %s)\n"
+           "  -f <cycles>   Instructions per 60 Hz frame (default: %d)\n"
+           "  -s <seed>     CXNN random seed (default: 1)\n"
+           "  -i <script>   Input script for ROMs without a <rom>.keys file next to them (default: %s)\n"
+           "  -e <engine>   Execution engine (default: switch)\n"
+           "  -j <jobs>     ROMs run in parallel (default: number of cores)\n"
+           "  -t <ms>       Fail if the corpus takes longer than this\n"
+           "  -v            Show the output of the ROM runs\n",
+           program, DEFAULT_CORPUS, DEFAULT_GOLDEN, DEFAULT_FRAMES, DEFAULT_CYCLES_PER_FRAME, DEFAULT_SCRIPT);
+}
+
+int main(int argc, char **argv)
+{
+    struct config config = {chip8_engine_find("switch"), DEFAULT_SCRIPT, {0}, 0, DEFAULT_CYCLES_PER_FRAME, 1, 0};
+    const char *golden_file = DEFAULT_GOLDEN;
+    const char *frames = DEFAULT_FRAMES;
+    uint8_t update = 0;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    double budget_ms = 0;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && strlen(argv[arg]) == 2; arg++)
+    {
+        /* Flags without a value */
+        if (argv[arg][1] == 'u' || argv[arg][1] == 'v')
+        {
+            if (argv[arg][1] == 'u')
+                update = 1;
+            else
+                config.verbose = 1;
+            continue;
+        }
+
+        if (arg + 1 >= argc)
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        const char *value = argv[++arg];
+        switch (argv[arg - 1][1])
+        {
+        case 'g':
+            golden_file = value;
+            break;
+        case 'F':
+            frames = value;
+            break;
+        case 'f':
+            config.cycles_per_frame = strtoul(value, NULL, 10);
+            break;
+        case 's':
+            config.seed = strtoul(value, NULL, 0);
+            break;
+        case 'i':
+            config.script_file = value;
+            break;
+        case 'e':
+            config.engine = chip8_engine_find(value);
+            break;
+        case 'j':
+            jobs = strtol(value, NULL, 10);
+            break;
+        case 't':
+            budget_ms = strtod(value, NULL);
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - arg > 1 || !config.engine || !config.cycles_per_frame || jobs < 1 || !parse_frames(frames, &config))
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct corpus corpus = {NULL, 0, 0};
+    corpus_scan(&corpus, arg < argc ? argv[arg] : DEFAULT_CORPUS);
+    if (!corpus.count)
+    {
+        fprintf(stderr, "Error: no ROMs found\n");
+        return EXIT_FAILURE;
+    }
+    qsort(corpus.roms, corpus.count, sizeof(*corpus.roms), compare_roms);
+
+    /* Flush before forking, so the workers do not repeat buffered output */
+    fflush(stdout);
+    double start_ms = now_ms();
+    corpus_run(&config, &corpus, jobs);
+    double total_ms = now_ms() - start_ms;
+
+    if (update)
+    {
+        if (!golden_write(golden_file, &config, &corpus, frames))
+        {
+            fprintf(stderr, "Error: failed to write %s\n", golden_file);
+            return EXIT_FAILURE;
+        }
+        printf("Wrote %u ROMs to %s in %.0f ms\n", corpus.count, golden_file, total_ms);
+        free(corpus.roms);
+        return EXIT_SUCCESS;
+    }
+
+    char *golden = golden_load(golden_file, &corpus);
+    if (!golden)
+        fprintf(stderr, "Warning: no golden file at %s, run with -u to create it\n", golden_file);
+
+    uint32_t failed = 0, slowest = 0;
+    for (uint32_t i = 0; i < corpus.count; i++)
+    {
+        const struct rom *rom = &corpus.roms[i];
+        if (rom->elapsed_ms > corpus.roms[slowest].elapsed_ms)
+            slowest = i;
+
+        if (!rom->golden)
+        {
+            printf("NEW   %s\n", rom->path);
+            failed++;
+        }
+        else if (strcmp(rom->result, rom->golden))
+        {
+            printf("FAIL  %s\n", rom->path);
+            print_mismatch(rom);
+            failed++;
+        }
+        else if (config.verbose)
+        {
+            printf("ok    %s (%.1f ms)\n", rom->path, rom->elapsed_ms);
+        }
+    }
+
+    printf("%u/%u ROMs match, %.0f ms with %ld jobs (slowest: %s, %.1f ms)\n", corpus.count - failed, corpus.count,
+           total_ms, jobs, corpus.roms[slowest].path, corpus.roms[slowest].elapsed_ms);
+
+    int8_t over_budget = budget_ms > 0 && total_ms > budget_ms;
+    if (over_budget)
+        printf("FAIL  time budget of %.0f ms exceeded\n", budget_ms);
+
+    free(golden);
+    free(corpus.roms);
+    return failed || over_budget ? EXIT_FAILURE : EXIT_SUCCESS;
+}
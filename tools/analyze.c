@@ -0,0 +1,100 @@
+#include "analysis.h"
+#include "rom_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Static analysis of a ROM without running it: writes the code/data map, basic blocks, loops, issues and detected
+ * platform as JSON to stdout and optionally the control-flow graph as DOT. Exits with 2 if reachable code holds an
+ * unknown opcode */
+
+#define EXIT_UNKNOWN_OPCODE 2
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] <rom>\n", name);
+    printf("  -d <file.dot>    Also write the control-flow graph in Graphviz DOT\n");
+    printf("  -s <symbols>     Name DOT blocks with labels, one \"label 0xADDR\" per line\n");
+    printf("  -c <directory>   Keep the analysis in a cache directory, keyed by the ROM contents\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *rom = NULL, *dot_path = NULL, *symbols_path = NULL, *cache = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-d") && i + 1 < argc)
+            dot_path = argv[++i];
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            symbols_path = argv[++i];
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+            cache = argv[++i];
+        else if (argv[i][0] != '-' && !rom)
+            rom = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!rom)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct symbols symbols = {0};
+    if (symbols_path && !symbols_load(&symbols, symbols_path))
+    {
+        fprintf(stderr, "Error: Failed to read symbols from %s\n", symbols_path);
+        return EXIT_FAILURE;
+    }
+
+    /* Same entry point as the emulator */
+    static struct chip8 chip8;
+    static struct analysis analysis;
+    struct rom_image image;
+    chip8_init(&chip8, START_ADDRESS);
+    const char *error = rom_image_open(&image, rom);
+    if (!error)
+        error = chip8_load_image(&chip8, image.data, image.size);
+    if (error)
+    {
+        fprintf(stderr, "Error: %s\n", error);
+        rom_image_close(&image);
+        symbols_free(&symbols);
+        return EXIT_FAILURE;
+    }
+
+    int8_t result = rom_cache_analysis(cache, &image, &chip8, &analysis);
+    rom_image_close(&image);
+    if (result < 0)
+    {
+        fprintf(stderr, "Error: Out of memory\n");
+        symbols_free(&symbols);
+        return EXIT_FAILURE;
+    }
+
+    analysis_write_json(&analysis, &chip8, stdout);
+
+    int status = analysis_count_issues(&analysis, ANALYSIS_UNKNOWN_OPCODE) ? EXIT_UNKNOWN_OPCODE : EXIT_SUCCESS;
+    if (dot_path)
+    {
+        FILE *dot = fopen(dot_path, "w");
+        if (dot)
+        {
+            analysis_write_dot(&analysis, symbols_path ? &symbols : NULL, dot);
+            fclose(dot);
+        }
+        else
+        {
+            fprintf(stderr, "Error: Failed to open %s\n", dot_path);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    analysis_free(&analysis);
+    symbols_free(&symbols);
+    return status;
+}
@@ -0,0 +1,55 @@
+#include "opcode.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Turns a binary trace dump written by cilly --trace into one line per instruction */
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        printf("Usage: %s <trace dump>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Failed to open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    struct trace_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)))
+    {
+        fprintf(stderr, "Error: %s is not a cilly trace\n", argv[1]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(struct trace_record))
+    {
+        fprintf(stderr, "Error: unsupported trace version %u (record size %u)\n", header.version, header.record_size);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    printf("# %u records, last cycle %llu\n", header.count, (unsigned long long)header.cycle);
+    printf("#        cycle pc    op   class I     VX     VF\n");
+
+    /* Records only keep the low 32 bits of the cycle, rebuild the rest from the newest one */
+    uint64_t first_cycle = header.cycle - (header.count ? header.count - 1 : 0);
+    struct trace_record record;
+    for (uint32_t i = 0; i < header.count && fread(&record, sizeof(record), 1, file) == 1; i++)
+    {
+        uint64_t cycle = ((first_cycle + i) & ~0xFFFFFFFFull) | record.cycle;
+        uint8_t x = (record.opcode >> 8) & 0xF;
+
+        printf("%14llu 0x%03x %04x %s 0x%03x V%X=%02x %02x\n", (unsigned long long)cycle, record.pc, record.opcode,
+               chip8_op_name(chip8_op_classify(record.opcode)), record.I, x, record.vx, record.vf);
+    }
+
+    fclose(file);
+    return EXIT_SUCCESS;
+}